@@ -1,9 +1,12 @@
 #pragma once
 #include "who_recognition_app_lcd.hpp"
 #include "who_recognition.hpp"
+#include "who_face_tracker.hpp"
+#include "who_decision.hpp"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "esp_heap_caps.h"
 #include <cstdlib>
@@ -22,94 +25,117 @@ extern "C" bool net_send_http_plain_async(const char *ip, uint16_t port, const c
 class MyRecognitionApp : public who::app::WhoRecognitionAppLCD {
 public:
     explicit MyRecognitionApp(who::frame_cap::WhoFrameCap *frame_cap)
-        : who::app::WhoRecognitionAppLCD(frame_cap)
+        : who::app::WhoRecognitionAppLCD(frame_cap), m_state_mutex(xSemaphoreCreateMutex()),
+          m_decision(get_decision_config())
 
     {
+#if CONFIG_DETECT_MOTION_GATE
+        // Nobody is at the door most of the time, only detect at full rate when something moves
+        m_recognition->get_detect_task()->set_motion_gate(CONFIG_DETECT_IDLE_FPS, CONFIG_DETECT_ACTIVE_MS);
+#endif
+#if CONFIG_DETECT_ROI_TRACKING
+        // Someone standing at the door barely moves, so only look around where the face was
+        m_recognition->get_detect_task()->set_roi_tracking(CONFIG_DETECT_ROI_EXPAND_PERCENT / 100.f,
+                                                           CONFIG_DETECT_ROI_FULL_SCAN_INTERVAL);
+#endif
+        // Several people at the door are recognized together instead of one after the other
+        m_recognition->get_recognition_task()->set_max_faces(CONFIG_RECOGNITION_MAX_FACES);
+#if CONFIG_RECOGNITION_FILTER
+        // People walking up to the door are far away or look aside first, don't waste feature runs on them
+        m_recognition->get_recognition_task()->set_face_filter({CONFIG_RECOGNITION_FILTER_MIN_BOX_AREA,
+                                                                CONFIG_RECOGNITION_FILTER_MIN_EYE_DIST,
+                                                                CONFIG_RECOGNITION_FILTER_MAX_YAW_PERCENT / 100.f,
+                                                                CONFIG_RECOGNITION_FILTER_MAX_DEFER_FRAMES});
+#endif
+        // A template averaged over the sharpest frontal frames gets recognized at the door at the first try
+        m_recognition->get_recognition_task()->set_enroll_session(CONFIG_RECOGNITION_ENROLL_FRAMES,
+                                                                  CONFIG_RECOGNITION_ENROLL_BEST,
+                                                                  CONFIG_RECOGNITION_ENROLL_MIN_QUALITY / 100.f);
+        // Typed results for the door logic, the LCD app still gets the text for display
+        m_recognition->get_recognition_task()->set_result_cb(
+            std::bind(&MyRecognitionApp::recognition_typed_result_cb, this, std::placeholders::_1));
+    }
+
+    ~MyRecognitionApp() {
+        vSemaphoreDelete(m_state_mutex);
+    }
 
+    // Expose the recognition task for web control, commands are queued with send_command()
+    who::recognition::WhoRecognitionCore *get_recognition_core() const {
+        return m_recognition->get_recognition_task();
     }
 
-    // Expose recognition event group for web control
-    EventGroupHandle_t get_recognition_event_group() const {
-        return m_recognition->get_recognition_task()->get_event_group();
+    // Expose detect event group so external motion triggers can wake up detection
+    EventGroupHandle_t get_detect_event_group() const {
+        return m_recognition->get_detect_task()->get_event_group();
     }
 
 protected:
-    // Callback hijack to add logging and network sending
-    void recognition_result_cb(const std::string &result) override {
-        //display LCD for recognition result 
-        who::app::WhoRecognitionAppLCD::recognition_result_cb(result);
+    // Typed result callback for logging and network sending, no string is parsed on this path
+    void recognition_typed_result_cb(const who::recognition::WhoRecognitionCore::result_t &result) {
+        // Runs on the recognition task, the detect task reads the tracks at the same time
+        xSemaphoreTake(m_state_mutex, portMAX_DELAY);
+        // Every command ends with one result, the one of our recognize command lets the next one go.
+        bool ours = result.seq == m_recognize_seq;
+        if (ours) {
+            m_recognize_seq = -1;
+        }
+        // Only recognitions count towards the decision, enroll and delete results are shown on the LCD only.
+        // A skipped one is retried with the next frame.
+        if (result.type != who::recognition::WhoRecognitionCore::RECOGNIZE_RESULT) {
+            xSemaphoreGive(m_state_mutex);
+            return;
+        }
         // Informational log to see recognition results and time stamps
-        ESP_LOGI("Recognition", "%s", result.c_str());
-        const TickType_t one_sec = pdMS_TO_TICKS(1000);
-        TickType_t now_tick = xTaskGetTickCount();
-
-        // Parse results for id and similarity
-        bool cur_known = false;
-        int cur_id = -1;
-        float cur_sim = 0.0f;
-
-        // Checks for known or unknown 
-        if (result.find("id: ") != std::string::npos) {
-            int id = -1; float parsed_sim = 0.0f;
-            if (std::sscanf(result.c_str(), "id: %d, sim: %f", &id, &parsed_sim) == 2) {
-                cur_known = true;
-                cur_id = id;
-                cur_sim = parsed_sim;
+        for (int i = 0; i < result.num_faces; i++) {
+            const auto &face = result.faces[i];
+            ESP_LOGI("Recognition", "track %d, known %d, id %d, sim %.3f", face.track_id, face.id >= 0, face.id,
+                     face.similarity);
+        }
+
+        // The identities stick to the tracks of the recognized faces until the next re-verify
+        if (ours) {
+            for (int i = 0; i < result.num_faces; i++) {
+                const auto &face = result.faces[i];
+                m_tracker.set_identity(face.track_id, face.id, face.similarity);
             }
-        } else if (result.find("who?") != std::string::npos) {
-            cur_known = false;
         }
 
-        // Require same outcome for 1s before posting
-        if (m_stable_first) {
-            m_stable_first = false;
-            m_stable_known = cur_known;
-            m_stable_id = cur_id;
-            m_stable_sim = cur_sim;
-            m_stable_start_tick = now_tick;
-            m_stable_sent = false;
-            m_last_stable_post_tick = 0;
-            return;
+        // Only the face of the decision track votes. faces[0] may be someone behind it when the front face was
+        // filtered out, and a frame without the decision track has no vote at all.
+        for (int i = 0; i < result.num_faces; i++) {
+            const auto &face = result.faces[i];
+            if (face.track_id >= 0 && face.track_id == m_decision_track) {
+                update_decision(face.id, face.similarity);
+                break;
+            }
         }
+        xSemaphoreGive(m_state_mutex);
+    }
 
-        // Different outcome: reset stability timer
-        if (m_stable_known != cur_known || m_stable_id != cur_id) {
-            m_stable_known = cur_known;
-            m_stable_id = cur_id;
-            m_stable_sim = cur_sim;
-            m_stable_start_tick = now_tick;
-            m_stable_sent = false;
-            m_last_stable_post_tick = 0;
+    // Voting over the last results, fed by recognitions and by every frame of a tracked face which already has an
+    // identity. The windows and thresholds are set in menuconfig.
+    void update_decision(int cur_id, float cur_sim) {
+        auto decision = m_decision.update(cur_id, cur_sim, pdTICKS_TO_MS(xTaskGetTickCount()));
+        if (!decision.send) {
             return;
         }
-
-        // Same outcome: send post
-        if (now_tick - m_stable_start_tick >= one_sec) {
-            bool should_send = false;
-            if (!m_stable_sent) {
-                should_send = true; // first send after stable
-            } else if (now_tick - m_stable_start_tick >= pdMS_TO_TICKS(5000)) {
-                should_send = true; // periodic resend every 5s
-            }
-            if (should_send) {
-                // By information logging here, we can check timestamps to ensure the logic is correct
-                ESP_LOGI("Recognition", "Sending Results now: %s", result.c_str());
-                if (m_stable_known) {
-                    char body[64];
-                    // snprintf for the authorized to add similarity score
-                    int n = std::snprintf(body, sizeof(body), "authorized,%.2f", m_stable_sim);
-                    if (n > 0) {
-                        if (n >= (int)sizeof(body)) n = (int)sizeof(body) - 1;
-                        net_send_http_plain_async(ESP32_Receiver_IP, ESP32_Receiver_Port, ESP32_Receiver_Path, body, (size_t)n);
-                    }
-                } else {
-                    // similarity score will be 0 for unknowns 
-                    const char *body = "denied,0";
-                    net_send_http_plain_async(ESP32_Receiver_IP, ESP32_Receiver_Port, ESP32_Receiver_Path, body, strlen(body));
-                }
-                m_stable_sent = true;
-                m_last_stable_post_tick = now_tick;
+        bool known = decision.outcome == who::decision::WhoDecision::ACCEPT;
+        // By information logging here, we can check timestamps to ensure the logic is correct
+        ESP_LOGI("Recognition", "Sending Results now: known %d, id %d, sim %.2f, conf %.2f", known, decision.id,
+                 decision.similarity, decision.confidence);
+        if (known) {
+            char body[64];
+            // snprintf for the authorized to add similarity score
+            int n = std::snprintf(body, sizeof(body), "authorized,%.2f", decision.similarity);
+            if (n > 0) {
+                if (n >= (int)sizeof(body)) n = (int)sizeof(body) - 1;
+                net_send_http_plain_async(ESP32_Receiver_IP, ESP32_Receiver_Port, ESP32_Receiver_Path, body, (size_t)n);
             }
+        } else {
+            // similarity score will be 0 for unknowns 
+            const char *body = "denied,0";
+            net_send_http_plain_async(ESP32_Receiver_IP, ESP32_Receiver_Port, ESP32_Receiver_Path, body, strlen(body));
         }
     }
 
@@ -117,11 +143,39 @@ protected:
     void detect_result_cb(const who::detect::WhoDetect::result_t &result) override {
         // display LCD but for detection bounding boxes
         who::app::WhoRecognitionAppLCD::detect_result_cb(result);
-        // If detected: auto trigger recognition as the app doesnt do this by default
-        if (!result.det_res.empty()) {
-            auto *rec_task = m_recognition->get_recognition_task();
-            xEventGroupSetBits(rec_task->get_event_group(), who::recognition::WhoRecognitionCore::RECOGNIZE);
+        xSemaphoreTake(m_state_mutex, portMAX_DELAY);
+        // Follow the faces between frames, the first face drives the door decision
+        auto track_ids = m_tracker.update(result.det_res);
+        m_front_track = track_ids.empty() ? -1 : track_ids[0];
+        // Votes of the person before don't count for someone else
+        if (m_front_track >= 0 && m_front_track != m_decision_track) {
+            m_decision.reset();
+            m_decision_track = m_front_track;
+        }
+        // Tags the faces if this frame is the one being recognized
+        m_recognition->get_recognition_task()->set_track_ids(track_ids);
+        if (m_front_track < 0 || m_recognize_seq >= 0) {
+            xSemaphoreGive(m_state_mutex);
+            return;
+        }
+        // Only recognize a face once when it shows up, then re-verify it now and then. All faces in view are
+        // recognized in one batch, so one new face is enough to trigger it.
+        bool needs_recognition = false;
+        for (size_t i = 0; i < track_ids.size() && i < CONFIG_RECOGNITION_MAX_FACES; i++) {
+            needs_recognition |=
+                m_tracker.needs_recognition(track_ids[i], pdMS_TO_TICKS(CONFIG_RECOGNITION_REVERIFY_MS));
+        }
+        if (needs_recognition) {
+            // Recognizes this frame or a later one, never an older frame still in the pipeline
+            m_recognize_seq = m_recognition->get_recognition_task()->send_command(
+                who::recognition::WhoRecognitionCore::RECOGNIZE, &result.timestamp);
+            xSemaphoreGive(m_state_mutex);
+            return;
         }
+        // Same person still in view: the tracked identity votes on every frame
+        const auto *track = m_tracker.get_track(m_front_track);
+        update_decision(track->face_id, track->similarity);
+        xSemaphoreGive(m_state_mutex);
     }
 
     // Add clean ups but not really used 
@@ -134,12 +188,14 @@ protected:
     }
 
 private:
-    // Recognition stability parameters 
-    bool m_stable_first {true};
-    bool m_stable_known {false};
-    int m_stable_id {-1};
-    float m_stable_sim {0.0f};
-    TickType_t m_stable_start_tick {0};
-    bool m_stable_sent {false};
-    TickType_t m_last_stable_post_tick {0};
-};
\ No newline at end of file
+    // Guards the tracks and the decision state, the detect and the recognition task run on different cores
+    SemaphoreHandle_t m_state_mutex;
+    who::detect::WhoFaceTracker m_tracker;
+    int m_front_track {-1};
+    // Sequence number of our pending recognize command, -1 if none
+    int m_recognize_seq {-1};
+
+    // Door decision, voted over the front track's results
+    who::decision::WhoDecision m_decision;
+    int m_decision_track {-1};
+};
@@ -7,6 +7,37 @@ WhoRecognitionAppBase::WhoRecognitionAppBase(frame_cap::WhoFrameCap *frame_cap)
 {
     WhoApp::add_task_group(m_frame_cap);
     WhoApp::add_task_group(m_recognition);
+    m_recognition->get_recognition_task()->set_queue_len(CONFIG_RECOGNITION_QUEUE_LEN);
+}
+
+decision::WhoDecision::config_t WhoRecognitionAppBase::get_decision_config()
+{
+    return {.window = CONFIG_DECISION_WINDOW,
+            .min_votes = CONFIG_DECISION_MIN_VOTES,
+            .accept_conf = CONFIG_DECISION_ACCEPT_PERCENT / 100.f,
+            .deny_conf = CONFIG_DECISION_DENY_PERCENT / 100.f,
+            .hold_ms = CONFIG_DECISION_HOLD_MS,
+            .resend_ms = CONFIG_DECISION_RESEND_MS};
+}
+
+recognition::WhoFaceRecognizer *WhoRecognitionAppBase::create_recognizer(bool lazy_load)
+{
+    auto model_type = static_cast<HumanFaceFeat::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_FEAT_MODEL);
+#if CONFIG_DB_PARTITION
+    return new recognition::WhoFaceDBRecognizer(
+        new HumanFaceFeat(model_type, lazy_load),
+        new face_db::WhoFaceDB(CONFIG_DB_PARTITION_LABEL, recognition::WhoFaceDBRecognizer::FEAT_LEN));
+#else
+    char db_path[64];
+#if CONFIG_DB_FATFS_FLASH
+    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_SPIFLASH_MOUNT_POINT);
+#elif CONFIG_DB_SPIFFS
+    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_BSP_SPIFFS_MOUNT_POINT);
+#else
+    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_BSP_SD_MOUNT_POINT);
+#endif
+    return new recognition::WhoHumanFaceRecognizer(new HumanFaceRecognizer(db_path, model_type, lazy_load));
+#endif
 }
 } // namespace app
 } // namespace who
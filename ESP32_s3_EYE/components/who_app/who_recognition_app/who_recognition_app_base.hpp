@@ -1,5 +1,6 @@
 #pragma once
 #include "who_app.hpp"
+#include "who_decision.hpp"
 #include "who_recognition.hpp"
 #include "who_recognition_button.hpp"
 
@@ -10,6 +11,11 @@ public:
     WhoRecognitionAppBase(frame_cap::WhoFrameCap *frame_cap);
 
 protected:
+    // Recognizer on the database selected by DB_FILE_SYSTEM.
+    static recognition::WhoFaceRecognizer *create_recognizer(bool lazy_load);
+    // Door decision voting set in menuconfig.
+    static decision::WhoDecision::config_t get_decision_config();
+
     frame_cap::WhoFrameCap *m_frame_cap;
     recognition::WhoRecognition *m_recognition;
 };
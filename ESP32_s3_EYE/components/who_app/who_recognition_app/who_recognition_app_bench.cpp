@@ -0,0 +1,178 @@
+#include "who_recognition_app_bench.hpp"
+#include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "human_face_detect.hpp"
+#include "who_yield2idle.hpp"
+#include <algorithm>
+
+static const char *TAG = "WhoRecognitionAppBench";
+
+namespace who {
+namespace app {
+WhoRecognitionAppBench::WhoRecognitionAppBench(frame_cap::WhoFrameCap *frame_cap) :
+    WhoRecognitionAppBase(frame_cap),
+    m_run_start_us(0),
+    m_first_detect_us(0),
+    m_last_detect_us(0),
+    m_detect_frames(0),
+    m_face_frames(0),
+    m_trigger_frame_us(0),
+    m_first_face_frame_us(0),
+    m_decision(get_decision_config())
+{
+    m_recognition_us.reserve(MAX_SAMPLES);
+    m_decision_us.reserve(MAX_SAMPLES);
+
+    m_recognition->set_recognizer(create_recognizer(false));
+    m_recognition->set_detect_model(
+        new HumanFaceDetect(static_cast<HumanFaceDetect::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_DETECT_MODEL), false));
+
+    auto recognition_task = m_recognition->get_recognition_task();
+    auto detect_task = m_recognition->get_detect_task();
+    recognition_task->set_result_cb(
+        std::bind(&WhoRecognitionAppBench::recognition_result_cb, this, std::placeholders::_1));
+    recognition_task->set_detect_result_cb(
+        std::bind(&WhoRecognitionAppBench::detect_result_cb, this, std::placeholders::_1));
+    detect_task->set_detect_result_cb(
+        std::bind(&WhoRecognitionAppBench::detect_result_cb, this, std::placeholders::_1));
+}
+
+bool WhoRecognitionAppBench::run()
+{
+    m_run_start_us = stats::WhoStats::now_us();
+    bool ret = WhoYield2Idle::get_instance()->run();
+    for (const auto &frame_cap_node : m_frame_cap->get_all_nodes()) {
+        ret &= frame_cap_node->run(4096, 2, 0);
+    }
+    ret &= m_recognition->get_detect_task()->run(3584, 2, CONFIG_RECOGNITION_DETECT_CORE);
+    ret &= m_recognition->get_recognition_task()->run(3584, 2, CONFIG_RECOGNITION_TASK_CORE);
+    return ret;
+}
+
+void WhoRecognitionAppBench::detect_result_cb(const detect::WhoDetect::result_t &result)
+{
+    // Called once per detected frame on the detect task, recognition_result_cb comes from the recognition task.
+    int64_t now = stats::WhoStats::now_us();
+    if (!m_first_detect_us) {
+        m_first_detect_us = now;
+    }
+    m_last_detect_us = now;
+    m_detect_frames++;
+    if (result.det_res.empty()) {
+        return;
+    }
+    m_face_frames++;
+    // One recognition at a time, like the door app.
+    if (!m_trigger_frame_us) {
+        m_trigger_frame_us = result.timestamp.tv_sec * 1000000LL + result.timestamp.tv_usec;
+        if (!m_first_face_frame_us) {
+            m_first_face_frame_us = m_trigger_frame_us.load();
+        }
+        m_recognition->get_recognition_task()->send_command(recognition::WhoRecognitionCore::RECOGNIZE,
+                                                            &result.timestamp);
+    }
+}
+
+void WhoRecognitionAppBench::recognition_result_cb(const recognition::WhoRecognitionCore::result_t &result)
+{
+    int64_t now = stats::WhoStats::now_us();
+    // Nothing was recognized, the next face frame triggers again.
+    if (result.type == recognition::WhoRecognitionCore::SKIP_RESULT) {
+        m_trigger_frame_us = 0;
+        return;
+    }
+    add_sample(m_recognition_us, now - (result.timestamp.tv_sec * 1000000LL + result.timestamp.tv_usec));
+    // Timed where the door app unlocks or denies. Then start over, as if the next person stepped in front.
+    auto decision = m_decision.update(result.ok ? result.id : -1, result.similarity, (uint32_t)(now / 1000));
+    if (decision.send) {
+        add_sample(m_decision_us, now - m_first_face_frame_us);
+        m_decision.reset();
+        m_first_face_frame_us = 0;
+    }
+    m_trigger_frame_us = 0;
+}
+
+void WhoRecognitionAppBench::add_sample(std::vector<uint32_t> &samples, int64_t us)
+{
+    if (samples.size() < MAX_SAMPLES) {
+        samples.push_back((uint32_t)us);
+    }
+}
+
+uint32_t WhoRecognitionAppBench::percentile(std::vector<uint32_t> samples, int p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    // Nearest rank.
+    size_t rank = (samples.size() * p + 99) / 100;
+    auto nth = samples.begin() + (rank ? rank - 1 : 0);
+    std::nth_element(samples.begin(), nth, samples.end());
+    return *nth;
+}
+
+bool WhoRecognitionAppBench::write_result(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s.", path);
+        return false;
+    }
+    // Taken from the first to the last detect result, so the time to load the models is not included.
+    int64_t detect_us = m_last_detect_us - m_first_detect_us;
+    float detect_fps = (detect_us > 0 && m_detect_frames > 1) ? (m_detect_frames - 1) * 1e6f / detect_us : 0;
+    // The minimum free size is tracked by the heap since boot, it includes the model loading.
+    size_t internal_total = heap_caps_get_total_size(MALLOC_CAP_INTERNAL);
+    size_t internal_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    size_t psram_total = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+    size_t psram_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"version\": \"%s\",\n", esp_app_get_description()->version);
+    fprintf(f, "  \"duration_ms\": %lld,\n", (stats::WhoStats::now_us() - m_run_start_us) / 1000);
+    fprintf(f, "  \"detect_frames\": %lu,\n", (unsigned long)m_detect_frames);
+    fprintf(f, "  \"face_frames\": %lu,\n", (unsigned long)m_face_frames);
+    fprintf(f, "  \"detect_fps\": %.2f,\n", detect_fps);
+    fprintf(f, "  \"recognitions\": %u,\n", (unsigned)m_recognition_us.size());
+    fprintf(f,
+            "  \"recognition_latency_us\": {\"p50\": %lu, \"p99\": %lu},\n",
+            (unsigned long)percentile(m_recognition_us, 50),
+            (unsigned long)percentile(m_recognition_us, 99));
+    fprintf(f, "  \"decisions\": %u,\n", (unsigned)m_decision_us.size());
+    fprintf(f,
+            "  \"decision_latency_us\": {\"p50\": %lu, \"p99\": %lu},\n",
+            (unsigned long)percentile(m_decision_us, 50),
+            (unsigned long)percentile(m_decision_us, 99));
+    fprintf(f, "  \"heap_internal_peak_bytes\": %u,\n", (unsigned)(internal_total - internal_min_free));
+    fprintf(f, "  \"heap_psram_peak_bytes\": %u,\n", (unsigned)(psram_total - psram_min_free));
+    // Every stage over the whole run, a stage which can't keep up drops frames.
+    float duration_s = (stats::WhoStats::now_us() - m_run_start_us) / 1e6f;
+    bool first = true;
+    fprintf(f, "  \"stages\": {");
+    stats::WhoStats::for_each([&](const stats::WhoStats &stage) {
+        fprintf(f,
+                "%s\n    \"%s\": {\"out_fps\": %.2f, \"dropped_fps\": %.2f}",
+                first ? "" : ",",
+                stage.get_name().c_str(),
+                duration_s > 0 ? stage.get_frames_out() / duration_s : 0,
+                duration_s > 0 ? stage.get_frames_dropped() / duration_s : 0);
+        first = false;
+    });
+    fprintf(f, "\n  }\n");
+    fprintf(f, "}\n");
+    bool ret = !ferror(f);
+    fclose(f);
+    if (ret) {
+        ESP_LOGI(TAG,
+                 "detect %.2f fps, recognition p50 %lu us, decision p99 %lu us. Result in %s.",
+                 detect_fps,
+                 (unsigned long)percentile(m_recognition_us, 50),
+                 (unsigned long)percentile(m_decision_us, 99),
+                 path);
+    } else {
+        ESP_LOGE(TAG, "Failed to write %s.", path);
+    }
+    return ret;
+}
+} // namespace app
+} // namespace who
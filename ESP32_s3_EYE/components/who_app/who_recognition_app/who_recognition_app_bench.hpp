@@ -0,0 +1,43 @@
+#pragma once
+#include "who_recognition_app_base.hpp"
+#include <atomic>
+#include <vector>
+
+namespace who {
+namespace app {
+// Headless recognition app for benchmarking. Every frame with a face triggers a recognition, the same way the door
+// app does, the results vote for the door decision and the timing of each step is recorded. Feed it a WhoFileCam pipeline to get comparable numbers between
+// builds, then stop it and write the result with write_result().
+class WhoRecognitionAppBench : public WhoRecognitionAppBase {
+public:
+    WhoRecognitionAppBench(frame_cap::WhoFrameCap *frame_cap);
+    bool run() override;
+    // Only call after stop(), the samples are written by the detect and recognition tasks.
+    bool write_result(const char *path);
+
+private:
+    static inline constexpr int MAX_SAMPLES = 2048;
+
+    void recognition_result_cb(const recognition::WhoRecognitionCore::result_t &result);
+    void detect_result_cb(const detect::WhoDetect::result_t &result);
+    static void add_sample(std::vector<uint32_t> &samples, int64_t us);
+    static uint32_t percentile(std::vector<uint32_t> samples, int p);
+
+    int64_t m_run_start_us;
+    int64_t m_first_detect_us;
+    int64_t m_last_detect_us;
+    uint32_t m_detect_frames;
+    uint32_t m_face_frames;
+    // Set by the detect task, cleared by the recognition task. The running recognition was triggered, and the
+    // current decision started, by a frame with this timestamp.
+    std::atomic<int64_t> m_trigger_frame_us;
+    std::atomic<int64_t> m_first_face_frame_us;
+    // Only used by the recognition task.
+    decision::WhoDecision m_decision;
+    // Frame timestamp to recognition result.
+    std::vector<uint32_t> m_recognition_us;
+    // First face frame to the sent decision.
+    std::vector<uint32_t> m_decision_us;
+};
+} // namespace app
+} // namespace who
@@ -13,16 +13,7 @@ WhoRecognitionAppLCD::WhoRecognitionAppLCD(frame_cap::WhoFrameCap *frame_cap) :
     WhoApp::add_task(m_lcd_disp);
     m_lcd_disp->set_lcd_disp_cb(std::bind(&WhoRecognitionAppLCD::lcd_disp_cb, this, std::placeholders::_1));
 
-    char db_path[64];
-#if CONFIG_DB_FATFS_FLASH
-    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_SPIFLASH_MOUNT_POINT);
-#elif CONFIG_DB_SPIFFS
-    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_BSP_SPIFFS_MOUNT_POINT);
-#else
-    snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_BSP_SD_MOUNT_POINT);
-#endif
-    m_recognition->set_recognizer(new HumanFaceRecognizer(
-        db_path, static_cast<HumanFaceFeat::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_FEAT_MODEL), false));
+    m_recognition->set_recognizer(create_recognizer(false));
     m_recognition->set_detect_model(
         new HumanFaceDetect(static_cast<HumanFaceDetect::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_DETECT_MODEL), false));
 
@@ -79,8 +70,8 @@ bool WhoRecognitionAppLCD::run()
         ret &= frame_cap_node->run(4096, 2, 0);
     }
     ret &= m_lcd_disp->run(2560, 2, 0);
-    ret &= m_recognition->get_detect_task()->run(3584, 2, 1);
-    ret &= m_recognition->get_recognition_task()->run(3584, 2, 1);
+    ret &= m_recognition->get_detect_task()->run(3584, 2, CONFIG_RECOGNITION_DETECT_CORE);
+    ret &= m_recognition->get_recognition_task()->run(3584, 2, CONFIG_RECOGNITION_TASK_CORE);
     return ret;
 }
 
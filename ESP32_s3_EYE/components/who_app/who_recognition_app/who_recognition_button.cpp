@@ -4,13 +4,13 @@ LV_FONT_DECLARE(montserrat_bold_26);
 
 namespace who {
 namespace button {
-WhoRecognitionButton::WhoRecognitionButton(task::WhoTask *task)
+WhoRecognitionButton::WhoRecognitionButton(recognition::WhoRecognitionCore *recognition)
 {
     m_btn_user_data = new btn_user_data_t[3];
-    m_btn_user_data[0] = {task, recognition::WhoRecognitionCore::RECOGNIZE};
-    m_btn_user_data[1] = {task, recognition::WhoRecognitionCore::ENROLL};
+    m_btn_user_data[0] = {recognition, recognition::WhoRecognitionCore::RECOGNIZE};
+    m_btn_user_data[1] = {recognition, recognition::WhoRecognitionCore::ENROLL};
     // Map delete button to clear-all instead of delete-last
-    m_btn_user_data[2] = {task, recognition::WhoRecognitionCore::CLEAR_ALL};
+    m_btn_user_data[2] = {recognition, recognition::WhoRecognitionCore::CLEAR_ALL};
 }
 
 WhoRecognitionButton::~WhoRecognitionButton()
@@ -59,8 +59,8 @@ WhoRecognitionButtonPhysical::~WhoRecognitionButtonPhysical()
 void WhoRecognitionButtonPhysical::btn_event_handler(void *button_handle, void *usr_data)
 {
     btn_user_data_t *user_data = reinterpret_cast<btn_user_data_t *>(usr_data);
-    if (user_data->task->is_active()) {
-        xEventGroupSetBits(user_data->task->get_event_group(), user_data->event);
+    if (user_data->recognition->is_active()) {
+        user_data->recognition->send_command(user_data->command);
     }
 }
 #endif
@@ -104,8 +104,8 @@ WhoRecognitionButtonLVGL::~WhoRecognitionButtonLVGL()
 void WhoRecognitionButtonLVGL::btn_event_handler(lv_event_t *e)
 {
     btn_user_data_t *user_data = reinterpret_cast<btn_user_data_t *>(lv_event_get_user_data(e));
-    if (user_data->task->is_active()) {
-        xEventGroupSetBits(user_data->task->get_event_group(), user_data->event);
+    if (user_data->recognition->is_active()) {
+        user_data->recognition->send_command(user_data->command);
     }
 }
 
@@ -7,10 +7,10 @@ namespace button {
 class WhoRecognitionButton {
 public:
     typedef struct {
-        task::WhoTask *task;
-        EventBits_t event;
+        recognition::WhoRecognitionCore *recognition;
+        recognition::WhoRecognitionCore::command_t command;
     } btn_user_data_t;
-    WhoRecognitionButton(task::WhoTask *task);
+    WhoRecognitionButton(recognition::WhoRecognitionCore *recognition);
     virtual ~WhoRecognitionButton();
 
 protected:
@@ -0,0 +1,124 @@
+// Allocation, alignment, exhaustion and stats of who_buf_pool, plus the frees it has to refuse: a pointer into the
+// middle of a slot, a pointer it does not own and a slot which is free already.
+#include "who_buf_pool.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+TickType_t s_host_tick = 0;
+
+static int s_errors = 0;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_errors++;
+    }
+}
+
+static void test_create()
+{
+    who_buf_pool_handle_t pool = nullptr;
+    who_buf_pool_config_t config = {};
+    config.name = "create";
+    config.slot_size = 100;
+    config.slot_count = 0;
+    check(who_buf_pool_create(&config, &pool) == ESP_ERR_INVALID_ARG, "create: no slots");
+    config.slot_count = 2;
+    config.align = 24;
+    check(who_buf_pool_create(&config, &pool) == ESP_ERR_INVALID_ARG, "create: align not a power of 2");
+    config.align = 64;
+    check(who_buf_pool_create(&config, &pool) == ESP_OK, "create: valid config");
+    check(who_buf_pool_get_slot_size(pool) == 128, "create: slot size rounded up to align");
+    who_buf_pool_delete(pool);
+}
+
+static void test_alloc_free()
+{
+    who_buf_pool_handle_t pool = nullptr;
+    who_buf_pool_config_t config = {};
+    config.name = "alloc";
+    config.slot_size = 100;
+    config.slot_count = 3;
+    check(who_buf_pool_create(&config, &pool) == ESP_OK, "alloc: create");
+    size_t slot_size = who_buf_pool_get_slot_size(pool);
+    check(slot_size == 112, "alloc: default align of 16");
+
+    std::vector<void *> bufs;
+    for (int i = 0; i < 3; i++) {
+        void *buf = who_buf_pool_alloc(pool, slot_size, 0);
+        check(buf && (uintptr_t)buf % 16 == 0, "alloc: aligned slot");
+        check(who_buf_pool_owns(pool, buf), "alloc: pool owns its slot");
+        // Slots don't overlap, a full write of one leaves the others alone.
+        memset(buf, i, slot_size);
+        bufs.push_back(buf);
+    }
+    for (int i = 0; i < 3; i++) {
+        check(((uint8_t *)bufs[i])[0] == i && ((uint8_t *)bufs[i])[slot_size - 1] == i, "alloc: slots are distinct");
+    }
+    check(!who_buf_pool_alloc(pool, 1, 0), "alloc: fails when every slot is taken");
+    check(!who_buf_pool_alloc(pool, slot_size + 1, 0), "alloc: fails above the slot size");
+
+    int local;
+    check(!who_buf_pool_owns(pool, &local), "free: pool does not own a stack address");
+    who_buf_pool_free(pool, (uint8_t *)bufs[1] + 1);
+    who_buf_pool_free(pool, &local);
+    check(!who_buf_pool_alloc(pool, 1, 0), "free: refused frees give nothing back");
+    who_buf_pool_free(pool, nullptr);
+
+    who_buf_pool_free(pool, bufs[1]);
+    void *again = who_buf_pool_alloc(pool, 1, 0);
+    check(again == bufs[1], "free: the freed slot is handed out again");
+
+    who_buf_pool_stats_t stats;
+    who_buf_pool_get_stats(pool, &stats);
+    check(stats.slot_count == 3 && stats.in_use == 3, "stats: in use");
+    check(stats.high_water == 3, "stats: high water");
+    check(stats.alloc_cnt == 4, "stats: alloc count");
+    check(stats.fail_cnt == 3, "stats: fail count");
+    who_buf_pool_print_stats(pool);
+
+    for (void *buf : bufs) {
+        who_buf_pool_free(pool, buf);
+    }
+    who_buf_pool_get_stats(pool, &stats);
+    check(stats.in_use == 0 && stats.high_water == 3, "stats: high water stays after the frees");
+    who_buf_pool_delete(pool);
+}
+
+static void test_double_free()
+{
+    who_buf_pool_handle_t pool = nullptr;
+    who_buf_pool_config_t config = {};
+    config.name = "double_free";
+    config.slot_size = 64;
+    config.slot_count = 2;
+    check(who_buf_pool_create(&config, &pool) == ESP_OK, "double free: create");
+    void *a = who_buf_pool_alloc(pool, 1, 0);
+    who_buf_pool_free(pool, a);
+    who_buf_pool_free(pool, a);
+    who_buf_pool_stats_t stats;
+    who_buf_pool_get_stats(pool, &stats);
+    check(stats.in_use == 0, "double free: in use does not go below 0");
+    void *b = who_buf_pool_alloc(pool, 1, 0);
+    void *c = who_buf_pool_alloc(pool, 1, 0);
+    check(b && c && b != c, "double free: the slot is not handed out twice");
+    check(!who_buf_pool_alloc(pool, 1, 0), "double free: no third slot");
+    who_buf_pool_free(pool, b);
+    who_buf_pool_free(pool, c);
+    who_buf_pool_delete(pool);
+}
+
+int main()
+{
+    test_create();
+    test_alloc_free();
+    test_double_free();
+    if (s_errors) {
+        printf("%d errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
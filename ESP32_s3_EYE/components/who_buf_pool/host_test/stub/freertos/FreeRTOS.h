@@ -0,0 +1,38 @@
+#pragma once
+// Just enough FreeRTOS for single threaded host tests. Time only moves when a test advances s_host_tick, delays
+// return right away.
+#include "sdkconfig.h"
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern TickType_t s_host_tick;
+#ifdef __cplusplus
+}
+#endif
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    return s_host_tick;
+}
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+    (void)ticks;
+}
+
+static inline void vTaskDelayUntil(TickType_t *prev_wake_time, TickType_t increment)
+{
+    *prev_wake_time += increment;
+}
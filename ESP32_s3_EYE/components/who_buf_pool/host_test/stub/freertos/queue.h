@@ -0,0 +1,57 @@
+#pragma once
+// FIFO queue without blocking, a receive on an empty queue fails at once whatever the timeout.
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    UBaseType_t head;
+    UBaseType_t count;
+    UBaseType_t len;
+    UBaseType_t item_size;
+    uint8_t *items;
+} host_queue_t;
+typedef host_queue_t *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(host_queue_t));
+    q->len = len;
+    q->item_size = item_size;
+    q->items = (uint8_t *)malloc(len * item_size);
+    return q;
+}
+
+static inline void vQueueDelete(QueueHandle_t q)
+{
+    free(q->items);
+    free(q);
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t timeout)
+{
+    (void)timeout;
+    if (q->count == q->len) {
+        return pdFAIL;
+    }
+    memcpy(q->items + (q->head + q->count) % q->len * q->item_size, item, q->item_size);
+    q->count++;
+    return pdPASS;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t timeout)
+{
+    (void)timeout;
+    if (!q->count) {
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    return q->count;
+}
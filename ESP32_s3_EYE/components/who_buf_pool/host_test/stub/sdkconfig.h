@@ -0,0 +1,3 @@
+#pragma once
+// The host tests build like the linux target.
+#define CONFIG_IDF_TARGET_LINUX 1
@@ -0,0 +1,187 @@
+#include "who_buf_pool.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "WhoBufPool";
+
+struct who_buf_pool_t {
+    const char *name;
+    uint8_t *block;
+    size_t slot_size;
+    uint16_t slot_count;
+    // Indexes of the free slots. A queue makes alloc/free thread safe and lets alloc block until a slot is freed.
+    QueueHandle_t free_slots;
+    // One flag per slot, a second free of a slot would queue its index twice and hand it out twice.
+    uint8_t *slot_in_use;
+    uint16_t in_use;
+    uint16_t high_water;
+    uint32_t alloc_cnt;
+    uint32_t fail_cnt;
+};
+
+static void *block_alloc(size_t align, size_t size, uint32_t caps)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    (void)caps;
+    void *p = NULL;
+    return posix_memalign(&p, align, size) == 0 ? p : NULL;
+#else
+    return heap_caps_aligned_alloc(align, size, caps);
+#endif
+}
+
+static void block_free(void *p)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    free(p);
+#else
+    heap_caps_free(p);
+#endif
+}
+
+esp_err_t who_buf_pool_create(const who_buf_pool_config_t *config, who_buf_pool_handle_t *ret_pool)
+{
+    if (!config || !ret_pool || config->slot_size == 0 || config->slot_count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t align = config->align ? config->align : 16;
+    if (align & (align - 1)) {
+        ESP_LOGE(TAG, "align must be a power of 2.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct who_buf_pool_t *pool = (struct who_buf_pool_t *)calloc(1, sizeof(struct who_buf_pool_t));
+    if (!pool) {
+        return ESP_ERR_NO_MEM;
+    }
+    pool->name = config->name ? config->name : "pool";
+    pool->slot_size = (config->slot_size + align - 1) & ~(align - 1);
+    pool->slot_count = config->slot_count;
+    pool->block = (uint8_t *)block_alloc(align, pool->slot_size * pool->slot_count, config->caps);
+    pool->free_slots = xQueueCreate(pool->slot_count, sizeof(uint16_t));
+    pool->slot_in_use = (uint8_t *)calloc(pool->slot_count, 1);
+    if (!pool->block || !pool->free_slots || !pool->slot_in_use) {
+        ESP_LOGE(TAG,
+                 "%s: failed to allocate %u slots of %u bytes.",
+                 pool->name,
+                 (unsigned)pool->slot_count,
+                 (unsigned)pool->slot_size);
+        if (pool->block) {
+            block_free(pool->block);
+        }
+        if (pool->free_slots) {
+            vQueueDelete(pool->free_slots);
+        }
+        free(pool->slot_in_use);
+        free(pool);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint16_t i = 0; i < pool->slot_count; i++) {
+        xQueueSend(pool->free_slots, &i, 0);
+    }
+    *ret_pool = pool;
+    return ESP_OK;
+}
+
+void who_buf_pool_delete(who_buf_pool_handle_t pool)
+{
+    if (!pool) {
+        return;
+    }
+    if (uxQueueMessagesWaiting(pool->free_slots) != pool->slot_count) {
+        ESP_LOGW(TAG, "%s: deleted with slots still in use.", pool->name);
+    }
+    vQueueDelete(pool->free_slots);
+    block_free(pool->block);
+    free(pool->slot_in_use);
+    free(pool);
+}
+
+void *who_buf_pool_alloc(who_buf_pool_handle_t pool, size_t size, TickType_t timeout)
+{
+    if (!pool) {
+        return NULL;
+    }
+    uint16_t idx;
+    if (size > pool->slot_size || xQueueReceive(pool->free_slots, &idx, timeout) != pdTRUE) {
+        __atomic_add_fetch(&pool->fail_cnt, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_store_n(&pool->slot_in_use[idx], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->alloc_cnt, 1, __ATOMIC_RELAXED);
+    uint16_t in_use = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+    uint16_t high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    while (in_use > high_water &&
+           !__atomic_compare_exchange_n(
+               &pool->high_water, &high_water, in_use, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return pool->block + (size_t)idx * pool->slot_size;
+}
+
+bool who_buf_pool_owns(who_buf_pool_handle_t pool, const void *buf)
+{
+    if (!pool || !buf) {
+        return false;
+    }
+    const uint8_t *p = (const uint8_t *)buf;
+    return p >= pool->block && p < pool->block + pool->slot_size * pool->slot_count;
+}
+
+void who_buf_pool_free(who_buf_pool_handle_t pool, void *buf)
+{
+    if (!buf) {
+        return;
+    }
+    if (!who_buf_pool_owns(pool, buf) || ((uint8_t *)buf - pool->block) % pool->slot_size) {
+        ESP_LOGE(TAG, "%s: %p is not a slot of this pool.", pool ? pool->name : "null", buf);
+        return;
+    }
+    uint16_t idx = ((uint8_t *)buf - pool->block) / pool->slot_size;
+    // Only the first of two frees clears the flag, also when they race on two tasks.
+    if (!__atomic_exchange_n(&pool->slot_in_use[idx], 0, __ATOMIC_RELAXED)) {
+        ESP_LOGE(TAG, "%s: double free of %p.", pool->name, buf);
+        return;
+    }
+    __atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+    xQueueSend(pool->free_slots, &idx, 0);
+}
+
+size_t who_buf_pool_get_slot_size(who_buf_pool_handle_t pool)
+{
+    return pool ? pool->slot_size : 0;
+}
+
+void who_buf_pool_get_stats(who_buf_pool_handle_t pool, who_buf_pool_stats_t *stats)
+{
+    if (!pool || !stats) {
+        return;
+    }
+    stats->slot_size = pool->slot_size;
+    stats->slot_count = pool->slot_count;
+    stats->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+    stats->high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    stats->alloc_cnt = __atomic_load_n(&pool->alloc_cnt, __ATOMIC_RELAXED);
+    stats->fail_cnt = __atomic_load_n(&pool->fail_cnt, __ATOMIC_RELAXED);
+}
+
+void who_buf_pool_print_stats(who_buf_pool_handle_t pool)
+{
+    who_buf_pool_stats_t stats;
+    if (!pool) {
+        return;
+    }
+    who_buf_pool_get_stats(pool, &stats);
+    ESP_LOGI(TAG,
+             "%s: slot %u bytes, in use %u/%u, high water %u, alloc %lu, fail %lu",
+             pool->name,
+             (unsigned)stats.slot_size,
+             (unsigned)stats.in_use,
+             (unsigned)stats.slot_count,
+             (unsigned)stats.high_water,
+             (unsigned long)stats.alloc_cnt,
+             (unsigned long)stats.fail_cnt);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fixed-size buffer pool. All slots are allocated in one block when the pool is created, so frame sized buffers
+// which are taken and given back at frame rate never go through the heap and can't fragment PSRAM.
+typedef struct who_buf_pool_t *who_buf_pool_handle_t;
+
+typedef struct {
+    const char *name;    // used in logs
+    size_t slot_size;    // bytes per slot, rounded up to align
+    uint16_t slot_count; // number of slots
+    uint32_t caps;       // heap caps of the backing block, e.g. MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA
+    size_t align;        // alignment of every slot, 0 means 16
+} who_buf_pool_config_t;
+
+typedef struct {
+    size_t slot_size;
+    uint16_t slot_count;
+    uint16_t in_use;
+    uint16_t high_water; // max slots in use at the same time since the pool was created
+    uint32_t alloc_cnt;
+    uint32_t fail_cnt;   // allocations which timed out or asked for more than slot_size
+} who_buf_pool_stats_t;
+
+esp_err_t who_buf_pool_create(const who_buf_pool_config_t *config, who_buf_pool_handle_t *ret_pool);
+// All slots must have been given back before the pool is deleted.
+void who_buf_pool_delete(who_buf_pool_handle_t pool);
+// Take a slot which can hold at least size bytes. Waits up to timeout for a slot to be freed, returns NULL on failure.
+void *who_buf_pool_alloc(who_buf_pool_handle_t pool, size_t size, TickType_t timeout);
+// A pointer which is not a slot of the pool, or a slot which is free already, is logged and ignored.
+void who_buf_pool_free(who_buf_pool_handle_t pool, void *buf);
+bool who_buf_pool_owns(who_buf_pool_handle_t pool, const void *buf);
+size_t who_buf_pool_get_slot_size(who_buf_pool_handle_t pool);
+void who_buf_pool_get_stats(who_buf_pool_handle_t pool, who_buf_pool_stats_t *stats);
+void who_buf_pool_print_stats(who_buf_pool_handle_t pool);
+
+#ifdef __cplusplus
+}
+#endif
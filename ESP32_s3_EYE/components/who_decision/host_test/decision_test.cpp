@@ -0,0 +1,153 @@
+// Synthetic recognition result streams through WhoDecision: accept, deny, an undecided window, the hold time before
+// the first send, the resend while a decision holds, a reset and a wrap of the millisecond clock.
+#include "who_decision.hpp"
+#include <cstdio>
+
+using namespace who::decision;
+
+static int s_errors = 0;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_errors++;
+    }
+}
+
+// Window 10, decide after 5 votes, accept at a confidence of 0.5, deny at 80% unknown votes.
+static WhoDecision::config_t make_config(uint32_t hold_ms, uint32_t resend_ms)
+{
+    return {.window = 10,
+            .min_votes = 5,
+            .accept_conf = 0.5f,
+            .deny_conf = 0.8f,
+            .hold_ms = hold_ms,
+            .resend_ms = resend_ms};
+}
+
+// Results every 100 ms, returns the last decision and counts the sends.
+static WhoDecision::decision_t feed(
+    WhoDecision &decision, int id, float similarity, int num, uint32_t &now_ms, int &sends)
+{
+    WhoDecision::decision_t ret = {};
+    for (int i = 0; i < num; i++) {
+        ret = decision.update(id, similarity, now_ms);
+        sends += ret.send;
+        now_ms += 100;
+    }
+    return ret;
+}
+
+static void test_accept()
+{
+    WhoDecision decision(make_config(0, 0));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    auto d = feed(decision, 3, 0.7f, 4, now_ms, sends);
+    check(d.outcome == WhoDecision::PENDING && sends == 0, "accept: nothing before min_votes");
+    d = feed(decision, 3, 0.7f, 1, now_ms, sends);
+    check(d.outcome == WhoDecision::ACCEPT && d.id == 3 && d.send, "accept: decided at min_votes");
+    check(d.similarity > 0.69f && d.similarity < 0.71f, "accept: mean similarity of the votes");
+    feed(decision, 3, 0.7f, 20, now_ms, sends);
+    check(sends == 1, "accept: sent once without resend");
+}
+
+static void test_deny()
+{
+    WhoDecision decision(make_config(0, 0));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    auto d = feed(decision, -1, 0.9f, 5, now_ms, sends);
+    check(d.outcome == WhoDecision::DENY && d.id == -1 && d.send, "deny: all unknown");
+    check(d.confidence == 1.f && d.similarity == 0, "deny: confidence is the unknown share");
+    // A known face in front of the camera takes over once its votes outweigh the unknown ones.
+    d = feed(decision, 5, 0.9f, 10, now_ms, sends);
+    check(d.outcome == WhoDecision::ACCEPT && d.id == 5 && sends == 2, "deny: a new decision is sent");
+}
+
+static void test_undecided()
+{
+    WhoDecision decision(make_config(0, 0));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    // Weak matches: 0.3 confidence, no unknown votes, neither threshold is reached.
+    auto d = feed(decision, 2, 0.3f, 10, now_ms, sends);
+    check(d.outcome == WhoDecision::PENDING && sends == 0, "undecided: weak matches decide nothing");
+    // Half strong matches, half unknown: accept.
+    feed(decision, 2, 0.9f, 10, now_ms, sends);
+    check(sends == 1, "undecided: strong matches accept");
+    // 60% unknown votes, the strong ones left are too few to accept: the accept stays but is not sent again.
+    feed(decision, -1, 0, 6, now_ms, sends);
+    d = decision.update(-1, 0, now_ms);
+    check(d.outcome == WhoDecision::ACCEPT && d.id == 2 && !d.send && sends == 1, "undecided: last decision stays");
+}
+
+static void test_hold()
+{
+    WhoDecision decision(make_config(1000, 0));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    feed(decision, 4, 0.8f, 5, now_ms, sends);
+    check(sends == 0, "hold: not sent before hold_ms");
+    // Decided at 400 ms, due at 1400 ms.
+    feed(decision, 4, 0.8f, 9, now_ms, sends);
+    check(sends == 0, "hold: still held at 1300 ms");
+    auto d = feed(decision, 4, 0.8f, 1, now_ms, sends);
+    check(d.send && sends == 1, "hold: sent at 1400 ms");
+    // A different id restarts the hold.
+    feed(decision, 6, 0.95f, 12, now_ms, sends);
+    check(sends == 1, "hold: a new id is held again");
+}
+
+static void test_resend()
+{
+    WhoDecision decision(make_config(0, 1000));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    // First send at 400 ms, resends at 1400, 2400 and 3400 ms.
+    feed(decision, 1, 0.8f, 35, now_ms, sends);
+    check(sends == 4, "resend: every resend_ms while the decision holds");
+}
+
+static void test_reset()
+{
+    WhoDecision decision(make_config(0, 0));
+    uint32_t now_ms = 0;
+    int sends = 0;
+    feed(decision, 1, 0.8f, 10, now_ms, sends);
+    decision.reset();
+    auto d = feed(decision, 1, 0.8f, 4, now_ms, sends);
+    check(d.outcome == WhoDecision::PENDING, "reset: votes are forgotten");
+    d = feed(decision, 1, 0.8f, 1, now_ms, sends);
+    check(d.send && sends == 2, "reset: the same decision is sent again");
+}
+
+static void test_wrap()
+{
+    WhoDecision decision(make_config(1000, 0));
+    uint32_t now_ms = UINT32_MAX - 450;
+    int sends = 0;
+    // Decided just before the wrap, due after it.
+    feed(decision, 7, 0.8f, 14, now_ms, sends);
+    check(sends == 0, "wrap: held across the wrap");
+    feed(decision, 7, 0.8f, 1, now_ms, sends);
+    check(sends == 1, "wrap: sent after hold_ms");
+}
+
+int main()
+{
+    test_accept();
+    test_deny();
+    test_undecided();
+    test_hold();
+    test_resend();
+    test_reset();
+    test_wrap();
+    if (s_errors) {
+        printf("%d errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
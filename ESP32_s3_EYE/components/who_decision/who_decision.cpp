@@ -0,0 +1,92 @@
+#include "who_decision.hpp"
+#include <algorithm>
+
+namespace who {
+namespace decision {
+WhoDecision::WhoDecision(const config_t &config) : m_config(config)
+{
+    m_config.window = std::max(m_config.window, 1);
+    m_config.min_votes = std::clamp(m_config.min_votes, 1, m_config.window);
+    m_votes.resize(m_config.window);
+    reset();
+}
+
+void WhoDecision::reset()
+{
+    m_next = 0;
+    m_count = 0;
+    m_outcome = PENDING;
+    m_id = -1;
+    m_since_ms = 0;
+    m_last_send_ms = 0;
+    m_sent = false;
+}
+
+WhoDecision::decision_t WhoDecision::update(int id, float similarity, uint32_t now_ms)
+{
+    m_votes[m_next] = {id < 0 ? -1 : id, id < 0 ? 0 : similarity};
+    m_next = (m_next + 1) % m_config.window;
+    m_count = std::min(m_count + 1, m_config.window);
+
+    // The window is small, count every id of it against all others.
+    int best_id = -1;
+    float best_weight = 0;
+    int best_votes = 0;
+    int unknown_votes = 0;
+    for (int i = 0; i < m_count; i++) {
+        int vote_id = m_votes[i].id;
+        if (vote_id < 0) {
+            unknown_votes++;
+            continue;
+        }
+        float weight = 0;
+        int votes = 0;
+        for (int j = 0; j < m_count; j++) {
+            if (m_votes[j].id == vote_id) {
+                weight += m_votes[j].similarity;
+                votes++;
+            }
+        }
+        if (weight > best_weight) {
+            best_id = vote_id;
+            best_weight = weight;
+            best_votes = votes;
+        }
+    }
+    float accept_conf = best_weight / m_count;
+    float deny_conf = (float)unknown_votes / m_count;
+
+    outcome_t outcome = PENDING;
+    if (m_count >= m_config.min_votes) {
+        if (best_id >= 0 && accept_conf >= m_config.accept_conf) {
+            outcome = ACCEPT;
+        } else if (deny_conf >= m_config.deny_conf) {
+            outcome = DENY;
+        }
+    }
+    // An undecided window keeps the last decision, it is only neither confirmed nor sent again.
+    int outcome_id = outcome == ACCEPT ? best_id : -1;
+    if (outcome != PENDING && (outcome != m_outcome || outcome_id != m_id)) {
+        m_outcome = outcome;
+        m_id = outcome_id;
+        m_since_ms = now_ms;
+        m_sent = false;
+    }
+
+    decision_t decision = {.outcome = m_outcome,
+                           .id = m_id,
+                           .similarity = outcome == ACCEPT ? best_weight / best_votes : 0,
+                           .confidence = outcome == ACCEPT ? accept_conf : deny_conf,
+                           .send = false};
+    // Differences of unsigned times stay right across a wrap.
+    if (outcome != PENDING && now_ms - m_since_ms >= m_config.hold_ms) {
+        decision.send = !m_sent || (m_config.resend_ms && now_ms - m_last_send_ms >= m_config.resend_ms);
+    }
+    if (decision.send) {
+        m_sent = true;
+        m_last_send_ms = now_ms;
+    }
+    return decision;
+}
+} // namespace decision
+} // namespace who
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace who {
+namespace decision {
+// Turns a stream of recognition results into accept / deny decisions.
+//
+// The last window results vote. The confidence of an id is the sum of the similarities of its votes divided by the
+// number of votes, so a few weak matches don't outvote a steady strong one. Accept and deny have their own
+// thresholds, in between nothing is decided and the last decision stays. A decision is sent once it held for hold_ms,
+// then again every resend_ms while it holds.
+//
+// Plain C++ without FreeRTOS, the caller passes the time, so it runs on the host with synthetic result streams.
+// Not thread safe.
+class WhoDecision {
+public:
+    typedef enum {
+        PENDING,
+        ACCEPT,
+        DENY,
+    } outcome_t;
+
+    typedef struct {
+        int window;
+        // Votes needed before the first decision.
+        int min_votes;
+        float accept_conf;
+        // Share of unknown votes.
+        float deny_conf;
+        uint32_t hold_ms;
+        // 0 sends a decision once.
+        uint32_t resend_ms;
+    } config_t;
+
+    typedef struct {
+        outcome_t outcome;
+        // Accepted id, -1 otherwise.
+        int id;
+        // Mean similarity of the votes for the accepted id, 0 otherwise.
+        float similarity;
+        float confidence;
+        // The decision is due to be sent now.
+        bool send;
+    } decision_t;
+
+    WhoDecision(const config_t &config);
+    // Add a result, id -1 for an unknown face. now_ms may wrap.
+    decision_t update(int id, float similarity, uint32_t now_ms);
+    // Forget the votes and the last decision, e.g. when someone else steps in front of the camera.
+    void reset();
+
+private:
+    typedef struct {
+        int id;
+        float similarity;
+    } vote_t;
+
+    config_t m_config;
+    // Ring of the last window votes.
+    std::vector<vote_t> m_votes;
+    int m_next;
+    int m_count;
+    outcome_t m_outcome;
+    int m_id;
+    uint32_t m_since_ms;
+    uint32_t m_last_send_ms;
+    bool m_sent;
+};
+} // namespace decision
+} // namespace who
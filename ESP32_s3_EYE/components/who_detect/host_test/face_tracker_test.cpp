@@ -0,0 +1,106 @@
+// Synthetic detection results through WhoFaceTracker: ids stay with faces which move and swap places in the result
+// list, a fast face is kept by the velocity prediction, a track survives a few missed frames and the identity is
+// reverified after reverify_time.
+#include "who_face_tracker.hpp"
+#include <cstdio>
+
+using namespace who::detect;
+
+TickType_t s_host_tick = 0;
+
+static int s_errors = 0;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_errors++;
+    }
+}
+
+// A 50x50 face at x, y.
+static dl::detect::result_t face(int x, int y)
+{
+    return {.category = 0, .score = 0.9f, .box = {x, y, x + 50, y + 50}, .keypoint = {}};
+}
+
+static void test_ids_follow_faces()
+{
+    WhoFaceTracker tracker;
+    auto ids = tracker.update({face(0, 0), face(200, 0)});
+    check(ids.size() == 2 && ids[0] != ids[1], "follow: new faces get new ids");
+    int left = ids[0], right = ids[1];
+    for (int i = 1; i <= 5; i++) {
+        // The detector lists the faces in any order.
+        ids = tracker.update({face(200 - 5 * i, 0), face(5 * i, 0)});
+        check(ids[0] == right && ids[1] == left, "follow: ids stay with moving faces");
+    }
+    check(tracker.get_tracks().size() == 2, "follow: no extra tracks");
+    check(tracker.get_track(left)->hits == 6, "follow: hits counted");
+}
+
+static void test_velocity()
+{
+    WhoFaceTracker tracker;
+    int id = tracker.update({face(0, 0)})[0];
+    // 10 px per frame builds up the velocity.
+    for (int i = 1; i <= 6; i++) {
+        tracker.update({face(10 * i, 0)});
+    }
+    // 30 px steps leave an IoU of 0.25 with the last box, below the threshold of 0.3. The prediction still matches.
+    for (int i = 1; i <= 3; i++) {
+        auto ids = tracker.update({face(60 + 30 * i, 0)});
+        check(ids[0] == id, "velocity: fast face keeps its id");
+    }
+    // Without history the same jump is a new face.
+    WhoFaceTracker fresh;
+    int fresh_id = fresh.update({face(0, 0)})[0];
+    check(fresh.update({face(30, 0)})[0] != fresh_id, "velocity: no prediction without history");
+}
+
+static void test_misses()
+{
+    WhoFaceTracker tracker(0.3f, 3);
+    int id = tracker.update({face(100, 100)})[0];
+    for (int i = 0; i < 3; i++) {
+        tracker.update({});
+    }
+    check(tracker.get_track(id) && tracker.get_track(id)->misses == 3, "misses: kept for max_misses frames");
+    check(tracker.update({face(100, 100)})[0] == id, "misses: found again");
+    for (int i = 0; i < 4; i++) {
+        tracker.update({});
+    }
+    check(!tracker.get_track(id) && tracker.get_tracks().empty(), "misses: dropped after max_misses");
+}
+
+static void test_identity()
+{
+    WhoFaceTracker tracker;
+    int id = tracker.update({face(0, 0)})[0];
+    check(tracker.needs_recognition(id, 100), "identity: a new track needs recognition");
+    s_host_tick = 1000;
+    tracker.set_identity(id, 7, 0.8f);
+    const auto *track = tracker.get_track(id);
+    check(track->recognized && track->face_id == 7 && track->similarity == 0.8f, "identity: stored with the track");
+    s_host_tick = 1099;
+    check(!tracker.needs_recognition(id, 100), "identity: valid within reverify_time");
+    s_host_tick = 1100;
+    check(tracker.needs_recognition(id, 100), "identity: reverified after reverify_time");
+    check(!tracker.needs_recognition(id + 1, 100), "identity: unknown track");
+    tracker.clear();
+    check(!tracker.get_track(id), "identity: clear drops the tracks");
+}
+
+int main()
+{
+    test_ids_follow_faces();
+    test_velocity();
+    test_misses();
+    test_identity();
+    if (s_errors) {
+        printf("%d errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
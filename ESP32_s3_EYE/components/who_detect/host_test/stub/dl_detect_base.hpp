@@ -0,0 +1,14 @@
+#pragma once
+// The part of the esp-dl detection result the tracker reads.
+#include <vector>
+
+namespace dl {
+namespace detect {
+typedef struct {
+    int category;
+    float score;
+    std::vector<int> box;
+    std::vector<int> keypoint;
+} result_t;
+} // namespace detect
+} // namespace dl
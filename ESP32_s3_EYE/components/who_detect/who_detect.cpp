@@ -1,17 +1,32 @@
 #include "who_detect.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
 
 namespace who {
 namespace detect {
 WhoDetect::WhoDetect(const std::string &name, frame_cap::WhoFrameCapNode *frame_cap_node) :
     task::WhoTask(name),
     m_frame_cap_node(frame_cap_node),
+    m_fb(nullptr),
     m_model(nullptr),
     m_interval(0),
     m_inv_rescale_x(0),
     m_inv_rescale_y(0),
     m_rescale_max_w(0),
     m_rescale_max_h(0),
-    m_result_cb_mutex(xSemaphoreCreateRecursiveMutex())
+    m_result_cb_mutex(xSemaphoreCreateRecursiveMutex()),
+    m_stats(name),
+    m_motion_gate(nullptr),
+    m_idle_interval(0),
+    m_active_time(0),
+    m_active_until(0),
+    m_last_detect_time(0),
+    m_roi_expand(0),
+    m_full_scan_interval(0),
+    m_roi_frames(0),
+    m_roi_buf(nullptr),
+    m_roi_buf_size(0)
 {
     frame_cap_node->add_new_frame_signal_subscriber(this);
 }
@@ -19,6 +34,8 @@ WhoDetect::WhoDetect(const std::string &name, frame_cap::WhoFrameCapNode *frame_
 WhoDetect::~WhoDetect()
 {
     vSemaphoreDelete(m_result_cb_mutex);
+    delete m_motion_gate;
+    heap_caps_free(m_roi_buf);
     if (m_model) {
         delete m_model;
     }
@@ -44,6 +61,24 @@ void WhoDetect::set_fps(float fps)
     }
 }
 
+void WhoDetect::set_motion_gate(float idle_fps, uint32_t active_ms)
+{
+    if (idle_fps <= 0) {
+        return;
+    }
+    if (!m_motion_gate) {
+        m_motion_gate = new WhoMotionGate();
+    }
+    m_idle_interval = pdMS_TO_TICKS((int)(1000.f / idle_fps));
+    m_active_time = pdMS_TO_TICKS(active_ms);
+}
+
+void WhoDetect::set_roi_tracking(float expand, int full_scan_interval)
+{
+    m_roi_expand = expand;
+    m_full_scan_interval = full_scan_interval;
+}
+
 void WhoDetect::set_detect_result_cb(const std::function<void(const result_t &result)> &result_cb)
 {
     xSemaphoreTakeRecursive(m_result_cb_mutex, portMAX_DELAY);
@@ -56,12 +91,22 @@ void WhoDetect::set_cleanup_func(const std::function<void()> &cleanup_func)
     m_cleanup = cleanup_func;
 }
 
+cam::cam_fb_t *WhoDetect::lease_frame()
+{
+    return m_fb ? m_frame_cap_node->cam_fb_retain(m_fb) : nullptr;
+}
+
+void WhoDetect::release_frame(cam::cam_fb_t *fb)
+{
+    m_frame_cap_node->cam_fb_release(fb);
+}
+
 void WhoDetect::task()
 {
     TickType_t last_wake_time = xTaskGetTickCount();
     while (true) {
-        EventBits_t event_bits =
-            xEventGroupWaitBits(m_event_group, NEW_FRAME | TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+        EventBits_t event_bits = xEventGroupWaitBits(
+            m_event_group, NEW_FRAME | MOTION | TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
         if (event_bits & TASK_STOP) {
             break;
         } else if (event_bits & TASK_PAUSE) {
@@ -75,18 +120,53 @@ void WhoDetect::task()
                 continue;
             }
         }
-        auto fb = m_frame_cap_node->cam_fb_peek();
+        if (event_bits & MOTION) {
+            m_active_until = xTaskGetTickCount() + m_active_time;
+            if (!(event_bits & NEW_FRAME)) {
+                continue;
+            }
+        }
+        // Pin the frame while the model and the result callback use it, so the node can't recycle it meanwhile.
+        m_stats.frame_in();
+        auto fb = m_frame_cap_node->cam_fb_lease();
+        if (!fb) {
+            m_stats.frame_dropped();
+            continue;
+        }
         struct timeval timestamp = fb->timestamp;
         dl::image::img_t img = static_cast<dl::image::img_t>(*fb);
-        auto &res = m_model->run(img);
+        if (m_motion_gate && skip_idle_frame(img)) {
+            // Frames skipped while idle count as dropped, so in = out + dropped still holds.
+            m_frame_cap_node->cam_fb_release(fb);
+            m_stats.frame_dropped();
+            continue;
+        }
+        int64_t start = stats::WhoStats::now_us();
+        m_stats.observe_queue_wait(start - (timestamp.tv_sec * 1000000LL + timestamp.tv_usec));
+        bool use_roi = m_full_scan_interval > 0 && !m_roi.empty() && m_roi_frames < m_full_scan_interval;
+        dl::image::img_t det_img = use_roi ? crop_roi(img) : img;
+        auto &res = m_model->run(det_img);
+        m_stats.observe_process_time(stats::WhoStats::now_us() - start);
+        if (m_full_scan_interval > 0) {
+            m_roi_frames = use_roi ? m_roi_frames + 1 : 0;
+            update_roi(res, det_img.data != img.data, img);
+        }
         if (m_inv_rescale_x && m_inv_rescale_y && m_rescale_max_w && m_rescale_max_h) {
             rescale_detect_result(res);
         }
+        if (m_motion_gate && !res.empty()) {
+            // Someone standing still in front of the camera keeps the full rate too.
+            m_active_until = xTaskGetTickCount() + m_active_time;
+        }
         if (m_result_cb) {
             xSemaphoreTakeRecursive(m_result_cb_mutex, portMAX_DELAY);
+            m_fb = fb;
             m_result_cb({res, timestamp, img});
+            m_fb = nullptr;
             xSemaphoreGiveRecursive(m_result_cb_mutex);
         }
+        m_frame_cap_node->cam_fb_release(fb);
+        m_stats.frame_out();
         if (m_interval) {
             vTaskDelayUntil(&last_wake_time, m_interval);
         }
@@ -95,6 +175,86 @@ void WhoDetect::task()
     vTaskDelete(NULL);
 }
 
+bool WhoDetect::skip_idle_frame(const dl::image::img_t &img)
+{
+    TickType_t now = xTaskGetTickCount();
+    // The gate sees every frame, so the previous gray frame is always the one right before.
+    if (m_motion_gate->update(img)) {
+        m_active_until = now + m_active_time;
+    }
+    if ((int32_t)(m_active_until - now) > 0 || now - m_last_detect_time >= m_idle_interval) {
+        m_last_detect_time = now;
+        return false;
+    }
+    return true;
+}
+
+dl::image::img_t WhoDetect::crop_roi(const dl::image::img_t &img)
+{
+    int x0 = m_roi[0], y0 = m_roi[1], x1 = m_roi[2], y1 = m_roi[3];
+    int pix_size = dl::image::get_pix_byte_size(img.pix_type);
+    size_t size = (size_t)(x1 - x0) * (y1 - y0) * pix_size;
+    if (size > m_roi_buf_size) {
+        heap_caps_free(m_roi_buf);
+        // Sized for a whole frame, so it is only allocated once.
+        m_roi_buf_size = dl::image::get_img_byte_size(img);
+        m_roi_buf = (uint8_t *)heap_caps_malloc(m_roi_buf_size, MALLOC_CAP_DEFAULT);
+        if (!m_roi_buf) {
+            ESP_LOGW("WhoDetect", "Failed to alloc roi buffer, detect on the whole frame.");
+            m_roi_buf_size = 0;
+            return img;
+        }
+    }
+    const uint8_t *src = (const uint8_t *)img.data + ((size_t)y0 * img.width + x0) * pix_size;
+    size_t src_stride = img.width * pix_size;
+    size_t dst_stride = (x1 - x0) * pix_size;
+    for (int y = y0; y < y1; y++) {
+        memcpy(m_roi_buf + (y - y0) * dst_stride, src, dst_stride);
+        src += src_stride;
+    }
+    return {.data = m_roi_buf, .width = (uint16_t)(x1 - x0), .height = (uint16_t)(y1 - y0), .pix_type = img.pix_type};
+}
+
+void WhoDetect::update_roi(std::list<dl::detect::result_t> &result, bool cropped, const dl::image::img_t &img)
+{
+    int off_x = cropped ? m_roi[0] : 0;
+    int off_y = cropped ? m_roi[1] : 0;
+    if (result.empty()) {
+        m_roi.clear();
+        return;
+    }
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (auto &res : result) {
+        // Back to frame coordinates before anyone else sees the result.
+        if (cropped) {
+            res.box[0] += off_x;
+            res.box[1] += off_y;
+            res.box[2] += off_x;
+            res.box[3] += off_y;
+            for (int i = 0; i + 1 < (int)res.keypoint.size(); i += 2) {
+                res.keypoint[i] += off_x;
+                res.keypoint[i + 1] += off_y;
+            }
+        }
+        x0 = std::min(x0, res.box[0]);
+        y0 = std::min(y0, res.box[1]);
+        x1 = std::max(x1, res.box[2]);
+        y1 = std::max(y1, res.box[3]);
+    }
+    int grow_x = (int)((x1 - x0) * m_roi_expand);
+    int grow_y = (int)((y1 - y0) * m_roi_expand);
+    x0 = std::max(x0 - grow_x, 0);
+    y0 = std::max(y0 - grow_y, 0);
+    x1 = std::min(x1 + grow_x, (int)img.width);
+    y1 = std::min(y1 + grow_y, (int)img.height);
+    // A crop close to the frame size saves nothing, and a tiny one is too small for the model.
+    if ((x1 - x0) * (y1 - y0) * 4 > img.width * img.height * 3 || x1 - x0 < ROI_MIN_SIZE || y1 - y0 < ROI_MIN_SIZE) {
+        m_roi.clear();
+        return;
+    }
+    m_roi = {x0, y0, x1, y1};
+}
+
 void WhoDetect::rescale_detect_result(std::list<dl::detect::result_t> &result)
 {
     for (auto &r : result) {
@@ -1,16 +1,21 @@
 #pragma once
 #include "dl_detect_base.hpp"
 #include "who_frame_cap.hpp"
+#include "who_motion_gate.hpp"
 
 namespace who {
 namespace detect {
 class WhoDetect : public task::WhoTask {
 public:
     static inline constexpr EventBits_t NEW_FRAME = frame_cap::WhoFrameCapNode::NEW_FRAME;
+    // Motion seen by someone else, e.g. a PIR sensor. Switches to the full detect rate like detected motion.
+    static inline constexpr EventBits_t MOTION = TASK_EVENT_BIT_LAST << 1;
 
     typedef struct {
         std::list<dl::detect::result_t> det_res;
         struct timeval timestamp;
+        // The frame stays leased only while the result callback runs, copy it or take a lease with lease_frame() if
+        // it is needed afterwards.
         dl::image::img_t img;
     } result_t;
 
@@ -19,18 +24,38 @@ public:
     void set_model(dl::detect::Detect *model);
     void set_rescale_params(float rescale_x, float rescale_y, uint16_t rescale_max_w, uint16_t rescale_max_h);
     void set_fps(float fps);
+    // Only run the model at idle_fps until motion or a face is seen, then at the full rate for active_ms. Without a
+    // motion gate every frame is detected.
+    void set_motion_gate(float idle_fps, uint32_t active_ms);
+    // Once a face is found, detect on a crop around the last faces instead of the whole frame. The crop is the box
+    // around all faces grown by expand on each side (0.5 = half a box). Every full_scan_interval frames, and whenever
+    // the crop has no face, the whole frame is scanned again so new faces are not missed.
+    void set_roi_tracking(float expand, int full_scan_interval);
     void set_detect_result_cb(const std::function<void(const result_t &)> &result_cb);
     void set_cleanup_func(const std::function<void()> &cleanup_func);
+    // Only from the result callback: keep the frame of the result leased after the callback returns, e.g. to hand it
+    // to another task. Any task gives it back with release_frame(). Returns nullptr if the frame can't be leased.
+    cam::cam_fb_t *lease_frame();
+    void release_frame(cam::cam_fb_t *fb);
     bool run(const configSTACK_DEPTH_TYPE uxStackDepth, UBaseType_t uxPriority, const BaseType_t xCoreID) override;
     bool stop_async() override;
     bool pause_async() override;
+    stats::WhoStats &get_stats() { return m_stats; }
 
 private:
+    // Smaller crops fall back to the full frame, the detect model needs some context around the face.
+    static inline constexpr int ROI_MIN_SIZE = 64;
+
     void task() override;
     void cleanup() override;
     void rescale_detect_result(std::list<dl::detect::result_t> &result);
+    bool skip_idle_frame(const dl::image::img_t &img);
+    dl::image::img_t crop_roi(const dl::image::img_t &img);
+    void update_roi(std::list<dl::detect::result_t> &result, bool cropped, const dl::image::img_t &img);
 
     frame_cap::WhoFrameCapNode *m_frame_cap_node;
+    // Frame of the running result callback.
+    cam::cam_fb_t *m_fb;
     dl::detect::Detect *m_model;
     TickType_t m_interval;
     float m_inv_rescale_x;
@@ -40,6 +65,19 @@ private:
     std::function<void(const result_t &)> m_result_cb;
     std::function<void()> m_cleanup;
     SemaphoreHandle_t m_result_cb_mutex;
+    stats::WhoStats m_stats;
+    WhoMotionGate *m_motion_gate;
+    TickType_t m_idle_interval;
+    TickType_t m_active_time;
+    TickType_t m_active_until;
+    TickType_t m_last_detect_time;
+    float m_roi_expand;
+    int m_full_scan_interval;
+    int m_roi_frames;
+    // x0, y0, x1, y1 in frame coordinates, empty if the last detection found no face.
+    std::vector<int> m_roi;
+    uint8_t *m_roi_buf;
+    size_t m_roi_buf_size;
 };
 } // namespace detect
 } // namespace who
@@ -0,0 +1,134 @@
+#include "who_face_tracker.hpp"
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+namespace who {
+namespace detect {
+WhoFaceTracker::WhoFaceTracker(float iou_threshold, int max_misses, float velocity_gain) :
+    m_iou_threshold(iou_threshold), m_max_misses(max_misses), m_velocity_gain(velocity_gain), m_next_id(0)
+{
+}
+
+std::vector<int> WhoFaceTracker::update(const std::list<dl::detect::result_t> &result)
+{
+    std::vector<std::array<float, 4>> boxes;
+    boxes.reserve(result.size());
+    for (const auto &r : result) {
+        boxes.push_back({(float)r.box[0], (float)r.box[1], (float)r.box[2], (float)r.box[3]});
+    }
+
+    // Predicted position of every track in this frame.
+    std::vector<std::array<float, 4>> predicted(m_tracks.size());
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        for (int i = 0; i < 4; i++) {
+            predicted[t][i] = m_tracks[t].box[i] + m_tracks[t].velocity[i] * (m_tracks[t].misses + 1);
+        }
+    }
+
+    // Only a handful of faces, greedy matching by the best IoU first is as good as the hungarian algorithm here.
+    std::vector<std::tuple<float, int, int>> pairs;
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        for (size_t d = 0; d < boxes.size(); d++) {
+            float v = iou(predicted[t].data(), boxes[d].data());
+            if (v >= m_iou_threshold) {
+                pairs.emplace_back(v, t, d);
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const auto &a, const auto &b) { return std::get<0>(a) > std::get<0>(b); });
+
+    std::vector<int> ids(boxes.size(), -1);
+    std::vector<bool> matched(m_tracks.size(), false);
+    for (const auto &[v, t, d] : pairs) {
+        if (matched[t] || ids[d] >= 0) {
+            continue;
+        }
+        matched[t] = true;
+        ids[d] = m_tracks[t].id;
+        track_t &track = m_tracks[t];
+        for (int i = 0; i < 4; i++) {
+            float step = (boxes[d][i] - track.box[i]) / (track.misses + 1);
+            track.velocity[i] += m_velocity_gain * (step - track.velocity[i]);
+            track.box[i] = boxes[d][i];
+        }
+        track.hits++;
+        track.misses = 0;
+    }
+
+    // Tracks without a face in this frame are kept for a few frames, detection misses a frame now and then.
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        if (!matched[t]) {
+            m_tracks[t].misses++;
+        }
+    }
+    m_tracks.erase(std::remove_if(m_tracks.begin(),
+                                  m_tracks.end(),
+                                  [this](const track_t &track) { return track.misses > m_max_misses; }),
+                   m_tracks.end());
+
+    for (size_t d = 0; d < boxes.size(); d++) {
+        if (ids[d] >= 0) {
+            continue;
+        }
+        track_t track = {};
+        track.id = m_next_id++;
+        std::copy(boxes[d].begin(), boxes[d].end(), track.box);
+        track.hits = 1;
+        track.face_id = -1;
+        m_tracks.push_back(track);
+        ids[d] = track.id;
+    }
+    return ids;
+}
+
+bool WhoFaceTracker::needs_recognition(int track_id, TickType_t reverify_time)
+{
+    track_t *track = find_track(track_id);
+    if (!track) {
+        return false;
+    }
+    return !track->recognized || xTaskGetTickCount() - track->recognized_time >= reverify_time;
+}
+
+void WhoFaceTracker::set_identity(int track_id, int face_id, float similarity)
+{
+    track_t *track = find_track(track_id);
+    if (!track) {
+        return;
+    }
+    track->recognized = true;
+    track->face_id = face_id;
+    track->similarity = similarity;
+    track->recognized_time = xTaskGetTickCount();
+}
+
+const WhoFaceTracker::track_t *WhoFaceTracker::get_track(int track_id)
+{
+    return find_track(track_id);
+}
+
+WhoFaceTracker::track_t *WhoFaceTracker::find_track(int track_id)
+{
+    for (auto &track : m_tracks) {
+        if (track.id == track_id) {
+            return &track;
+        }
+    }
+    return nullptr;
+}
+
+float WhoFaceTracker::iou(const float *a, const float *b)
+{
+    float w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+    float h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+    float inter = w * h;
+    float area_a = (a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (b[2] - b[0]) * (b[3] - b[1]);
+    return inter / (area_a + area_b - inter);
+}
+} // namespace detect
+} // namespace who
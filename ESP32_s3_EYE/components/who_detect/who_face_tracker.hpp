@@ -0,0 +1,52 @@
+#pragma once
+#include "dl_detect_base.hpp"
+#include <freertos/FreeRTOS.h>
+#include <list>
+#include <vector>
+
+namespace who {
+namespace detect {
+// Gives every face a track id which stays the same while the face moves between frames, so a face only has to be
+// recognized once and the identity can be kept with the track.
+//
+// Boxes are matched greedily by IoU against the position predicted from the last velocity. The velocity is smoothed
+// with a fixed gain, which is the steady state of a constant velocity Kalman filter and needs no matrices.
+class WhoFaceTracker {
+public:
+    typedef struct {
+        int id;
+        // x0, y0, x1, y1 of the last matched box.
+        float box[4];
+        float velocity[4];
+        int hits;
+        int misses;
+        // Identity from the last recognition, face_id -1 means unknown.
+        bool recognized;
+        int face_id;
+        float similarity;
+        TickType_t recognized_time;
+    } track_t;
+
+    WhoFaceTracker(float iou_threshold = 0.3f, int max_misses = 5, float velocity_gain = 0.5f);
+    // Match the faces of a new frame. Returns the track id of each face, in the order of result.
+    std::vector<int> update(const std::list<dl::detect::result_t> &result);
+    // True if the track was never recognized, or its identity is older than reverify_time.
+    bool needs_recognition(int track_id, TickType_t reverify_time);
+    void set_identity(int track_id, int face_id, float similarity);
+    // nullptr if the track is gone.
+    const track_t *get_track(int track_id);
+    const std::vector<track_t> &get_tracks() { return m_tracks; }
+    void clear() { m_tracks.clear(); }
+
+private:
+    static float iou(const float *a, const float *b);
+    track_t *find_track(int track_id);
+
+    float m_iou_threshold;
+    int m_max_misses;
+    float m_velocity_gain;
+    int m_next_id;
+    std::vector<track_t> m_tracks;
+};
+} // namespace detect
+} // namespace who
@@ -0,0 +1,49 @@
+#include "who_motion_gate.hpp"
+#include "esp_heap_caps.h"
+#include <utility>
+
+namespace who {
+namespace detect {
+WhoMotionGate::WhoMotionGate(uint16_t width, uint16_t height, uint8_t pixel_threshold, float area_threshold) :
+    m_width(width),
+    m_height(height),
+    m_pixel_threshold(pixel_threshold),
+    m_area_threshold((int)(width * height * area_threshold)),
+    m_prev((uint8_t *)heap_caps_malloc(width * height, MALLOC_CAP_DEFAULT)),
+    m_cur((uint8_t *)heap_caps_malloc(width * height, MALLOC_CAP_DEFAULT)),
+    m_has_prev(false)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    m_image_transformer.set_caps(dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN);
+#endif
+}
+
+WhoMotionGate::~WhoMotionGate()
+{
+    heap_caps_free(m_prev);
+    heap_caps_free(m_cur);
+}
+
+bool WhoMotionGate::update(const dl::image::img_t &img)
+{
+    dl::image::img_t dst_img = {
+        .data = m_cur, .width = m_width, .height = m_height, .pix_type = dl::image::DL_IMAGE_PIX_TYPE_GRAY};
+    m_image_transformer.set_src_img(img).set_dst_img(dst_img).transform();
+    if (!m_has_prev) {
+        m_has_prev = true;
+        std::swap(m_prev, m_cur);
+        return true;
+    }
+    // Branch free and over plain byte arrays, so the compiler can vectorize it.
+    const int n = m_width * m_height;
+    const int th = m_pixel_threshold;
+    int changed = 0;
+    for (int i = 0; i < n; i++) {
+        int diff = m_cur[i] - m_prev[i];
+        changed += (diff > th) | (diff < -th);
+    }
+    std::swap(m_prev, m_cur);
+    return changed > m_area_threshold;
+}
+} // namespace detect
+} // namespace who
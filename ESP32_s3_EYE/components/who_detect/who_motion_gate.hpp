@@ -0,0 +1,32 @@
+#pragma once
+#include "who_frame_cap.hpp"
+
+namespace who {
+namespace detect {
+// Cheap motion check for the detect task. Every frame is scaled down to a small gray image with the esp-dl image
+// transformer, then compared with the previous one pixel by pixel. Only width * height bytes are touched by the
+// compare, so it costs a tiny fraction of a model run.
+class WhoMotionGate {
+public:
+    // A pixel counts as changed when its gray value moves by more than pixel_threshold, the frame counts as motion
+    // when more than area_threshold of the pixels changed.
+    WhoMotionGate(uint16_t width = 32,
+                  uint16_t height = 24,
+                  uint8_t pixel_threshold = 20,
+                  float area_threshold = 0.02f);
+    ~WhoMotionGate();
+    // Returns true if the frame differs enough from the previous one. The first frame is always motion.
+    bool update(const dl::image::img_t &img);
+
+private:
+    dl::image::ImageTransformer m_image_transformer;
+    uint16_t m_width;
+    uint16_t m_height;
+    uint8_t m_pixel_threshold;
+    int m_area_threshold;
+    uint8_t *m_prev;
+    uint8_t *m_cur;
+    bool m_has_prev;
+};
+} // namespace detect
+} // namespace who
@@ -0,0 +1,470 @@
+#include "who_face_db.hpp"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+static const char *TAG = "WhoFaceDB";
+
+namespace who {
+namespace face_db {
+WhoFaceDB::WhoFaceDB(const char *partition_label, int feat_len) :
+    m_partition_label(partition_label),
+    m_feat_len(feat_len),
+    m_row_len(face_index::WhoFaceIndex::get_row_len(feat_len)),
+    m_record_size(sizeof(record_header_t) + m_row_len),
+    m_partition(nullptr),
+    m_mmap_handle(0),
+    m_base(nullptr),
+    m_segment_size(0),
+    m_num_slots(0),
+    m_active(0),
+    m_generation(0),
+    m_next_slot(0),
+    m_num_live(0),
+    m_max_id(0),
+    m_row((int8_t *)heap_caps_aligned_alloc(16, m_row_len, MALLOC_CAP_8BIT)),
+    m_queries((int8_t *)heap_caps_aligned_alloc(16, m_row_len * MAX_BATCH, MALLOC_CAP_8BIT)),
+    m_query_scales(),
+    m_mutex(xSemaphoreCreateMutex()),
+    m_compaction_task(nullptr),
+    m_compaction_done(xSemaphoreCreateBinary()),
+    m_stop(false)
+{
+    static_assert(sizeof(segment_header_t) == HEADER_SIZE);
+    // Keeps the feature 16 byte aligned.
+    static_assert(sizeof(record_header_t) == 16);
+}
+
+WhoFaceDB::~WhoFaceDB()
+{
+    if (m_compaction_task) {
+        // The task may be in the middle of a flash erase, let it finish instead of deleting it.
+        m_stop = true;
+        xTaskNotifyGive(m_compaction_task);
+        xSemaphoreTake(m_compaction_done, portMAX_DELAY);
+    }
+    if (m_base) {
+        esp_partition_munmap(m_mmap_handle);
+    }
+    heap_caps_free(m_row);
+    heap_caps_free(m_queries);
+    vSemaphoreDelete(m_mutex);
+    vSemaphoreDelete(m_compaction_done);
+}
+
+esp_err_t WhoFaceDB::open()
+{
+    if (!m_row || !m_queries || !m_mutex || !m_compaction_done) {
+        ESP_LOGE(TAG, "Failed to alloc face db.");
+        return ESP_ERR_NO_MEM;
+    }
+    m_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, m_partition_label);
+    if (!m_partition) {
+        ESP_LOGE(TAG, "Partition %s not found.", m_partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    m_segment_size = (m_partition->size / 2) & ~(size_t)(m_partition->erase_size - 1);
+    if (m_segment_size < HEADER_SIZE + m_record_size) {
+        ESP_LOGE(TAG, "Partition %s is too small.", m_partition_label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    m_num_slots = std::min<int>((m_segment_size - HEADER_SIZE) / m_record_size, UINT16_MAX);
+    const void *ptr;
+    esp_err_t ret =
+        esp_partition_mmap(m_partition, 0, m_segment_size * 2, ESP_PARTITION_MMAP_DATA, &ptr, &m_mmap_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mmap partition %s, %s.", m_partition_label, esp_err_to_name(ret));
+        return ret;
+    }
+    m_base = (const uint8_t *)ptr;
+
+    int active = -1;
+    uint32_t max_generation = 0;
+    for (int segment = 0; segment < 2; segment++) {
+        const segment_header_t *header = get_header(segment);
+        if (header->magic == MAGIC) {
+            max_generation = std::max(max_generation, header->generation);
+        }
+        if (is_header_valid(header) && (active < 0 || header->generation > get_header(active)->generation)) {
+            active = segment;
+        }
+    }
+    if (active < 0) {
+        ESP_LOGW(TAG, "No face db of this format in partition %s, formatting.", m_partition_label);
+        ret = format_segment(0, max_generation + 1);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        active = 0;
+    }
+    m_active = active;
+    m_generation = get_header(active)->generation;
+    scan();
+    ESP_LOGI(TAG, "%d faces, %d/%d slots used.", m_num_live, m_next_slot, m_num_slots);
+
+    if (xTaskCreate(compaction_task, "FaceDBCompact", 3072, this, 1, &m_compaction_task) != pdPASS) {
+        m_compaction_task = nullptr;
+        ESP_LOGW(TAG, "Failed to create compaction task, deleted faces keep their slots.");
+    } else if (needs_compaction()) {
+        xTaskNotifyGive(m_compaction_task);
+    }
+    return ESP_OK;
+}
+
+int WhoFaceDB::enroll(const float *feat)
+{
+    if (!m_base) {
+        return -1;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    int id = -1;
+    float scale;
+    if (m_next_slot >= m_num_slots || m_max_id >= UINT16_MAX) {
+        ESP_LOGW(TAG, "Face db is full.");
+    } else if (face_index::WhoFaceIndex::quantize(feat, m_feat_len, m_row, scale) &&
+               write_record(m_active, m_next_slot, m_max_id + 1, m_row, scale) == ESP_OK) {
+        id = ++m_max_id;
+        m_num_live++;
+        m_next_slot++;
+    }
+    bool compact = needs_compaction();
+    xSemaphoreGive(m_mutex);
+    if (compact && m_compaction_task) {
+        xTaskNotifyGive(m_compaction_task);
+    }
+    return id;
+}
+
+esp_err_t WhoFaceDB::remove(int id)
+{
+    if (!m_base) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    for (int slot = 0; slot < m_next_slot; slot++) {
+        if (is_live(m_active, slot) && get_record(m_active, slot)->id == id) {
+            ret = write_tombstone(m_active, slot);
+            break;
+        }
+    }
+    if (ret == ESP_OK) {
+        scan();
+    }
+    bool compact = needs_compaction();
+    xSemaphoreGive(m_mutex);
+    if (compact && m_compaction_task) {
+        xTaskNotifyGive(m_compaction_task);
+    }
+    return ret;
+}
+
+int WhoFaceDB::remove_last()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    int id = m_num_live > 0 ? m_max_id : -1;
+    xSemaphoreGive(m_mutex);
+    // Only the caller's task changes the faces, so the id can't change in between.
+    if (id < 0 || remove(id) != ESP_OK) {
+        return -1;
+    }
+    return id;
+}
+
+esp_err_t WhoFaceDB::clear_all()
+{
+    if (!m_base) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    esp_err_t ret = ESP_OK;
+    for (int slot = 0; slot < m_next_slot && ret == ESP_OK; slot++) {
+        if (is_live(m_active, slot)) {
+            ret = write_tombstone(m_active, slot);
+        }
+    }
+    scan();
+    xSemaphoreGive(m_mutex);
+    // Don't leave the deleted features in flash longer than needed.
+    if (m_compaction_task) {
+        xTaskNotifyGive(m_compaction_task);
+    }
+    return ret;
+}
+
+int WhoFaceDB::search(const float *feat, int top_k, float thr, face_index::WhoFaceIndex::result_t *results)
+{
+    if (!m_base || top_k <= 0) {
+        return 0;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    int num_results = 0;
+    float query_scale;
+    if (face_index::WhoFaceIndex::quantize(feat, m_feat_len, m_row, query_scale)) {
+        for (int slot = 0; slot < m_next_slot; slot++) {
+            if (!is_live(m_active, slot)) {
+                continue;
+            }
+            const record_header_t *record = get_record(m_active, slot);
+            // The feature follows the 16 byte record header, the mapping keeps its 16 byte alignment.
+            const int8_t *row = (const int8_t *)(record + 1);
+            float sim = face_index::WhoFaceIndex::dot_s8(m_row, row, m_row_len) * query_scale * record->scale;
+            if (sim >= thr) {
+                face_index::WhoFaceIndex::insert_top_k(results, num_results, top_k, record->id, sim);
+            }
+        }
+    }
+    xSemaphoreGive(m_mutex);
+    return num_results;
+}
+
+void WhoFaceDB::search_batch(const float *feats, int num_feats, float thr, face_index::WhoFaceIndex::result_t *results)
+{
+    num_feats = std::min(num_feats, MAX_BATCH);
+    for (int q = 0; q < num_feats; q++) {
+        results[q] = {-1, 0};
+    }
+    if (!m_base) {
+        return;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    // A query which can't be quantized matches nothing, its scale of 0 keeps it below any thr > 0.
+    for (int q = 0; q < num_feats; q++) {
+        if (!face_index::WhoFaceIndex::quantize(
+                feats + q * m_feat_len, m_feat_len, m_queries + q * m_row_len, m_query_scales[q])) {
+            memset(m_queries + q * m_row_len, 0, m_row_len);
+            m_query_scales[q] = 0;
+        }
+    }
+    for (int slot = 0; slot < m_next_slot; slot++) {
+        if (!is_live(m_active, slot)) {
+            continue;
+        }
+        const record_header_t *record = get_record(m_active, slot);
+        const int8_t *row = (const int8_t *)(record + 1);
+        // The row stays in cache while it is compared with every query.
+        for (int q = 0; q < num_feats; q++) {
+            float sim = face_index::WhoFaceIndex::dot_s8(m_queries + q * m_row_len, row, m_row_len) *
+                m_query_scales[q] * record->scale;
+            if (sim >= thr && (results[q].id < 0 || sim > results[q].similarity)) {
+                results[q] = {record->id, sim};
+            }
+        }
+    }
+    xSemaphoreGive(m_mutex);
+}
+
+int WhoFaceDB::size()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    int num_live = m_num_live;
+    xSemaphoreGive(m_mutex);
+    return num_live;
+}
+
+const WhoFaceDB::segment_header_t *WhoFaceDB::get_header(int segment) const
+{
+    return (const segment_header_t *)(m_base + segment * m_segment_size);
+}
+
+const WhoFaceDB::record_header_t *WhoFaceDB::get_record(int segment, int slot) const
+{
+    return (const record_header_t *)(m_base + segment * m_segment_size + HEADER_SIZE + slot * m_record_size);
+}
+
+bool WhoFaceDB::is_live(int segment, int slot) const
+{
+    return get_record(segment, slot)->state == RECORD_VALID;
+}
+
+bool WhoFaceDB::is_header_valid(const segment_header_t *header) const
+{
+    return header->magic == MAGIC && header->version == FORMAT_VERSION && header->feat_len == m_feat_len &&
+        header->record_size == m_record_size &&
+        header->crc == esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(segment_header_t, crc));
+}
+
+esp_err_t WhoFaceDB::format_segment(int segment, uint32_t generation)
+{
+    esp_err_t ret = esp_partition_erase_range(m_partition, segment * m_segment_size, m_segment_size);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase segment %d, %s.", segment, esp_err_to_name(ret));
+        return ret;
+    }
+    return write_header(segment, generation);
+}
+
+esp_err_t WhoFaceDB::write_header(int segment, uint32_t generation)
+{
+    segment_header_t header = {};
+    header.magic = MAGIC;
+    header.version = FORMAT_VERSION;
+    header.feat_len = m_feat_len;
+    header.record_size = m_record_size;
+    header.generation = generation;
+    header.crc = esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(segment_header_t, crc));
+    esp_err_t ret = esp_partition_write(m_partition, segment * m_segment_size, &header, sizeof(header));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write header of segment %d, %s.", segment, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+uint32_t WhoFaceDB::get_record_crc(const record_header_t &record, const int8_t *row) const
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&record.id, offsetof(record_header_t, crc) - 4);
+    return esp_rom_crc32_le(crc, (const uint8_t *)row, m_row_len);
+}
+
+esp_err_t WhoFaceDB::write_record(int segment, int slot, int id, const int8_t *row, float scale)
+{
+    record_header_t record = {};
+    record.state = RECORD_VALID;
+    record.id = id;
+    record.scale = scale;
+    record.crc = get_record_crc(record, row);
+    size_t offset = segment * m_segment_size + HEADER_SIZE + slot * m_record_size;
+    // The state goes last, a record cut off by a reset still reads as erased and is skipped by scan().
+    esp_err_t ret = esp_partition_write(m_partition, offset + sizeof(record), row, m_row_len);
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(m_partition, offset + 4, &record.id, sizeof(record) - 4);
+    }
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(m_partition, offset, &record.state, 4);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write face %d, %s.", id, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t WhoFaceDB::write_tombstone(int segment, int slot)
+{
+    // Clearing bits needs no erase.
+    uint32_t state = RECORD_DELETED;
+    size_t offset = segment * m_segment_size + HEADER_SIZE + slot * m_record_size;
+    esp_err_t ret = esp_partition_write(m_partition, offset, &state, sizeof(state));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to delete slot %d, %s.", slot, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+void WhoFaceDB::scan()
+{
+    m_num_live = 0;
+    m_max_id = 0;
+    int slot = 0;
+    for (; slot < m_num_slots; slot++) {
+        const record_header_t *record = get_record(m_active, slot);
+        if (record->state == RECORD_ERASED) {
+            const uint32_t *words = (const uint32_t *)record;
+            if (std::all_of(words, words + m_record_size / 4, [](uint32_t w) { return w == RECORD_ERASED; })) {
+                break;
+            }
+            // A write cut off by a reset, the slot can't be written again before an erase.
+            ESP_LOGW(TAG, "Skipping partly written slot %d.", slot);
+            write_tombstone(m_active, slot);
+            continue;
+        }
+        if (record->state == RECORD_VALID) {
+            m_num_live++;
+            m_max_id = std::max<int>(m_max_id, record->id);
+        }
+    }
+    m_next_slot = slot;
+}
+
+bool WhoFaceDB::needs_compaction() const
+{
+    int num_dead = m_next_slot - m_num_live;
+    return num_dead > 0 && (num_dead >= m_num_slots / 2 || m_next_slot >= m_num_slots || m_num_live == 0);
+}
+
+void WhoFaceDB::compaction_task(void *args)
+{
+    WhoFaceDB *self = (WhoFaceDB *)args;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (self->m_stop) {
+            break;
+        }
+        xSemaphoreTake(self->m_mutex, portMAX_DELAY);
+        bool compact = self->needs_compaction();
+        xSemaphoreGive(self->m_mutex);
+        if (compact) {
+            self->compact();
+        }
+    }
+    xSemaphoreGive(self->m_compaction_done);
+    vTaskDelete(NULL);
+}
+
+void WhoFaceDB::compact()
+{
+    // Only this task writes the inactive segment, so it is erased and filled without holding the lock, searches and
+    // enrolls go on in the active one meanwhile.
+    int src = m_active;
+    int dst = 1 - src;
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_partition_erase_range(m_partition, dst * m_segment_size, m_segment_size);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase segment %d, %s.", dst, esp_err_to_name(ret));
+        return;
+    }
+
+    // Copy one record per lock, faces enrolled meanwhile are appended to src and copied in the same pass.
+    std::vector<uint16_t> src_slots;
+    int src_slot = 0;
+    while (true) {
+        xSemaphoreTake(m_mutex, portMAX_DELAY);
+        while (src_slot < m_next_slot && !is_live(src, src_slot)) {
+            src_slot++;
+        }
+        if (src_slot >= m_next_slot) {
+            // Done, keep the lock for the switch.
+            break;
+        }
+        const record_header_t *record = get_record(src, src_slot);
+        // esp_partition_write() can't read from the mapped flash, copy the feature to RAM first.
+        memcpy(m_row, record + 1, m_row_len);
+        if (get_record_crc(*record, m_row) != record->crc) {
+            ESP_LOGW(TAG, "Dropping face %d, crc mismatch.", record->id);
+        } else if (write_record(dst, src_slots.size(), record->id, m_row, record->scale) == ESP_OK) {
+            src_slots.push_back(src_slot);
+        } else {
+            xSemaphoreGive(m_mutex);
+            return;
+        }
+        src_slot++;
+        xSemaphoreGive(m_mutex);
+    }
+
+    // Faces deleted after they were copied.
+    for (size_t slot = 0; slot < src_slots.size(); slot++) {
+        if (!is_live(src, src_slots[slot])) {
+            write_tombstone(dst, slot);
+        }
+    }
+    // The new header is the commit, a reset before it keeps src.
+    ret = write_header(dst, m_generation + 1);
+    if (ret == ESP_OK) {
+        m_active = dst;
+        m_generation++;
+        scan();
+    }
+    xSemaphoreGive(m_mutex);
+    if (ret != ESP_OK) {
+        return;
+    }
+    // Invalidate the old segment so deleted faces can't come back.
+    esp_partition_erase_range(m_partition, src * m_segment_size, m_partition->erase_size);
+    ESP_LOGI(TAG, "Compacted in %lld ms.", (long long)((esp_timer_get_time() - start) / 1000));
+}
+} // namespace face_db
+} // namespace who
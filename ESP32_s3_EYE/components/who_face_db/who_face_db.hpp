@@ -0,0 +1,113 @@
+#pragma once
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "who_face_index.hpp"
+#include <atomic>
+
+namespace who {
+namespace face_db {
+// Face feature database in a raw data partition, read through esp_partition_mmap() so nothing is copied to the heap.
+//
+// The partition is split into two segments. The active one starts with a versioned header, followed by fixed size
+// records in the WhoFaceIndex row layout: a 16 byte record header and the int8 feature, 16 byte aligned. Record i is
+// at a fixed offset, so the header and the record size are the whole index.
+//
+// Enroll appends a record to the erased end of the segment. Delete writes a tombstone over the state word of the
+// record, which only clears bits and needs no erase. Clear all tombstones every record. A background task copies the
+// live records into the other segment when the active one is full or mostly tombstones, then commits the copy by
+// writing its header with the next generation. At boot the valid header with the highest generation wins, so a
+// compaction cut off by a reset leaves the old segment in use.
+//
+// Only the record states are read at open, boot time and heap use don't depend on the number of faces.
+class WhoFaceDB {
+public:
+    static inline constexpr uint32_t MAGIC = 0x42444657; // "WFDB"
+    static inline constexpr uint16_t FORMAT_VERSION = 1;
+    static inline constexpr int MAX_BATCH = 8;
+
+    WhoFaceDB(const char *partition_label, int feat_len);
+    ~WhoFaceDB();
+    // Map the partition and find the active segment, formats it if there is none. Starts the compaction task.
+    esp_err_t open();
+    // Returns the new id, or -1 if the database is full or the write failed.
+    int enroll(const float *feat);
+    esp_err_t remove(int id);
+    // Remove the face with the highest id, returns its id or -1 if there is none.
+    int remove_last();
+    esp_err_t clear_all();
+    int search(const float *feat, int top_k, float thr, face_index::WhoFaceIndex::result_t *results);
+    // Best match of up to MAX_BATCH features in one pass, so every record is read from flash once. results[i] gets
+    // the match of feats[i] with a similarity of at least thr, or id -1.
+    void search_batch(const float *feats, int num_feats, float thr, face_index::WhoFaceIndex::result_t *results);
+    int size();
+    int capacity() const { return m_num_slots; }
+    int get_feat_len() const { return m_feat_len; }
+
+private:
+    typedef struct {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t feat_len;
+        uint16_t record_size;
+        uint16_t reserved0;
+        uint32_t generation;
+        uint32_t reserved1[3];
+        uint32_t crc;
+    } segment_header_t;
+
+    typedef struct {
+        uint32_t state;
+        uint16_t id;
+        uint16_t reserved;
+        float scale;
+        // Of id, reserved, scale and the feature.
+        uint32_t crc;
+    } record_header_t;
+
+    static inline constexpr uint32_t RECORD_ERASED = 0xffffffff;
+    static inline constexpr uint32_t RECORD_VALID = 0x7e7e7e7e;
+    static inline constexpr uint32_t RECORD_DELETED = 0;
+    static inline constexpr size_t HEADER_SIZE = 32;
+
+    static void compaction_task(void *args);
+    const segment_header_t *get_header(int segment) const;
+    const record_header_t *get_record(int segment, int slot) const;
+    bool is_live(int segment, int slot) const;
+    bool is_header_valid(const segment_header_t *header) const;
+    esp_err_t format_segment(int segment, uint32_t generation);
+    esp_err_t write_header(int segment, uint32_t generation);
+    uint32_t get_record_crc(const record_header_t &record, const int8_t *row) const;
+    esp_err_t write_record(int segment, int slot, int id, const int8_t *row, float scale);
+    esp_err_t write_tombstone(int segment, int slot);
+    void scan();
+    bool needs_compaction() const;
+    void compact();
+
+    const char *m_partition_label;
+    const int m_feat_len;
+    const int m_row_len;
+    const size_t m_record_size;
+    const esp_partition_t *m_partition;
+    esp_partition_mmap_handle_t m_mmap_handle;
+    const uint8_t *m_base;
+    size_t m_segment_size;
+    int m_num_slots;
+    int m_active;
+    uint32_t m_generation;
+    // Next erased slot of the active segment.
+    int m_next_slot;
+    int m_num_live;
+    int m_max_id;
+    int8_t *m_row;
+    // MAX_BATCH quantized queries and their scales.
+    int8_t *m_queries;
+    float m_query_scales[MAX_BATCH];
+    SemaphoreHandle_t m_mutex;
+    TaskHandle_t m_compaction_task;
+    SemaphoreHandle_t m_compaction_done;
+    std::atomic<bool> m_stop;
+};
+} // namespace face_db
+} // namespace who
@@ -0,0 +1,97 @@
+// Lookup time of WhoFaceIndex against the float linear match of the face database, for growing database sizes.
+// Queries are noisy copies of enrolled features, the top-1 agreement shows what the int8 quantization costs.
+#include "who_face_index.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace who::face_index;
+
+static constexpr int FEAT_LEN = 512;
+static constexpr int NUM_QUERIES = 200;
+
+static void normalize(float *feat)
+{
+    float norm = 0;
+    for (int i = 0; i < FEAT_LEN; i++) {
+        norm += feat[i] * feat[i];
+    }
+    norm = 1.f / std::sqrt(norm);
+    for (int i = 0; i < FEAT_LEN; i++) {
+        feat[i] *= norm;
+    }
+}
+
+// What the float database does: cosine of normalized features against every row.
+static int float_search(const std::vector<float> &feats, int num, const float *query, float &best_sim)
+{
+    int best = -1;
+    best_sim = -2;
+    for (int i = 0; i < num; i++) {
+        const float *row = &feats[(size_t)i * FEAT_LEN];
+        float sim = 0;
+        for (int j = 0; j < FEAT_LEN; j++) {
+            sim += row[j] * query[j];
+        }
+        if (sim > best_sim) {
+            best_sim = sim;
+            best = i;
+        }
+    }
+    return best;
+}
+
+int main()
+{
+    std::mt19937 rng(4216);
+    std::normal_distribution<float> dist(0, 1);
+    const int sizes[] = {10, 50, 100, 500, 1000, 2000, 5000};
+
+    printf("%8s %14s %14s %8s %10s\n", "faces", "float (us)", "int8 (us)", "speedup", "top1 agree");
+    for (int num : sizes) {
+        std::vector<float> feats((size_t)num * FEAT_LEN);
+        for (auto &v : feats) {
+            v = dist(rng);
+        }
+        WhoFaceIndex index(FEAT_LEN, num);
+        for (int i = 0; i < num; i++) {
+            normalize(&feats[(size_t)i * FEAT_LEN]);
+            index.add(i, &feats[(size_t)i * FEAT_LEN]);
+        }
+        std::vector<float> queries((size_t)NUM_QUERIES * FEAT_LEN);
+        for (int q = 0; q < NUM_QUERIES; q++) {
+            const float *src = &feats[(size_t)(rng() % num) * FEAT_LEN];
+            for (int j = 0; j < FEAT_LEN; j++) {
+                queries[(size_t)q * FEAT_LEN + j] = src[j] + 0.05f * dist(rng);
+            }
+            normalize(&queries[(size_t)q * FEAT_LEN]);
+        }
+
+        std::vector<int> float_best(NUM_QUERIES);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int q = 0; q < NUM_QUERIES; q++) {
+            float sim;
+            float_best[q] = float_search(feats, num, &queries[(size_t)q * FEAT_LEN], sim);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        int agree = 0;
+        for (int q = 0; q < NUM_QUERIES; q++) {
+            WhoFaceIndex::result_t res[5];
+            int n = index.search(&queries[(size_t)q * FEAT_LEN], 5, -1.f, res);
+            agree += n > 0 && res[0].id == float_best[q];
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        double float_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / NUM_QUERIES;
+        double int8_us = std::chrono::duration<double, std::micro>(t2 - t1).count() / NUM_QUERIES;
+        printf("%8d %14.2f %14.2f %7.1fx %9.1f%%\n",
+               num,
+               float_us,
+               int8_us,
+               float_us / int8_us,
+               100.0 * agree / NUM_QUERIES);
+    }
+    return 0;
+}
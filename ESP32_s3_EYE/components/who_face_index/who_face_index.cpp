@@ -0,0 +1,166 @@
+#include "who_face_index.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#if ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#endif
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// who_face_index_dot_s8_esp32s3.S
+extern "C" int32_t who_face_index_dot_s8_esp32s3(const int8_t *a, const int8_t *b, int len);
+#endif
+
+namespace who {
+namespace face_index {
+static void *alloc_aligned(size_t size)
+{
+#if ESP_PLATFORM
+    void *ptr = heap_caps_aligned_alloc(16, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!ptr) {
+        ptr = heap_caps_aligned_alloc(16, size, MALLOC_CAP_8BIT);
+    }
+    return ptr;
+#else
+    return aligned_alloc(16, (size + 15) & ~(size_t)15);
+#endif
+}
+
+static void free_aligned(void *ptr)
+{
+#if ESP_PLATFORM
+    heap_caps_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+WhoFaceIndex::WhoFaceIndex(int feat_len, int capacity) :
+    m_feat_len(feat_len),
+    m_row_len(get_row_len(feat_len)),
+    m_capacity(capacity),
+    m_num_rows(0),
+    m_rows((int8_t *)alloc_aligned((size_t)m_row_len * capacity)),
+    m_scales((float *)alloc_aligned(sizeof(float) * capacity)),
+    m_ids((int *)alloc_aligned(sizeof(int) * capacity)),
+    m_query((int8_t *)alloc_aligned(m_row_len))
+{
+    if (!m_rows || !m_scales || !m_ids || !m_query) {
+#if ESP_PLATFORM
+        ESP_LOGE("WhoFaceIndex", "Failed to alloc index for %d faces.", capacity);
+#endif
+        // add() and search() check m_rows only.
+        free_aligned(m_rows);
+        m_rows = nullptr;
+    }
+}
+
+WhoFaceIndex::~WhoFaceIndex()
+{
+    free_aligned(m_rows);
+    free_aligned(m_scales);
+    free_aligned(m_ids);
+    free_aligned(m_query);
+}
+
+bool WhoFaceIndex::quantize(const float *feat, int feat_len, int8_t *dst, float &scale)
+{
+    float norm = 0;
+    float max_abs = 0;
+    for (int i = 0; i < feat_len; i++) {
+        norm += feat[i] * feat[i];
+        max_abs = std::max(max_abs, std::fabs(feat[i]));
+    }
+    if (norm <= 0) {
+        return false;
+    }
+    // Scale of the normalized feature, the largest element maps to 127.
+    float inv_norm = 1.f / std::sqrt(norm);
+    scale = max_abs * inv_norm / 127.f;
+    float inv_q = 127.f / max_abs;
+    for (int i = 0; i < feat_len; i++) {
+        dst[i] = (int8_t)std::lround(feat[i] * inv_q);
+    }
+    // The padding takes part in every dot product.
+    memset(dst + feat_len, 0, get_row_len(feat_len) - feat_len);
+    return true;
+}
+
+bool WhoFaceIndex::add(int id, const float *feat)
+{
+    if (!m_rows || m_num_rows >= m_capacity) {
+        return false;
+    }
+    if (!quantize(feat, m_feat_len, get_row(m_num_rows), m_scales[m_num_rows])) {
+        return false;
+    }
+    m_ids[m_num_rows] = id;
+    m_num_rows++;
+    return true;
+}
+
+bool WhoFaceIndex::remove(int id)
+{
+    bool found = false;
+    for (int i = 0; i < m_num_rows;) {
+        if (m_ids[i] != id) {
+            i++;
+            continue;
+        }
+        found = true;
+        int last = --m_num_rows;
+        if (i != last) {
+            memcpy(get_row(i), get_row(last), m_row_len);
+            m_scales[i] = m_scales[last];
+            m_ids[i] = m_ids[last];
+        }
+    }
+    return found;
+}
+
+int WhoFaceIndex::search(const float *feat, int top_k, float thr, result_t *results)
+{
+    float query_scale;
+    if (!m_rows || top_k <= 0 || !quantize(feat, m_feat_len, m_query, query_scale)) {
+        return 0;
+    }
+    int num_results = 0;
+    for (int i = 0; i < m_num_rows; i++) {
+        float sim = dot_s8(m_query, get_row(i), m_row_len) * query_scale * m_scales[i];
+        if (sim >= thr) {
+            insert_top_k(results, num_results, top_k, m_ids[i], sim);
+        }
+    }
+    return num_results;
+}
+
+void WhoFaceIndex::insert_top_k(result_t *results, int &num_results, int top_k, int id, float similarity)
+{
+    // top_k is small, insertion into the sorted results is cheaper than a heap.
+    if (num_results == top_k && similarity <= results[top_k - 1].similarity) {
+        return;
+    }
+    int j = num_results < top_k ? num_results++ : top_k - 1;
+    for (; j > 0 && results[j - 1].similarity < similarity; j--) {
+        results[j] = results[j - 1];
+    }
+    results[j] = {id, similarity};
+}
+
+int32_t WhoFaceIndex::dot_s8(const int8_t *a, const int8_t *b, int len)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    return who_face_index_dot_s8_esp32s3(a, b, len);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < len; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+#endif
+}
+} // namespace face_index
+} // namespace who
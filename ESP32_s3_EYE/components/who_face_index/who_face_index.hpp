@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace who {
+namespace face_index {
+// In RAM search index over the enrolled face features.
+//
+// Features are L2 normalized and quantized to int8 with one scale per row, so the cosine similarity of two features
+// is dot(a, b) * scale_a * scale_b. Rows are padded to a multiple of 16 bytes and 16 byte aligned, which is the layout
+// the ESP32-S3 PIE vector loads need, and the whole matrix is one block so a search streams through it linearly.
+// On other targets a scalar loop is used which the compiler can vectorize.
+//
+// Not thread safe, search() uses a scratch buffer for the quantized query.
+class WhoFaceIndex {
+public:
+    typedef struct {
+        int id;
+        float similarity;
+    } result_t;
+
+    // The matrix for capacity rows is allocated at once, in PSRAM if there is some.
+    WhoFaceIndex(int feat_len, int capacity);
+    ~WhoFaceIndex();
+    WhoFaceIndex(const WhoFaceIndex &) = delete;
+    WhoFaceIndex &operator=(const WhoFaceIndex &) = delete;
+
+    // Returns false if the index is full, the allocation failed or feat is all zeros.
+    bool add(int id, const float *feat);
+    // Removes every row with this id. The last row takes the place of a removed one, so the order is not kept.
+    bool remove(int id);
+    void clear() { m_num_rows = 0; }
+    int size() const { return m_num_rows; }
+    int capacity() const { return m_capacity; }
+    int get_feat_len() const { return m_feat_len; }
+    // Writes up to top_k rows with a similarity of at least thr to results, best first, and returns how many.
+    int search(const float *feat, int top_k, float thr, result_t *results);
+
+    // a and b are 16 byte aligned, len is a multiple of 16.
+    static int32_t dot_s8(const int8_t *a, const int8_t *b, int len);
+    // Rows have feat_len rounded up to 16 elements.
+    static int get_row_len(int feat_len) { return (feat_len + 15) & ~15; }
+    // Fill a row of row_len int8 values and its scale. Returns false if feat is all zeros.
+    static bool quantize(const float *feat, int feat_len, int8_t *dst, float &scale);
+    // Keep results sorted best first with at most top_k entries.
+    static void insert_top_k(result_t *results, int &num_results, int top_k, int id, float similarity);
+
+private:
+    int8_t *get_row(int i) const { return m_rows + (size_t)i * m_row_len; }
+
+    const int m_feat_len;
+    // feat_len rounded up to 16.
+    const int m_row_len;
+    const int m_capacity;
+    int m_num_rows;
+    int8_t *m_rows;
+    float *m_scales;
+    int *m_ids;
+    int8_t *m_query;
+};
+} // namespace face_index
+} // namespace who
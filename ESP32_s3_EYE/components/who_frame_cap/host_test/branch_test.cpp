@@ -0,0 +1,168 @@
+// A fetch node feeds two nodes added with WhoFrameCap::add_branch(), a slow one behind an overwriting queue and a fast
+// one behind a blocking queue, all running as host threads. Checks that no camera frame is given back while it is
+// queued to or processed by a branch, that none is given back twice, and that the slow branch skips frames instead of
+// holding up the fetch node. The pipeline is stopped and run again, the frames released on stop come back then.
+#include "who_frame_cap.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace who::cam;
+using namespace who::frame_cap;
+using namespace std::chrono_literals;
+
+static constexpr int FETCH_RINGBUF_LEN = 2;
+static constexpr int SLOW_QUEUE_LEN = 1;
+static constexpr int FAST_QUEUE_LEN = 2;
+// Every branch leases the frames queued to it and the one it processes.
+static constexpr int MAX_LEASED = (SLOW_QUEUE_LEN + 1) + (FAST_QUEUE_LEN + 1);
+// The ringbuf, the fb being filled and every lease, all of which may have left the ringbuf.
+static constexpr int FB_COUNT = FETCH_RINGBUF_LEN + 1 + MAX_LEASED;
+
+typedef struct {
+    std::atomic<bool> in_use;
+    std::atomic<uint32_t> seq;
+} frame_t;
+
+static std::atomic<int> s_errors(0);
+
+static void check(bool cond, const char *what)
+{
+    if (!cond && s_errors.fetch_add(1) < 10) {
+        printf("FAIL: %s\n", what);
+    }
+}
+
+// Delivers a frame every millisecond like a camera. A fb given back is free for the next capture, as the DMA would
+// overwrite it.
+class HostCam : public WhoCam {
+public:
+    HostCam() : WhoCam(FB_COUNT, 64, 48), m_frames(FB_COUNT), m_seq(0)
+    {
+        for (int i = 0; i < FB_COUNT; i++) {
+            m_frames[i].in_use.store(false);
+            m_frames[i].seq.store(0);
+            m_cam_fbs[i].buf = &m_frames[i];
+            m_cam_fbs[i].len = sizeof(frame_t);
+            m_cam_fbs[i].width = m_fb_width;
+            m_cam_fbs[i].height = m_fb_height;
+            m_cam_fbs[i].format = cam_fb_fmt_t::CAM_FB_FMT_RGB565;
+            m_free_fbs.push_back(&m_cam_fbs[i]);
+        }
+    }
+
+    cam_fb_t *cam_fb_get() override
+    {
+        std::this_thread::sleep_for(1ms);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Like the camera driver, give up if no fb comes back for a while.
+        if (!m_cond.wait_for(lock, 100ms, [this] { return !m_free_fbs.empty(); })) {
+            return nullptr;
+        }
+        cam_fb_t *fb = m_free_fbs.back();
+        m_free_fbs.pop_back();
+        frame_t *frame = (frame_t *)fb->buf;
+        frame->seq.store(++m_seq);
+        frame->in_use.store(true);
+        int64_t now = who::stats::WhoStats::now_us();
+        fb->timestamp.tv_sec = now / 1000000;
+        fb->timestamp.tv_usec = now % 1000000;
+        return fb;
+    }
+
+    void cam_fb_return(cam_fb_t *fb) override
+    {
+        check(((frame_t *)fb->buf)->in_use.exchange(false), "fb given back twice");
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free_fbs.push_back(fb);
+        m_cond.notify_one();
+    }
+
+    cam_fb_fmt_t get_fb_format() override { return cam_fb_fmt_t::CAM_FB_FMT_RGB565; }
+
+private:
+    std::vector<frame_t> m_frames;
+    std::vector<cam_fb_t *> m_free_fbs;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    uint32_t m_seq;
+};
+
+// Reads the camera frame for process_ms and passes a copy of its header on.
+class ReadNode : public WhoFrameCapNode {
+public:
+    ReadNode(const std::string &name, int process_ms) :
+        WhoFrameCapNode(name, 1, 0), m_process_ms(process_ms), m_processed(0)
+    {
+    }
+    uint16_t get_fb_width() override { return get_prev_node()->get_fb_width(); }
+    uint16_t get_fb_height() override { return get_prev_node()->get_fb_height(); }
+    std::string get_type() override { return "ReadNode"; }
+    int get_processed() { return m_processed.load(); }
+
+private:
+    void cleanup() override
+    {
+        drain_in_queue();
+        clear_ringbuf();
+    }
+
+    cam_fb_t *process(cam_fb_t *fb) override
+    {
+        frame_t *frame = (frame_t *)fb->buf;
+        uint32_t seq = frame->seq.load();
+        check(frame->in_use.load(), "queued fb given back");
+        // The fetch node goes on meanwhile, so the frame leaves its ringbuf.
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_process_ms);
+        do {
+            check(frame->in_use.load() && frame->seq.load() == seq, "fb given back while it is processed");
+            std::this_thread::yield();
+        } while (std::chrono::steady_clock::now() < end);
+        m_processed++;
+        cam_fb_t *out_fb = new cam_fb_t(*fb);
+        out_fb->buf = nullptr;
+        return out_fb;
+    }
+
+    void recycle_fb(cam_fb_t *fb) override { delete fb; }
+
+    int m_process_ms;
+    std::atomic<int> m_processed;
+};
+
+static void test_branches()
+{
+    auto frame_cap = new WhoFrameCap();
+    auto fetch = frame_cap->add_node<WhoFetchNode>("Fetch", new HostCam(), FETCH_RINGBUF_LEN, MAX_LEASED);
+    auto slow = frame_cap->add_branch<ReadNode>(fetch, SLOW_QUEUE_LEN, true, "Slow", 10);
+    auto fast = frame_cap->add_branch<ReadNode>(fetch, FAST_QUEUE_LEN, false, "Fast", 1);
+    for (int i = 0; i < 2; i++) {
+        check(frame_cap->run({{4096, 2, 0}, {4096, 2, 1}, {4096, 2, 1}}), "run the pipeline");
+        std::this_thread::sleep_for(500ms);
+        frame_cap->stop();
+    }
+    printf("fetch: %u out, %u dropped, slow: %d, fast: %d\n",
+           (unsigned)fetch->get_stats().get_frames_out(),
+           (unsigned)fetch->get_stats().get_frames_dropped(),
+           slow->get_processed(),
+           fast->get_processed());
+    check(slow->get_processed() > 10, "the slow branch gets frames");
+    check(fast->get_processed() > 2 * slow->get_processed(), "the slow branch does not hold up the fast one");
+    check(fetch->get_stats().get_frames_dropped() > 0, "the slow branch skips frames");
+    delete frame_cap;
+}
+
+int main()
+{
+    test_branches();
+    if (s_errors.load()) {
+        printf("%d errors\n", s_errors.load());
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,233 @@
+// One producer pushes frames into a SeqRing while several readers peek, acquire, retain and release them, the way
+// the frame cap node and its subscribers do. Checks that a leased frame is never recycled, that the newest frame a
+// reader sees never goes back in time and that every frame is given back exactly once. Then checks that leases
+// outside the ring which are released while the producer has no frame left come back through reclaim().
+#include "who_seq_ring.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace who::frame_cap;
+
+static constexpr int CAPACITY = 3;
+static constexpr int MAX_LEASED = 4;
+static constexpr int NUM_READERS = 4;
+static constexpr int NUM_PUSHES = 1000000;
+
+typedef struct {
+    std::atomic<bool> in_use;
+    std::atomic<uint32_t> seq;
+} frame_t;
+
+static std::atomic<int> s_errors(0);
+
+static void check(bool cond, const char *what)
+{
+    if (!cond && s_errors.fetch_add(1) < 10) {
+        printf("FAIL: %s\n", what);
+    }
+}
+
+static void reader(SeqRing<frame_t *> &ring, std::atomic<bool> &done, int id)
+{
+    uint32_t last_newest = 0;
+    int leases = 0;
+    while (!done.load()) {
+        // Same as a subscriber with a single lease at a time, plus the retain of a lease handed over to another task.
+        int index = (leases % 3 == 0) ? 0 : -1;
+        frame_t *frame = ring.acquire(index);
+        if (!frame) {
+            std::this_thread::yield();
+            continue;
+        }
+        leases++;
+        check(frame->in_use.load(), "acquired a recycled frame");
+        uint32_t seq = frame->seq.load();
+        if (index == -1) {
+            check(seq >= last_newest, "newest frame went back in time");
+            last_newest = seq;
+        }
+        bool retained = (leases + id) % 4 == 0 && ring.retain(frame);
+        for (int i = 0; i < 50; i++) {
+            check(frame->in_use.load() && frame->seq.load() == seq, "leased frame recycled or reused");
+        }
+        if (retained) {
+            check(ring.release(frame), "release of a retained frame");
+        }
+        check(ring.release(frame), "release of a leased frame");
+        // peek gives no guarantee on the frame, only that it does not crash or return garbage
+        frame_t *peeked = ring.peek(-1);
+        (void)peeked;
+    }
+    printf("reader %d: %d leases\n", id, leases);
+}
+
+static void test_stress()
+{
+    // Enough frames for the ring, every lease and the one the producer is about to push.
+    std::vector<frame_t> frames(CAPACITY + MAX_LEASED + 1);
+    std::vector<frame_t *> free_frames;
+    for (auto &frame : frames) {
+        frame.in_use.store(false);
+        frame.seq.store(0);
+        free_frames.push_back(&frame);
+    }
+    SeqRing<frame_t *> ring(CAPACITY, MAX_LEASED);
+    int pushed = 0, refused = 0, recycled = 0;
+    auto recycle = [&](frame_t *frame) {
+        if (!frame->in_use.exchange(false)) {
+            check(false, "frame recycled twice");
+        }
+        free_frames.push_back(frame);
+        recycled++;
+    };
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < NUM_READERS; i++) {
+        readers.emplace_back(reader, std::ref(ring), std::ref(done), i);
+    }
+    for (uint32_t seq = 1; seq <= NUM_PUSHES; seq++) {
+        if (free_frames.empty()) {
+            check(false, "out of frames, a frame was never given back");
+            break;
+        }
+        frame_t *frame = free_frames.back();
+        free_frames.pop_back();
+        frame->seq.store(seq);
+        frame->in_use.store(true);
+        if (ring.push(frame, recycle)) {
+            pushed++;
+        } else {
+            // The caller keeps a refused frame and gives it back itself, as the frame cap node does.
+            refused++;
+            frame->in_use.store(false);
+            free_frames.push_back(frame);
+        }
+    }
+    done.store(true);
+    for (auto &t : readers) {
+        t.join();
+    }
+    ring.clear(recycle);
+
+    check(recycled == pushed, "every pushed frame is recycled once");
+    check(free_frames.size() == frames.size(), "every frame is free at the end");
+    check(ring.empty(), "ring is empty after clear");
+    printf("pushed %d, refused %d, recycled %d\n", pushed, refused, recycled);
+}
+
+static void escaped_reader(SeqRing<frame_t *> &ring, std::atomic<bool> &done, int id)
+{
+    while (!done.load()) {
+        // Lease the newest frame and hold it for longer than the ring keeps it, like a slow recognition job.
+        frame_t *frame = ring.acquire(-1);
+        if (!frame) {
+            std::this_thread::yield();
+            continue;
+        }
+        // Every reader takes other frames, so the leases pile up outside the ring.
+        uint32_t seq = frame->seq.load();
+        if (seq % MAX_LEASED != (uint32_t)id) {
+            ring.release(frame);
+            std::this_thread::yield();
+            continue;
+        }
+        for (int i = 0; i < 10 * CAPACITY; i++) {
+            check(frame->in_use.load() && frame->seq.load() == seq, "leased frame recycled or reused");
+            std::this_thread::yield();
+        }
+        check(ring.release(frame), "release of an escaped lease");
+    }
+}
+
+static void test_escaped_leases()
+{
+    // Only enough frames for the ring and every lease. With every lease outside the ring the producer runs out of
+    // frames and pushes nothing, so only reclaim() gets the released ones back.
+    std::vector<frame_t> frames(CAPACITY + MAX_LEASED);
+    std::vector<frame_t *> free_frames;
+    for (auto &frame : frames) {
+        frame.in_use.store(false);
+        frame.seq.store(0);
+        free_frames.push_back(&frame);
+    }
+    SeqRing<frame_t *> ring(CAPACITY, MAX_LEASED);
+    auto recycle = [&](frame_t *frame) {
+        check(frame->in_use.exchange(false), "frame recycled twice");
+        free_frames.push_back(frame);
+    };
+    auto push_next = [&](uint32_t seq) {
+        frame_t *frame = free_frames.back();
+        free_frames.pop_back();
+        frame->seq.store(seq);
+        frame->in_use.store(true);
+        check(ring.push(frame, recycle), "push with leases within max_leased");
+    };
+
+    // Lease MAX_LEASED frames and push them out of the ring, then release them without pushing again.
+    uint32_t seq = 0;
+    std::vector<frame_t *> leases;
+    for (int i = 0; i < MAX_LEASED; i++) {
+        push_next(++seq);
+        leases.push_back(ring.acquire(-1));
+    }
+    for (int i = 0; i < CAPACITY; i++) {
+        push_next(++seq);
+    }
+    check(free_frames.empty(), "leased frames outside the ring are kept");
+    for (frame_t *frame : leases) {
+        check(ring.release(frame), "release of an escaped lease");
+    }
+    check(free_frames.empty(), "released frames wait for reclaim");
+    ring.reclaim(recycle);
+    check((int)free_frames.size() == MAX_LEASED, "reclaim gives back every released lease");
+
+    // Same with readers racing the producer, which reclaims before taking a frame and while it has none.
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < MAX_LEASED; i++) {
+        readers.emplace_back(escaped_reader, std::ref(ring), std::ref(done), i);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    int waits = 0;
+    for (int i = 0; i < NUM_PUSHES / 10; i++) {
+        ring.reclaim(recycle);
+        while (free_frames.empty()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                check(false, "producer stalled with every frame released");
+                break;
+            }
+            waits++;
+            std::this_thread::yield();
+            ring.reclaim(recycle);
+        }
+        if (free_frames.empty()) {
+            break;
+        }
+        push_next(++seq);
+        // Let the readers catch up, as a camera waiting for the next frame does.
+        std::this_thread::yield();
+    }
+    done.store(true);
+    for (auto &t : readers) {
+        t.join();
+    }
+    ring.clear(recycle);
+    check(free_frames.size() == frames.size(), "every frame is free at the end");
+    printf("escaped leases: %d waits for a frame\n", waits);
+}
+
+int main()
+{
+    test_stress();
+    test_escaped_leases();
+    if (s_errors.load()) {
+        printf("%d errors\n", s_errors.load());
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
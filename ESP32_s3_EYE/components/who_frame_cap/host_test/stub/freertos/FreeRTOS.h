@@ -0,0 +1,250 @@
+#pragma once
+// FreeRTOS on std::thread for the branch test, enough to run the frame cap nodes as real tasks: tasks, queues, event
+// groups and mutexes, all blocking with timeouts. One tick is one millisecond. C++ only.
+#include "sdkconfig.h"
+#include <assert.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t EventBits_t;
+typedef uint32_t configSTACK_DEPTH_TYPE;
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_PRIORITIES 25
+
+namespace host_freertos {
+template <typename Pred>
+bool wait(std::condition_variable &cond, std::unique_lock<std::mutex> &lock, TickType_t ticks, Pred pred)
+{
+    if (ticks == portMAX_DELAY) {
+        cond.wait(lock, pred);
+        return true;
+    }
+    return cond.wait_for(lock, std::chrono::milliseconds(ticks), pred);
+}
+
+// Thrown by vTaskDelete(NULL) to leave the task function.
+struct task_exit {};
+} // namespace host_freertos
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+// Tasks.
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct host_task *TaskHandle_t;
+
+struct host_task {
+    std::thread thread;
+};
+
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func,
+                                                 const char *name,
+                                                 configSTACK_DEPTH_TYPE stack_depth,
+                                                 void *arg,
+                                                 UBaseType_t priority,
+                                                 TaskHandle_t *handle,
+                                                 BaseType_t core_id)
+{
+    (void)name, (void)stack_depth, (void)priority, (void)core_id;
+    // The handle is never freed, like a deleted task on the target it is never touched again.
+    TaskHandle_t task = new host_task;
+    task->thread = std::thread([func, arg]() {
+        try {
+            func(arg);
+        } catch (const host_freertos::task_exit &) {
+        }
+    });
+    task->thread.detach();
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+static inline void vTaskDelete(TaskHandle_t task)
+{
+    assert(!task);
+    throw host_freertos::task_exit{};
+}
+
+static inline BaseType_t xTaskAbortDelay(TaskHandle_t task)
+{
+    (void)task;
+    return pdFAIL;
+}
+
+// Queues.
+
+struct host_queue {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t len;
+    UBaseType_t item_size;
+};
+typedef host_queue *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    QueueHandle_t q = new host_queue;
+    q->len = len;
+    q->item_size = item_size;
+    return q;
+}
+
+static inline void vQueueDelete(QueueHandle_t q)
+{
+    delete q;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t timeout)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!host_freertos::wait(q->cond, lock, timeout, [q] { return q->items.size() < q->len; })) {
+        return pdFAIL;
+    }
+    const uint8_t *bytes = (const uint8_t *)item;
+    q->items.emplace_back(bytes, bytes + q->item_size);
+    q->cond.notify_all();
+    return pdPASS;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t timeout)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!host_freertos::wait(q->cond, lock, timeout, [q] { return !q->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    q->cond.notify_all();
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->items.size();
+}
+
+static inline UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->len - q->items.size();
+}
+
+// Event groups.
+
+struct host_event_group {
+    std::mutex mutex;
+    std::condition_variable cond;
+    EventBits_t bits = 0;
+};
+typedef host_event_group *EventGroupHandle_t;
+
+static inline EventGroupHandle_t xEventGroupCreate(void)
+{
+    return new host_event_group;
+}
+
+static inline void vEventGroupDelete(EventGroupHandle_t group)
+{
+    delete group;
+}
+
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->cond.notify_all();
+    return group->bits;
+}
+
+static inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t old_bits = group->bits;
+    group->bits &= ~bits;
+    return old_bits;
+}
+
+static inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+static inline EventBits_t xEventGroupWaitBits(
+    EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t timeout)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto ready = [&] { return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+    bool ok = host_freertos::wait(group->cond, lock, timeout, ready);
+    EventBits_t ret = group->bits;
+    if (ok && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return ret;
+}
+
+// Mutexes, a binary semaphore which can be taken with a timeout from any thread.
+
+struct host_semaphore {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool taken = false;
+};
+typedef host_semaphore *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return new host_semaphore;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    delete sem;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    std::unique_lock<std::mutex> lock(sem->mutex);
+    if (!host_freertos::wait(sem->cond, lock, timeout, [sem] { return !sem->taken; })) {
+        return pdFALSE;
+    }
+    sem->taken = true;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    std::lock_guard<std::mutex> lock(sem->mutex);
+    sem->taken = false;
+    sem->cond.notify_one();
+    return pdTRUE;
+}
@@ -1,4 +1,5 @@
 #include "who_frame_cap.hpp"
+#include "esp_log.h"
 
 static const char *TAG = "WhoFrameCap";
 
@@ -14,6 +15,15 @@ bool WhoFrameCap::run(std::vector<std::tuple<const configSTACK_DEPTH_TYPE, UBase
     return ret;
 }
 
+void WhoFrameCap::connect(WhoFrameCapNode *prev_node, WhoFrameCapNode *node, uint8_t queue_len, bool overwrite)
+{
+    QueueHandle_t queue = xQueueCreate(std::max<uint8_t>(queue_len, 1), sizeof(who::cam::cam_fb_t *));
+    node->set_in_queue(queue);
+    node->set_prev_node(prev_node);
+    prev_node->add_out_edge(node, queue, overwrite);
+    m_queues.emplace_back(queue);
+}
+
 WhoFrameCapNode *WhoFrameCap::get_node(const std::string &name)
 {
     auto it = std::find_if(
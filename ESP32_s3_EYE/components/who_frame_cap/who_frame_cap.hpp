@@ -13,31 +13,44 @@ public:
         }
     }
 
+    // Append a node fed by the node added before it, through a queue of one frame with the overwrite policy of that
+    // node.
     template <typename T, typename... Args>
-    void add_node(Args &&...args)
+    T *add_node(Args &&...args)
     {
         T *node = new T(std::forward<Args>(args)...);
         if (!m_nodes.empty()) {
             auto &prev_node = m_nodes.back();
-            QueueHandle_t queue = xQueueCreate(1, sizeof(who::cam::cam_fb_t *));
-            node->set_in_queue(queue);
-            node->set_prev_node(prev_node);
-            prev_node->set_out_queue(queue);
-            prev_node->set_next_node(node);
-            m_queues.emplace_back(queue);
+            connect(prev_node, node, 1, prev_node->get_out_queue_overwrite());
         }
         m_nodes.emplace_back(node);
         WhoTaskGroup::register_task(node);
+        return node;
+    }
+
+    // Add a node fed by prev_node next to the nodes prev_node feeds already, e.g. a downscaled copy for detection and a
+    // gray one for motion from one capture. Every branch has its own queue of queue_len frames. With overwrite a slow
+    // branch misses frames, otherwise it holds up prev_node and every other branch of it.
+    template <typename T, typename... Args>
+    T *add_branch(WhoFrameCapNode *prev_node, uint8_t queue_len, bool overwrite, Args &&...args)
+    {
+        T *node = new T(std::forward<Args>(args)...);
+        connect(prev_node, node, queue_len, overwrite);
+        m_nodes.emplace_back(node);
+        WhoTaskGroup::register_task(node);
+        return node;
     }
 
     bool run(std::vector<std::tuple<const configSTACK_DEPTH_TYPE, UBaseType_t, const BaseType_t>> args);
 
     WhoFrameCapNode *get_node(const std::string &name);
     WhoFrameCapNode *get_node(int i);
+    // The node added last, the one detection takes its frames from.
     WhoFrameCapNode *get_last_node();
     std::vector<WhoFrameCapNode *> get_all_nodes() { return m_nodes; }
 
 private:
+    void connect(WhoFrameCapNode *prev_node, WhoFrameCapNode *node, uint8_t queue_len, bool overwrite);
     std::vector<WhoFrameCapNode *> m_nodes;
     std::vector<QueueHandle_t> m_queues;
 };
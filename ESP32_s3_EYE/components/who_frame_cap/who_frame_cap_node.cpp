@@ -1,31 +1,35 @@
 #include "who_frame_cap_node.hpp"
+#include "esp_log.h"
+#if CONFIG_SOC_PPA_SUPPORTED
 #include "hal/cache_hal.h"
 #include "hal/cache_ll.h"
+#endif
+#if !CONFIG_SOC_JPEG_CODEC_SUPPORTED && !CONFIG_IDF_TARGET_LINUX
+#include "jpeg_decoder.h"
+#endif
+#include <algorithm>
 
 using namespace who::cam;
 static const char *TAG = "WhoFrameCapNode";
 
 namespace who {
 namespace frame_cap {
-WhoFrameCapNode::WhoFrameCapNode(const std::string &name, uint8_t ringbuf_len, bool out_queue_overwrite) :
+WhoFrameCapNode::WhoFrameCapNode(const std::string &name,
+                                 uint8_t ringbuf_len,
+                                 uint8_t max_leased,
+                                 bool out_queue_overwrite) :
     task::WhoTask(name),
     m_out_queue_overwrite(out_queue_overwrite),
-    m_out_queue(nullptr),
     m_prev_node(nullptr),
-    m_next_node(nullptr),
+    m_stats(name),
     m_in_queue(nullptr),
-    m_cam_fbs(ringbuf_len),
-    m_mutex(xSemaphoreCreateMutex())
+    m_max_leased(max_leased),
+    m_cam_fbs(ringbuf_len, max_leased)
 {
     // Ensure at least one element in ringbuf.
     assert(ringbuf_len >= 1);
 }
 
-WhoFrameCapNode::~WhoFrameCapNode()
-{
-    vSemaphoreDelete(m_mutex);
-}
-
 bool WhoFrameCapNode::pause_async()
 {
     if (task::WhoTask::pause_async()) {
@@ -50,29 +54,94 @@ bool WhoFrameCapNode::stop_async()
     return false;
 }
 
-cam_fb_t *WhoFrameCapNode::cam_fb_peek(int index)
+void WhoFrameCapNode::log_invalid_index(int index)
 {
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
-    if (m_cam_fbs.empty()) {
+    int size = m_cam_fbs.size();
+    if (size == 0) {
         ESP_LOGW(TAG, "%s: Unable to peek from an empty frame buffer.", get_name().c_str());
-        xSemaphoreGive(m_mutex);
+    } else {
+        ESP_LOGW(TAG, "%s: Invalid index %d, valid index should be [-1, %d].", get_name().c_str(), index, size - 1);
+    }
+}
+
+cam_fb_t *WhoFrameCapNode::cam_fb_peek(int index)
+{
+    cam_fb_t *ret = m_cam_fbs.peek(index);
+    if (!ret) {
+        log_invalid_index(index);
+    }
+    return ret;
+}
+
+cam_fb_t *WhoFrameCapNode::cam_fb_lease(int index)
+{
+    cam_fb_t *ret = m_cam_fbs.acquire(index);
+    if (!ret) {
+        log_invalid_index(index);
+    }
+    return ret;
+}
+
+cam_fb_t *WhoFrameCapNode::cam_fb_retain(cam_fb_t *fb)
+{
+    if (!fb || !m_cam_fbs.retain(fb)) {
+        ESP_LOGW(TAG, "%s: Retain a frame which is not leased.", get_name().c_str());
         return nullptr;
     }
-    if (index == -1) {
-        index = m_cam_fbs.size() - 1;
+    return fb;
+}
+
+void WhoFrameCapNode::cam_fb_release(cam_fb_t *fb)
+{
+    if (!fb) {
+        return;
+    }
+    // The frame is recycled by the node task before it processes the next frame once nobody holds it.
+    if (!m_cam_fbs.release(fb)) {
+        ESP_LOGW(TAG, "%s: Release a frame which is not leased.", get_name().c_str());
     }
-    if (index < 0 || index > m_cam_fbs.size() - 1) {
+}
+
+bool WhoFrameCapNode::update_ringbuf(cam_fb_t *fb)
+{
+    if (!m_cam_fbs.push(fb, [this](cam_fb_t *old_fb) { recycle_fb(old_fb); })) {
+        ESP_LOGW(TAG, "%s: Too many leased frames, drop the new frame.", get_name().c_str());
+        m_stats.frame_dropped();
+        recycle_fb(fb);
+        return false;
+    }
+    return true;
+}
+
+void WhoFrameCapNode::reclaim_ringbuf()
+{
+    m_cam_fbs.reclaim([this](cam_fb_t *fb) { recycle_fb(fb); });
+}
+
+void WhoFrameCapNode::clear_ringbuf()
+{
+    m_cam_fbs.clear([this](cam_fb_t *fb) { recycle_fb(fb); });
+}
+
+bool WhoFrameCapNode::is_buf_in_use(void *buf)
+{
+    return m_cam_fbs.any_of([buf](cam_fb_t *fb) { return fb->buf == buf; });
+}
+
+void WhoFrameCapNode::add_out_edge(WhoFrameCapNode *node, QueueHandle_t queue, bool overwrite)
+{
+    m_out_edges.push_back({node, queue, overwrite});
+    int leases = 0;
+    for (const auto &edge : m_out_edges) {
+        leases += uxQueueMessagesWaiting(edge.queue) + uxQueueSpacesAvailable(edge.queue) + 1;
+    }
+    if (leases > m_max_leased) {
         ESP_LOGW(TAG,
-                 "%s: Invalid index %d, valid index should be [-1, %d].",
+                 "%s: The next nodes may lease %d frames, more than max_leased %d, frames will be dropped.",
                  get_name().c_str(),
-                 index,
-                 m_cam_fbs.size() - 1);
-        xSemaphoreGive(m_mutex);
-        return nullptr;
+                 leases,
+                 m_max_leased);
     }
-    cam_fb_t *ret = m_cam_fbs[index];
-    xSemaphoreGive(m_mutex);
-    return ret;
 }
 
 void WhoFrameCapNode::add_new_frame_signal_subscriber(task::WhoTask *task)
@@ -90,10 +159,60 @@ WhoFrameCapNode *WhoFrameCapNode::get_prev_node()
 
 WhoFrameCapNode *WhoFrameCapNode::get_next_node()
 {
-    if (!m_next_node) {
+    if (m_out_edges.empty()) {
         ESP_LOGE(TAG, "No next node.");
+        return nullptr;
+    }
+    return m_out_edges.front().node;
+}
+
+std::vector<WhoFrameCapNode *> WhoFrameCapNode::get_next_nodes()
+{
+    std::vector<WhoFrameCapNode *> nodes;
+    for (const auto &edge : m_out_edges) {
+        nodes.push_back(edge.node);
+    }
+    return nodes;
+}
+
+void WhoFrameCapNode::send_out_fb(cam_fb_t *fb)
+{
+    for (const auto &edge : m_out_edges) {
+        // Every queued frame holds a lease until the next node has processed it, it may leave the ringbuf meanwhile.
+        m_cam_fbs.retain(fb);
+        if (!edge.overwrite) {
+            xQueueSend(edge.queue, &fb, portMAX_DELAY);
+            continue;
+        }
+        // The next node has not taken the oldest frame yet, it is skipped. The next node may take it meanwhile, then
+        // the send below finds room anyway.
+        if (uxQueueSpacesAvailable(edge.queue) == 0) {
+            cam_fb_t *old_fb;
+            if (xQueueReceive(edge.queue, &old_fb, 0) == pdTRUE) {
+                cam_fb_release(old_fb);
+                m_stats.frame_dropped();
+            }
+        }
+        // A pause or stop wake up may have taken the room.
+        if (xQueueSend(edge.queue, &fb, 0) != pdTRUE) {
+            cam_fb_release(fb);
+        }
+    }
+}
+
+void WhoFrameCapNode::release_in_fb(cam_fb_t *fb)
+{
+    if (fb && m_prev_node) {
+        m_prev_node->cam_fb_release(fb);
+    }
+}
+
+void WhoFrameCapNode::drain_in_queue()
+{
+    cam_fb_t *fb;
+    while (m_in_queue && xQueueReceive(m_in_queue, &fb, 0) == pdTRUE) {
+        release_in_fb(fb);
     }
-    return m_next_node;
 }
 
 void WhoFrameCapNode::task()
@@ -104,6 +223,9 @@ void WhoFrameCapNode::task()
             xQueueReceive(m_in_queue, &in_fb, portMAX_DELAY);
         }
         EventBits_t event_bits = xEventGroupWaitBits(m_event_group, TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, 0);
+        if (event_bits & (TASK_PAUSE | TASK_STOP)) {
+            release_in_fb(in_fb);
+        }
         if (event_bits & TASK_STOP) {
             break;
         } else if (event_bits & TASK_PAUSE) {
@@ -116,23 +238,35 @@ void WhoFrameCapNode::task()
                 continue;
             }
         }
+        // The wake up of a pause or stop, queued behind frames of a longer queue.
+        if (m_in_queue && !in_fb) {
+            continue;
+        }
+        m_stats.frame_in();
+        int64_t start = stats::WhoStats::now_us();
+        if (in_fb) {
+            m_stats.observe_queue_wait(start - (in_fb->timestamp.tv_sec * 1000000LL + in_fb->timestamp.tv_usec));
+        }
+        // Give back the frames released since the last push, process() may need them and the ringbuf is only
+        // updated once it succeeds.
+        reclaim_ringbuf();
         cam_fb_t *out_fb = process(in_fb);
+        release_in_fb(in_fb);
+        m_stats.observe_process_time(stats::WhoStats::now_us() - start);
         // Drop the fb which failed to process.
         if (!out_fb) {
+            // A lease may have been released while process() waited for a frame.
+            reclaim_ringbuf();
+            m_stats.frame_dropped();
             continue;
         }
-        if (m_out_queue) {
-            if (m_out_queue_overwrite) {
-                xQueueOverwrite(m_out_queue, &out_fb);
-            } else {
-                xQueueSend(m_out_queue, &out_fb, portMAX_DELAY);
-            }
+        // The ringbuf owns the frame from here, a frame it refuses is recycled and must not reach the next nodes.
+        if (!update_ringbuf(out_fb)) {
+            continue;
         }
-        xSemaphoreTake(m_mutex, portMAX_DELAY);
-        update_ringbuf(out_fb);
-        bool full_ringbuf = m_cam_fbs.full();
-        xSemaphoreGive(m_mutex);
-        if (full_ringbuf) {
+        m_stats.frame_out();
+        send_out_fb(out_fb);
+        if (m_cam_fbs.full()) {
             for (const auto &task : m_tasks) {
                 if (task->is_active()) {
                     xEventGroupSetBits(task->get_event_group(), NEW_FRAME);
@@ -144,6 +278,17 @@ void WhoFrameCapNode::task()
     vTaskDelete(NULL);
 }
 
+WhoFetchNode::WhoFetchNode(const std::string &name,
+                           WhoCam *cam,
+                           uint8_t ringbuf_len,
+                           uint8_t max_leased,
+                           bool out_queue_overwrite) :
+    WhoFrameCapNode(name, ringbuf_len, max_leased, out_queue_overwrite), m_cam(cam)
+{
+    // A full ringbuf would hold every fb and the driver would wait forever.
+    assert(cam->get_fb_count() > ringbuf_len);
+}
+
 WhoFetchNode::~WhoFetchNode()
 {
     delete m_cam;
@@ -151,12 +296,7 @@ WhoFetchNode::~WhoFetchNode()
 
 void WhoFetchNode::cleanup()
 {
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
-    while (!m_cam_fbs.empty()) {
-        auto fb = m_cam_fbs.pop();
-        m_cam->cam_fb_return(fb);
-    }
-    xSemaphoreGive(m_mutex);
+    clear_ringbuf();
 }
 
 cam_fb_t *WhoFetchNode::process(who::cam::cam_fb_t *fb)
@@ -164,28 +304,41 @@ cam_fb_t *WhoFetchNode::process(who::cam::cam_fb_t *fb)
     return m_cam->cam_fb_get();
 }
 
-void WhoFetchNode::update_ringbuf(who::cam::cam_fb_t *fb)
+void WhoFetchNode::recycle_fb(who::cam::cam_fb_t *fb)
+{
+    m_cam->cam_fb_return(fb);
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+WhoDecodeNode::WhoDecodeNode(const std::string &name,
+                             dl::image::pix_type_t pix_type,
+                             uint8_t ringbuf_len,
+                             uint8_t max_leased,
+                             bool out_queue_overwrite,
+                             uint8_t scale_shift) :
+    WhoFrameCapNode(name, ringbuf_len, max_leased, out_queue_overwrite),
+    m_pix_type(pix_type),
+    m_scale_shift(0),
+    m_pool(nullptr)
 {
-    if (m_cam_fbs.full()) {
-        auto fb_prev = m_cam_fbs.pop();
-        m_cam->cam_fb_return(fb_prev);
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+    if (scale_shift) {
+        ESP_LOGW(TAG, "The JPEG codec decodes at full size only, add a resize node instead.");
     }
-    m_cam_fbs.push(fb);
+#else
+    m_scale_shift = std::min<uint8_t>(scale_shift, 3);
+#endif
+}
+
+WhoDecodeNode::~WhoDecodeNode()
+{
+    who_buf_pool_delete(m_pool);
 }
 
 void WhoDecodeNode::cleanup()
 {
-    while (uxQueueMessagesWaiting(m_in_queue) > 0) {
-        cam_fb_t *tmp;
-        xQueueReceive(m_in_queue, &tmp, 0);
-    }
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
-    while (!m_cam_fbs.empty()) {
-        auto fb = m_cam_fbs.pop();
-        heap_caps_free(fb->buf);
-        delete fb;
-    }
-    xSemaphoreGive(m_mutex);
+    drain_in_queue();
+    clear_ringbuf();
 }
 
 cam_fb_t *WhoDecodeNode::process(who::cam::cam_fb_t *fb)
@@ -199,7 +352,7 @@ cam_fb_t *WhoDecodeNode::process(who::cam::cam_fb_t *fb)
 #if CONFIG_SOC_JPEG_CODEC_SUPPORTED
     auto img = hw_decode_jpeg({fb->buf, fb->len}, m_pix_type, caps);
 #else
-    auto img = sw_decode_jpeg({fb->buf, fb->len}, m_pix_type, caps);
+    auto img = sw_decode_jpeg_to_pool(fb, caps);
 #endif
     // Sometimes may fail to decode a corrupted frame.
     if (!img.data) {
@@ -208,27 +361,136 @@ cam_fb_t *WhoDecodeNode::process(who::cam::cam_fb_t *fb)
     return new cam_fb_t(img, timestamp);
 }
 
-void WhoDecodeNode::update_ringbuf(who::cam::cam_fb_t *fb)
+void WhoDecodeNode::recycle_fb(who::cam::cam_fb_t *fb)
 {
-    if (m_cam_fbs.full()) {
-        auto fb_prev = m_cam_fbs.pop();
-        heap_caps_free(fb_prev->buf);
-        delete fb_prev;
+    if (who_buf_pool_owns(m_pool, fb->buf)) {
+        who_buf_pool_free(m_pool, fb->buf);
+    } else {
+        heap_caps_free(fb->buf);
     }
-    m_cam_fbs.push(fb);
+    delete fb;
 }
 
+#if !CONFIG_SOC_JPEG_CODEC_SUPPORTED
+dl::image::img_t WhoDecodeNode::sw_decode_jpeg_to_pool(who::cam::cam_fb_t *fb, uint32_t caps)
+{
+    dl::image::img_t img = {.data = nullptr,
+                            .width = (uint16_t)(fb->width >> m_scale_shift),
+                            .height = (uint16_t)(fb->height >> m_scale_shift),
+                            .pix_type = m_pix_type};
+    if (!m_pool) {
+        // The frame being decoded comes on top of the ringbuf and the leased frames, which may have left it.
+        who_buf_pool_config_t config = {};
+        config.name = "decode";
+        config.slot_size = dl::image::get_img_byte_size(img);
+        config.slot_count = m_cam_fbs.capacity() + m_max_leased + 1;
+        config.caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+        config.align = 16;
+        if (who_buf_pool_create(&config, &m_pool) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create decode pool.");
+            return img;
+        }
+    }
+    size_t slot_size = who_buf_pool_get_slot_size(m_pool);
+    void *buf = who_buf_pool_alloc(m_pool, slot_size, 0);
+    if (!buf) {
+        // Every slot is still held, drop the frame.
+        return img;
+    }
+    esp_jpeg_image_cfg_t jpeg_cfg = {};
+    jpeg_cfg.indata = (uint8_t *)fb->buf;
+    jpeg_cfg.indata_size = fb->len;
+    jpeg_cfg.outbuf = (uint8_t *)buf;
+    jpeg_cfg.outbuf_size = slot_size;
+    jpeg_cfg.out_format =
+        (m_pix_type == dl::image::DL_IMAGE_PIX_TYPE_RGB565) ? JPEG_IMAGE_FORMAT_RGB565 : JPEG_IMAGE_FORMAT_RGB888;
+    jpeg_cfg.out_scale = (esp_jpeg_image_scale_t)m_scale_shift;
+    jpeg_cfg.flags.swap_color_bytes = (caps & dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN) ? 1 : 0;
+    esp_jpeg_image_output_t out_img;
+    if (esp_jpeg_decode(&jpeg_cfg, &out_img) != ESP_OK || out_img.width != img.width ||
+        out_img.height != img.height) {
+        who_buf_pool_free(m_pool, buf);
+        return img;
+    }
+    img.data = buf;
+    return img;
+}
+#endif
+
+WhoResizeNode::WhoResizeNode(const std::string &name,
+                             uint16_t dst_w,
+                             uint16_t dst_h,
+                             dl::image::pix_type_t dst_pix_type,
+                             uint8_t ringbuf_len,
+                             uint8_t max_leased,
+                             bool out_queue_overwrite) :
+    WhoFrameCapNode(name, ringbuf_len, max_leased, out_queue_overwrite),
+    m_dst_w(dst_w),
+    m_dst_h(dst_h),
+    m_dst_pix_type(dst_pix_type),
+    m_pool(nullptr)
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    m_image_transformer.set_caps(dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN);
+#endif
+    dl::image::img_t img = {.data = nullptr, .width = dst_w, .height = dst_h, .pix_type = dst_pix_type};
+    // Every frame in the ringbuf, the one being resized and one for every lease, each may outlive the ringbuf.
+    who_buf_pool_config_t config = {};
+    config.name = "resize";
+    config.slot_size = dl::image::get_img_byte_size(img);
+    config.slot_count = ringbuf_len + 1 + max_leased;
+    config.caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    config.align = 16;
+    ESP_ERROR_CHECK(who_buf_pool_create(&config, &m_pool));
+}
+
+WhoResizeNode::~WhoResizeNode()
+{
+    who_buf_pool_delete(m_pool);
+}
+
+void WhoResizeNode::cleanup()
+{
+    drain_in_queue();
+    clear_ringbuf();
+}
+
+cam_fb_t *WhoResizeNode::process(who::cam::cam_fb_t *fb)
+{
+    auto timestamp = fb->timestamp;
+    void *buf = who_buf_pool_alloc(m_pool, who_buf_pool_get_slot_size(m_pool), 0);
+    if (!buf) {
+        // Every buffer is still held, drop the frame.
+        return nullptr;
+    }
+    dl::image::img_t dst_img = {.data = buf, .width = m_dst_w, .height = m_dst_h, .pix_type = m_dst_pix_type};
+    if (m_image_transformer.set_src_img(*fb).set_dst_img(dst_img).transform() != ESP_OK) {
+        who_buf_pool_free(m_pool, buf);
+        return nullptr;
+    }
+    return new cam_fb_t(dst_img, timestamp);
+}
+
+void WhoResizeNode::recycle_fb(who::cam::cam_fb_t *fb)
+{
+    who_buf_pool_free(m_pool, fb->buf);
+    delete fb;
+}
+#endif
+
 #if CONFIG_SOC_PPA_SUPPORTED
 WhoPPAResizeNode::WhoPPAResizeNode(const std::string &name,
                                    uint16_t dst_w,
                                    uint16_t dst_h,
                                    dl::image::pix_type_t dst_pix_type,
                                    uint8_t ringbuf_len,
+                                   uint8_t max_leased,
                                    bool out_queue_overwrite) :
-    WhoFrameCapNode(name, ringbuf_len, out_queue_overwrite),
+    WhoFrameCapNode(name, ringbuf_len, max_leased, out_queue_overwrite),
     m_dst_w(dst_w),
     m_dst_h(dst_h),
-    m_dst_imgs(ringbuf_len + 1),
+    // The PPA writes into an image which is neither in the ringbuf nor leased, so it needs one more than those.
+    m_dst_imgs(ringbuf_len + max_leased + 1),
     m_img_idx(0)
 {
     ppa_client_config_t ppa_client_config = {};
@@ -257,40 +519,37 @@ WhoPPAResizeNode::~WhoPPAResizeNode()
 
 void WhoPPAResizeNode::cleanup()
 {
-    while (uxQueueMessagesWaiting(m_in_queue) > 0) {
-        cam_fb_t *tmp;
-        xQueueReceive(m_in_queue, &tmp, 0);
-    }
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
-    while (!m_cam_fbs.empty()) {
-        auto fb = m_cam_fbs.pop();
-        delete fb;
-    }
-    xSemaphoreGive(m_mutex);
+    drain_in_queue();
+    clear_ringbuf();
 }
 
 cam_fb_t *WhoPPAResizeNode::process(who::cam::cam_fb_t *fb)
 {
     auto timestamp = fb->timestamp;
     auto dst_img = get_dst_img();
+    if (!dst_img.data) {
+        return nullptr;
+    }
     dl::image::resize_ppa(*fb, dst_img, m_ppa_srm_handle);
     return new cam_fb_t(dst_img, timestamp);
 }
 
-void WhoPPAResizeNode::update_ringbuf(who::cam::cam_fb_t *fb)
+void WhoPPAResizeNode::recycle_fb(who::cam::cam_fb_t *fb)
 {
-    if (m_cam_fbs.full()) {
-        auto fb_prev = m_cam_fbs.pop();
-        delete fb_prev;
-    }
-    m_cam_fbs.push(fb);
+    delete fb;
 }
 
 dl::image::img_t WhoPPAResizeNode::get_dst_img()
 {
-    auto &img = m_dst_imgs[m_img_idx];
-    m_img_idx = (m_img_idx + 1) % m_dst_imgs.size();
-    return img;
+    // Skip the buffers still in the ringbuf or leased by a consumer.
+    for (int i = 0; i < m_dst_imgs.size(); i++) {
+        auto &img = m_dst_imgs[m_img_idx];
+        m_img_idx = (m_img_idx + 1) % m_dst_imgs.size();
+        if (!is_buf_in_use(img.data)) {
+            return img;
+        }
+    }
+    return {};
 }
 #endif
 } // namespace frame_cap
@@ -1,7 +1,10 @@
 #pragma once
 #include "who_cam_base.hpp"
-#include "who_ringbuf.hpp"
+#include "who_seq_ring.hpp"
 #include "who_task.hpp"
+#include "who_stats.hpp"
+#include "who_buf_pool.h"
+#include <vector>
 
 namespace who {
 namespace frame_cap {
@@ -9,44 +12,83 @@ class WhoFrameCapNode : public task::WhoTask {
 public:
     static inline constexpr EventBits_t NEW_FRAME = TASK_EVENT_BIT_LAST;
 
-    WhoFrameCapNode(const std::string &name, uint8_t ringbuf_len, bool out_queue_overwrite = true);
-    ~WhoFrameCapNode();
+    // max_leased is how many frames can be leased at the same time on top of the ringbuf, by the consumers outside the
+    // pipeline and the next nodes. A node which allocates its frames needs a buffer for each of them.
+    WhoFrameCapNode(const std::string &name, uint8_t ringbuf_len, uint8_t max_leased, bool out_queue_overwrite = true);
     bool stop_async() override;
     bool pause_async() override;
     void set_in_queue(QueueHandle_t in_queue) { m_in_queue = in_queue; }
-    void set_out_queue(QueueHandle_t out_queue) { m_out_queue = out_queue; }
     void set_prev_node(WhoFrameCapNode *node) { m_prev_node = node; }
-    void set_next_node(WhoFrameCapNode *node) { m_next_node = node; }
+    // Feed every new frame to node through queue as well. With overwrite the oldest queued frame is dropped when the
+    // queue is full, otherwise this node waits until the next node takes a frame. The next node leases every frame
+    // queued to it and the one it processes, so an edge takes the queue length plus one of max_leased.
+    void add_out_edge(WhoFrameCapNode *node, QueueHandle_t queue, bool overwrite);
     who::cam::cam_fb_t *cam_fb_peek(int index = -1);
+    // Borrow a frame for a consumer outside the pipeline, e.g. a http handler. The frame is not recycled until it is
+    // given back with cam_fb_release(), even if it has already been popped from the ringbuf.
+    // Neither peek nor lease takes a lock, so readers on the other core never stall the pipeline.
+    who::cam::cam_fb_t *cam_fb_lease(int index = -1);
+    // Lease a frame once more which is already leased, so it can be handed to another task which releases it on its
+    // own. Returns nullptr if fb is not leased.
+    who::cam::cam_fb_t *cam_fb_retain(who::cam::cam_fb_t *fb);
+    void cam_fb_release(who::cam::cam_fb_t *fb);
     void add_new_frame_signal_subscriber(task::WhoTask *task);
     WhoFrameCapNode *get_prev_node();
+    // The first node fed by this one.
     WhoFrameCapNode *get_next_node();
+    std::vector<WhoFrameCapNode *> get_next_nodes();
+    // Overwrite policy of the queue to a node appended with WhoFrameCap::add_node().
+    bool get_out_queue_overwrite() { return m_out_queue_overwrite; }
+    uint8_t get_ringbuf_len() { return m_cam_fbs.capacity(); }
+    uint8_t get_max_leased() { return m_max_leased; }
     virtual uint16_t get_fb_width() = 0;
     virtual uint16_t get_fb_height() = 0;
     virtual std::string get_type() = 0;
+    stats::WhoStats &get_stats() { return m_stats; }
 
 private:
     void task() override;
     virtual who::cam::cam_fb_t *process(who::cam::cam_fb_t *fb) = 0;
-    virtual void update_ringbuf(who::cam::cam_fb_t *fb) = 0;
+    // Give the fb back to where it comes from. Only called from the node task, or from cleanup when it is stopped.
+    virtual void recycle_fb(who::cam::cam_fb_t *fb) = 0;
+    bool update_ringbuf(who::cam::cam_fb_t *fb);
+    void log_invalid_index(int index);
+    void send_out_fb(who::cam::cam_fb_t *fb);
+    // Give back the lease on a frame of the previous node which was queued to this one.
+    void release_in_fb(who::cam::cam_fb_t *fb);
+
+    typedef struct {
+        WhoFrameCapNode *node;
+        QueueHandle_t queue;
+        bool overwrite;
+    } out_edge_t;
+
     bool m_out_queue_overwrite;
-    QueueHandle_t m_out_queue;
+    std::vector<out_edge_t> m_out_edges;
     WhoFrameCapNode *m_prev_node;
-    WhoFrameCapNode *m_next_node;
     std::vector<task::WhoTask *> m_tasks;
+    stats::WhoStats m_stats;
 
 protected:
+    void reclaim_ringbuf();
+    void clear_ringbuf();
+    // Drop the frames still queued to this node, on cleanup.
+    void drain_in_queue();
+    bool is_buf_in_use(void *buf);
     QueueHandle_t m_in_queue;
-    RingBuf<who::cam::cam_fb_t *> m_cam_fbs;
-    SemaphoreHandle_t m_mutex;
+    const uint8_t m_max_leased;
+    SeqRing<who::cam::cam_fb_t *> m_cam_fbs;
 };
 
 class WhoFetchNode : public WhoFrameCapNode {
 public:
-    WhoFetchNode(const std::string &name, who::cam::WhoCam *cam, bool out_queue_overwrite = true) :
-        WhoFrameCapNode(name, cam->get_fb_count() - 2, out_queue_overwrite), m_cam(cam)
-    {
-    }
+    // The cam needs at least ringbuf_len + 1 fbs, so the driver has one to fill while the ringbuf is full, plus one for
+    // every frame which is still leased after it left the ringbuf.
+    WhoFetchNode(const std::string &name,
+                 who::cam::WhoCam *cam,
+                 uint8_t ringbuf_len,
+                 uint8_t max_leased,
+                 bool out_queue_overwrite = true);
     ~WhoFetchNode();
     uint16_t get_fb_width() override { return m_cam->get_fb_width(); }
     uint16_t get_fb_height() override { return m_cam->get_fb_height(); }
@@ -55,30 +97,70 @@ public:
 private:
     void cleanup() override;
     who::cam::cam_fb_t *process(who::cam::cam_fb_t *fb) override;
-    void update_ringbuf(who::cam::cam_fb_t *fb) override;
+    void recycle_fb(who::cam::cam_fb_t *fb) override;
     who::cam::WhoCam *m_cam;
 };
 
+// Decoding needs esp-dl, which is not available on the linux target.
+#if !CONFIG_IDF_TARGET_LINUX
 class WhoDecodeNode : public WhoFrameCapNode {
 public:
+    // scale_shift decodes at 1 / (1 << scale_shift) of the JPEG size, 0..3. Scaling is done by the software decoder
+    // while it decodes, so a big JPEG costs little more than a small one. The JPEG codec only decodes at full size,
+    // there the shift is ignored and a resize node has to follow.
     WhoDecodeNode(const std::string &name,
                   dl::image::pix_type_t pix_type,
                   uint8_t ringbuf_len,
-                  bool out_queue_overwrite = true) :
-        WhoFrameCapNode(name, ringbuf_len, out_queue_overwrite), m_pix_type(pix_type)
-    {
-    }
-    uint16_t get_fb_width() override { return get_prev_node()->get_fb_width(); }
-    uint16_t get_fb_height() override { return get_prev_node()->get_fb_height(); }
+                  uint8_t max_leased,
+                  bool out_queue_overwrite = true,
+                  uint8_t scale_shift = 0);
+    ~WhoDecodeNode();
+    uint16_t get_fb_width() override { return get_prev_node()->get_fb_width() >> m_scale_shift; }
+    uint16_t get_fb_height() override { return get_prev_node()->get_fb_height() >> m_scale_shift; }
     std::string get_type() override { return "DecodeNode"; }
 
 private:
     void cleanup() override;
     who::cam::cam_fb_t *process(who::cam::cam_fb_t *fb) override;
-    void update_ringbuf(who::cam::cam_fb_t *fb) override;
+    void recycle_fb(who::cam::cam_fb_t *fb) override;
+#if !CONFIG_SOC_JPEG_CODEC_SUPPORTED
+    dl::image::img_t sw_decode_jpeg_to_pool(who::cam::cam_fb_t *fb, uint32_t caps);
+#endif
     dl::image::pix_type_t m_pix_type;
+    uint8_t m_scale_shift;
+    // Decoded frames, created on the first frame when the frame size is known.
+    who_buf_pool_handle_t m_pool;
 };
 
+// Resize and pixel format convert in software with the esp-dl ImageTransformer, which has SIMD kernels on the
+// ESP32-S3. Lets the camera capture bigger frames than detection needs on targets without the PPA.
+class WhoResizeNode : public WhoFrameCapNode {
+public:
+    WhoResizeNode(const std::string &name,
+                  uint16_t dst_w,
+                  uint16_t dst_h,
+                  dl::image::pix_type_t dst_pix_type,
+                  uint8_t ringbuf_len,
+                  uint8_t max_leased,
+                  bool out_queue_overwrite = true);
+    ~WhoResizeNode();
+    uint16_t get_fb_width() override { return m_dst_w; }
+    uint16_t get_fb_height() override { return m_dst_h; }
+    std::string get_type() override { return "ResizeNode"; }
+
+private:
+    void cleanup() override;
+    who::cam::cam_fb_t *process(who::cam::cam_fb_t *fb) override;
+    void recycle_fb(who::cam::cam_fb_t *fb) override;
+
+    uint16_t m_dst_w;
+    uint16_t m_dst_h;
+    dl::image::pix_type_t m_dst_pix_type;
+    dl::image::ImageTransformer m_image_transformer;
+    who_buf_pool_handle_t m_pool;
+};
+#endif
+
 #if CONFIG_SOC_PPA_SUPPORTED
 class WhoPPAResizeNode : public WhoFrameCapNode {
 public:
@@ -87,6 +169,7 @@ public:
                      uint16_t dst_h,
                      dl::image::pix_type_t dst_pix_type,
                      uint8_t ringbuf_len,
+                     uint8_t max_leased,
                      bool out_queue_overwrite = true);
     ~WhoPPAResizeNode();
     uint16_t get_fb_width() override { return m_dst_w; }
@@ -96,7 +179,7 @@ public:
 private:
     void cleanup() override;
     who::cam::cam_fb_t *process(who::cam::cam_fb_t *fb) override;
-    void update_ringbuf(who::cam::cam_fb_t *fb) override;
+    void recycle_fb(who::cam::cam_fb_t *fb) override;
     dl::image::img_t get_dst_img();
 
     uint16_t m_dst_w;
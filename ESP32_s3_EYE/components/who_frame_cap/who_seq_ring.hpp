@@ -0,0 +1,254 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace who {
+namespace frame_cap {
+// Ring of the latest frames, written by one producer task and read by any number of tasks without a lock.
+//
+// Values live in a fixed pool of entries with an atomic refcount. The ring holds one ref of every entry it
+// contains and every lease holds one more. A ring slot stores the entry index and the sequence number of the value,
+// so a reader can tell if the slot was overwritten while it was reading and simply retries. The producer always
+// removes a slot from the visible range before overwriting it, so a reader never has to wait for the producer.
+//
+// Only the producer gives values back (reclaim), a reader dropping the last ref just leaves the entry for the next
+// reclaim. So the recycle callback never runs concurrently with the producer. push() and clear() reclaim, a producer
+// which has nothing to push until released values come back has to call reclaim() itself.
+template <typename T>
+class SeqRing {
+public:
+    // max_leased values can be leased after they left the ring, while it is full.
+    SeqRing(int capacity, int max_leased) :
+        m_capacity(capacity),
+        // One more for the value being pushed into a full ring.
+        m_num_entries(capacity + max_leased + 1),
+        // The sequence number wraps at a multiple of capacity, so seq % capacity stays continuous.
+        m_seq_mod((SEQ_MASK + 1) / capacity * capacity),
+        m_slots(new slot_t[capacity]),
+        m_entries(new entry_t[capacity + max_leased + 1]),
+        m_state(0)
+    {
+        for (int i = 0; i < m_capacity; i++) {
+            m_slots[i].seq.store(INVALID_SEQ);
+            m_slots[i].entry.store(0);
+        }
+        for (int i = 0; i < m_num_entries; i++) {
+            m_entries[i].val.store(T{});
+            m_entries[i].refs.store(0);
+        }
+    }
+
+    int capacity() const { return m_capacity; }
+
+    int size() const { return get_count(m_state.load()); }
+
+    bool empty() const { return size() == 0; }
+
+    bool full() const { return size() == m_capacity; }
+
+    // Readers. Index 0 is the oldest value, -1 the newest. Return T{} if the index is out of range.
+
+    // The value is not pinned, it may be given back by the producer as soon as this returns.
+    T peek(int index) const
+    {
+        while (true) {
+            uint32_t seq;
+            const slot_t *slot = locate(index, seq);
+            if (!slot) {
+                return T{};
+            }
+            int entry = slot->entry.load();
+            T val = m_entries[entry].val.load();
+            if (slot->seq.load() == seq) {
+                return val;
+            }
+        }
+    }
+
+    // Pin the value until release() is called.
+    T acquire(int index)
+    {
+        while (true) {
+            uint32_t seq;
+            const slot_t *slot = locate(index, seq);
+            if (!slot) {
+                return T{};
+            }
+            entry_t &entry = m_entries[slot->entry.load()];
+            // Only take a ref while someone else still holds one, a zero refcount entry is waiting to be reclaimed.
+            int refs = entry.refs.load();
+            while (refs > 0 && !entry.refs.compare_exchange_weak(refs, refs + 1)) {
+            }
+            if (refs == 0) {
+                continue;
+            }
+            // The slot still holds the same value, so the entry was not reused before we took the ref.
+            if (slot->seq.load() == seq) {
+                return entry.val.load();
+            }
+            entry.refs.fetch_sub(1);
+        }
+    }
+
+    // Take one more ref of a value the caller already pinned, e.g. to hand a lease over to another task.
+    bool retain(T val)
+    {
+        for (int i = 0; i < m_num_entries; i++) {
+            entry_t &entry = m_entries[i];
+            // The caller's ref keeps the entry from being reclaimed meanwhile.
+            if (entry.val.load() == val && entry.refs.load() > 0) {
+                entry.refs.fetch_add(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool release(T val)
+    {
+        for (int i = 0; i < m_num_entries; i++) {
+            entry_t &entry = m_entries[i];
+            if (entry.val.load() == val && entry.refs.load() > 0) {
+                entry.refs.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Producer.
+
+    // Push a value, dropping the oldest one if full. Returns false if every entry is still leased, the caller keeps
+    // the value then.
+    template <typename F>
+    bool push(T val, F recycle)
+    {
+        int entry = get_free_entry();
+        if (entry < 0) {
+            reclaim(recycle);
+            entry = get_free_entry();
+            if (entry < 0) {
+                return false;
+            }
+        }
+        m_entries[entry].val.store(val);
+        m_entries[entry].refs.store(1);
+
+        uint32_t state = m_state.load();
+        uint32_t tail = get_tail(state);
+        int count = get_count(state);
+        // The oldest value and the new one share the same slot.
+        slot_t &slot = m_slots[tail % m_capacity];
+        bool drop_oldest = count == m_capacity;
+        if (drop_oldest) {
+            count--;
+            m_state.store(make_state(tail, count));
+        }
+        slot.seq.store(INVALID_SEQ);
+        if (drop_oldest) {
+            m_entries[slot.entry.load()].refs.fetch_sub(1);
+        }
+        slot.entry.store(entry);
+        slot.seq.store(tail);
+        m_state.store(make_state((tail + 1) % m_seq_mod, count + 1));
+        reclaim(recycle);
+        return true;
+    }
+
+    // Drop every value in the ring. Leased values are given back on the next push(), clear() or reclaim().
+    template <typename F>
+    void clear(F recycle)
+    {
+        uint32_t state = m_state.load();
+        uint32_t tail = get_tail(state);
+        int count = get_count(state);
+        m_state.store(make_state(tail, 0));
+        for (int i = 0; i < count; i++) {
+            slot_t &slot = m_slots[(tail + m_seq_mod - count + i) % m_seq_mod % m_capacity];
+            slot.seq.store(INVALID_SEQ);
+            m_entries[slot.entry.load()].refs.fetch_sub(1);
+        }
+        reclaim(recycle);
+    }
+
+    // Give back every value which is neither in the ring nor leased any more. Producer only.
+    template <typename F>
+    void reclaim(F recycle)
+    {
+        for (int i = 0; i < m_num_entries; i++) {
+            entry_t &entry = m_entries[i];
+            T val = entry.val.load();
+            if (val != T{} && entry.refs.load() == 0) {
+                entry.val.store(T{});
+                recycle(val);
+            }
+        }
+    }
+
+    // Check every value which is not given back yet, in the ring or leased. Producer only.
+    template <typename F>
+    bool any_of(F pred) const
+    {
+        for (int i = 0; i < m_num_entries; i++) {
+            T val = m_entries[i].val.load();
+            if (val != T{} && pred(val)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    typedef struct {
+        std::atomic<uint32_t> seq;
+        std::atomic<int> entry;
+    } slot_t;
+
+    typedef struct {
+        std::atomic<T> val;
+        std::atomic<int> refs;
+    } entry_t;
+
+    // State packs the sequence number of the next value and the number of values, so readers get both in one load.
+    static constexpr uint32_t SEQ_BITS = 24;
+    static constexpr uint32_t SEQ_MASK = (1u << SEQ_BITS) - 1;
+    static constexpr uint32_t INVALID_SEQ = UINT32_MAX;
+
+    static uint32_t make_state(uint32_t tail, int count) { return (tail << 8) | (uint32_t)count; }
+    static uint32_t get_tail(uint32_t state) { return state >> 8; }
+    static int get_count(uint32_t state) { return state & 0xff; }
+
+    const slot_t *locate(int index, uint32_t &seq) const
+    {
+        uint32_t state = m_state.load();
+        int count = get_count(state);
+        if (index == -1) {
+            index = count - 1;
+        }
+        if (index < 0 || index >= count) {
+            return nullptr;
+        }
+        seq = (get_tail(state) + m_seq_mod - count + index) % m_seq_mod;
+        return &m_slots[seq % m_capacity];
+    }
+
+    int get_free_entry() const
+    {
+        for (int i = 0; i < m_num_entries; i++) {
+            if (m_entries[i].val.load() == T{} && m_entries[i].refs.load() == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    const int m_capacity;
+    const int m_num_entries;
+    const uint32_t m_seq_mod;
+    std::unique_ptr<slot_t[]> m_slots;
+    std::unique_ptr<entry_t[]> m_entries;
+    std::atomic<uint32_t> m_state;
+};
+} // namespace frame_cap
+} // namespace who
@@ -5,7 +5,11 @@ using namespace who::lcd;
 namespace who {
 namespace lcd_disp {
 WhoFrameLCDDisp::WhoFrameLCDDisp(const std::string &name, frame_cap::WhoFrameCapNode *frame_cap_node, int peek_index) :
-    task::WhoTask(name), m_lcd(new lcd::WhoLCD()), m_frame_cap_node(frame_cap_node), m_peek_index(peek_index)
+    task::WhoTask(name),
+    m_lcd(new lcd::WhoLCD()),
+    m_frame_cap_node(frame_cap_node),
+    m_peek_index(peek_index),
+    m_fb(nullptr)
 {
     frame_cap_node->add_new_frame_signal_subscriber(this);
 #if !BSP_CONFIG_NO_GRAPHIC_LIB
@@ -55,7 +59,10 @@ void WhoFrameLCDDisp::task()
                 continue;
             }
         }
-        auto fb = m_frame_cap_node->cam_fb_peek(m_peek_index);
+        auto fb = m_frame_cap_node->cam_fb_lease(m_peek_index);
+        if (!fb) {
+            continue;
+        }
 #if BSP_CONFIG_NO_GRAPHIC_LIB
         if (m_lcd_disp_cb) {
             m_lcd_disp_cb(fb);
@@ -69,9 +76,17 @@ void WhoFrameLCDDisp::task()
         }
         bsp_display_unlock();
 #endif
+        m_frame_cap_node->cam_fb_release(m_fb);
+        m_fb = fb;
     }
     xEventGroupSetBits(m_event_group, TASK_STOPPED);
     vTaskDelete(NULL);
 }
+
+void WhoFrameLCDDisp::cleanup()
+{
+    m_frame_cap_node->cam_fb_release(m_fb);
+    m_fb = nullptr;
+}
 } // namespace lcd_disp
 } // namespace who
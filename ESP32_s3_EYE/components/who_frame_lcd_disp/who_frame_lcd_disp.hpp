@@ -18,12 +18,15 @@ public:
 
 private:
     void task() override;
+    void cleanup() override;
     lcd::WhoLCD *m_lcd;
 #if !BSP_CONFIG_NO_GRAPHIC_LIB
     lv_obj_t *m_canvas;
 #endif
     frame_cap::WhoFrameCapNode *m_frame_cap_node;
     bool m_peek_index;
+    // The frame on screen. The display may read it after draw returns, so it stays leased until the next one is shown.
+    who::cam::cam_fb_t *m_fb;
     std::function<void(who::cam::cam_fb_t *)> m_lcd_disp_cb;
 };
 } // namespace lcd_disp
@@ -0,0 +1,157 @@
+// The rate controller against a synthetic encoder whose JPEG doubles every 12 quality steps: it settles on the target,
+// keeps a fixed quality without one, stays in its bounds, and steps down on a JPEG which didn't fit its buffer, which
+// has no size to follow.
+#include "who_jpeg_rc.h"
+#include <cmath>
+#include <cstdio>
+
+static int s_errors = 0;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_errors++;
+    }
+}
+
+// JPEG bytes of a frame encoded with quality, 20000 at quality 50.
+static size_t jpeg_len(uint8_t quality)
+{
+    return (size_t)(20000. * std::pow(2., (quality - 50) / 12.));
+}
+
+static void init(who_jpeg_rc_t *rc, uint32_t target_bytes, uint8_t quality, uint8_t min_quality, uint8_t max_quality)
+{
+    who_jpeg_rc_config_t config = {};
+    config.target_bytes = target_bytes;
+    config.quality = quality;
+    config.min_quality = min_quality;
+    config.max_quality = max_quality;
+    who_jpeg_rc_init(rc, &config);
+}
+
+// Encodes frames until the quality stops changing, returns false if it doesn't within 30 frames.
+static bool settle(who_jpeg_rc_t *rc)
+{
+    for (int i = 0; i < 30; i++) {
+        uint8_t quality = who_jpeg_rc_get_quality(rc);
+        who_jpeg_rc_update(rc, jpeg_len(quality));
+        if (who_jpeg_rc_get_quality(rc) == quality) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_converge()
+{
+    who_jpeg_rc_t rc;
+    init(&rc, 12000, 80, 10, 95);
+    check(settle(&rc), "converge down: settles");
+    size_t len = jpeg_len(who_jpeg_rc_get_quality(&rc));
+    check(len > 12000 * 0.85 && len < 12000 * 1.15, "converge down: near the target");
+
+    init(&rc, 30000, 20, 10, 95);
+    check(settle(&rc), "converge up: settles");
+    len = jpeg_len(who_jpeg_rc_get_quality(&rc));
+    check(len > 30000 * 0.85 && len < 30000 * 1.15, "converge up: near the target");
+
+    // A new budget, e.g. from a new bitrate, is followed from where the quality is.
+    who_jpeg_rc_set_target(&rc, 10000);
+    check(settle(&rc), "new target: settles");
+    len = jpeg_len(who_jpeg_rc_get_quality(&rc));
+    check(len > 10000 * 0.85 && len < 10000 * 1.15, "new target: near the target");
+}
+
+static void test_max_step()
+{
+    who_jpeg_rc_t rc;
+    init(&rc, 1000, 90, 1, 100);
+    who_jpeg_rc_update(&rc, jpeg_len(90));
+    check(who_jpeg_rc_get_quality(&rc) == 80, "max step: a frame far too big moves the quality by 10 only");
+    who_jpeg_rc_update(&rc, 1050);
+    check(who_jpeg_rc_get_quality(&rc) == 80, "deadband: a frame near the target keeps the quality");
+}
+
+static void test_fixed()
+{
+    who_jpeg_rc_t rc;
+    init(&rc, 0, 70, 10, 95);
+    who_jpeg_rc_update(&rc, 1);
+    who_jpeg_rc_update(&rc, 1000000);
+    check(who_jpeg_rc_get_quality(&rc) == 70, "fixed: no target keeps the quality");
+    who_jpeg_rc_update(&rc, 0);
+    check(who_jpeg_rc_get_quality(&rc) == 70, "fixed: an empty frame keeps the quality");
+}
+
+static void test_bounds()
+{
+    who_jpeg_rc_t rc;
+    init(&rc, 12000, 99, 30, 60);
+    check(who_jpeg_rc_get_quality(&rc) == 60, "bounds: first quality clamped to max");
+    init(&rc, 100, 40, 30, 60);
+    for (int i = 0; i < 10; i++) {
+        who_jpeg_rc_update(&rc, jpeg_len(who_jpeg_rc_get_quality(&rc)));
+    }
+    check(who_jpeg_rc_get_quality(&rc) == 30, "bounds: an unreachable small target stops at min");
+    init(&rc, 10000000, 40, 30, 60);
+    for (int i = 0; i < 10; i++) {
+        who_jpeg_rc_update(&rc, jpeg_len(who_jpeg_rc_get_quality(&rc)));
+    }
+    check(who_jpeg_rc_get_quality(&rc) == 60, "bounds: an unreachable big target stops at max");
+    init(&rc, 12000, 50, 0, 200);
+    check(rc.config.min_quality == 1 && rc.config.max_quality == 100, "bounds: config clamped to 1..100");
+}
+
+static void test_overflow()
+{
+    who_jpeg_rc_t rc;
+    init(&rc, 12000, 80, 25, 95);
+    who_jpeg_rc_overflow(&rc);
+    check(who_jpeg_rc_get_quality(&rc) == 70, "overflow: steps down by 10");
+    for (int i = 0; i < 10; i++) {
+        who_jpeg_rc_overflow(&rc);
+    }
+    check(who_jpeg_rc_get_quality(&rc) == 25, "overflow: repeated overflows stop at min");
+
+    // A fixed quality too big for the buffer must not stall the stream either.
+    init(&rc, 0, 90, 10, 95);
+    who_jpeg_rc_overflow(&rc);
+    check(who_jpeg_rc_get_quality(&rc) == 80, "overflow: fixed quality steps down too");
+
+    // A buffer of 16000 bytes holds up to quality 55. Frames that don't fit are dropped, the rest are followed, so
+    // the stream recovers within a few frames and keeps to the target once it fits.
+    init(&rc, 12000, 95, 10, 95);
+    int dropped = 0;
+    bool fits = false;
+    for (int i = 0; i < 20; i++) {
+        size_t len = jpeg_len(who_jpeg_rc_get_quality(&rc));
+        if (len > 16000) {
+            check(!fits, "overflow: no overflow once the stream fits");
+            who_jpeg_rc_overflow(&rc);
+            dropped++;
+        } else {
+            fits = true;
+            who_jpeg_rc_update(&rc, len);
+        }
+    }
+    check(fits && dropped <= 5, "overflow: recovers within 5 frames");
+    size_t len = jpeg_len(who_jpeg_rc_get_quality(&rc));
+    check(len > 12000 * 0.85 && len < 12000 * 1.15, "overflow: near the target after recovering");
+}
+
+int main()
+{
+    test_converge();
+    test_max_step();
+    test_fixed();
+    test_bounds();
+    test_overflow();
+    if (s_errors) {
+        printf("%d errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
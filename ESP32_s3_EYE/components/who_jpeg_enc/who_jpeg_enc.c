@@ -0,0 +1,177 @@
+#include "who_jpeg_enc.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <string.h>
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+#include "driver/jpeg_encode.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "hal/cache_hal.h"
+#include "hal/cache_ll.h"
+#else
+#include "img_converters.h"
+#endif
+
+static const char *TAG = "WhoJpegEnc";
+
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+// A frame takes a few ms on the codec, this only catches a hung engine
+#define HW_ENC_TIMEOUT_MS 100
+
+static jpeg_encoder_handle_t s_engine = NULL;
+static SemaphoreHandle_t s_mutex = NULL;
+
+esp_err_t who_jpeg_enc_init(void)
+{
+    if (s_engine) {
+        return ESP_OK;
+    }
+    s_mutex = xSemaphoreCreateMutex();
+    if (!s_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+    jpeg_encode_engine_cfg_t engine_cfg = {
+        .intr_priority = 0,
+        .timeout_ms = HW_ENC_TIMEOUT_MS,
+    };
+    esp_err_t ret = jpeg_new_encoder_engine(&engine_cfg, &s_engine);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create jpeg encoder engine.");
+        vSemaphoreDelete(s_mutex);
+        s_mutex = NULL;
+    }
+    return ret;
+}
+
+who_jpeg_enc_backend_t who_jpeg_enc_get_backend(void)
+{
+    return WHO_JPEG_ENC_BACKEND_HW;
+}
+
+uint32_t who_jpeg_enc_get_out_caps(void)
+{
+    return MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA | MALLOC_CAP_8BIT;
+}
+
+size_t who_jpeg_enc_get_out_align(void)
+{
+    return cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
+}
+
+esp_err_t who_jpeg_enc_encode(const uint8_t *src,
+                              size_t src_len,
+                              uint16_t width,
+                              uint16_t height,
+                              pixformat_t format,
+                              uint8_t quality,
+                              uint8_t *out,
+                              size_t out_size,
+                              size_t *out_len)
+{
+    jpeg_enc_input_format_t src_type;
+    jpeg_down_sampling_type_t sub_sample = JPEG_DOWN_SAMPLING_YUV420;
+    switch (format) {
+    case PIXFORMAT_RGB565:
+        src_type = JPEG_ENCODE_IN_FORMAT_RGB565;
+        break;
+    case PIXFORMAT_RGB888:
+        src_type = JPEG_ENCODE_IN_FORMAT_RGB888;
+        break;
+    case PIXFORMAT_GRAYSCALE:
+        src_type = JPEG_ENCODE_IN_FORMAT_GRAY;
+        sub_sample = JPEG_DOWN_SAMPLING_GRAY;
+        break;
+    default:
+        ESP_LOGE(TAG, "Unsupported pixel format %d.", format);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (!s_engine) {
+        ESP_LOGE(TAG, "Call who_jpeg_enc_init() first.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    jpeg_encode_cfg_t enc_cfg = {
+        .height = height,
+        .width = width,
+        .src_type = src_type,
+        .sub_sample = sub_sample,
+        .image_quality = quality,
+    };
+    uint32_t len = 0;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    esp_err_t ret = jpeg_encoder_process(s_engine, &enc_cfg, src, src_len, out, out_size, &len);
+    xSemaphoreGive(s_mutex);
+    if (ret != ESP_OK) {
+        // The codec doesn't tell a full output buffer from other failures
+        return ret;
+    }
+    *out_len = len;
+    return ESP_OK;
+}
+#else
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} sw_enc_out_t;
+
+esp_err_t who_jpeg_enc_init(void)
+{
+    return ESP_OK;
+}
+
+who_jpeg_enc_backend_t who_jpeg_enc_get_backend(void)
+{
+    return WHO_JPEG_ENC_BACKEND_SW;
+}
+
+uint32_t who_jpeg_enc_get_out_caps(void)
+{
+    return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+}
+
+size_t who_jpeg_enc_get_out_align(void)
+{
+    return 16;
+}
+
+// fmt2jpg_cb streams the encoded bytes in chunks, write them straight into the output buffer
+static size_t sw_enc_write_cb(void *arg, size_t index, const void *data, size_t len)
+{
+    sw_enc_out_t *out = (sw_enc_out_t *)arg;
+    if (out->overflow || index + len > out->size) {
+        out->overflow = true;
+        return 0;
+    }
+    memcpy(out->buf + index, data, len);
+    out->len = index + len;
+    return len;
+}
+
+esp_err_t who_jpeg_enc_encode(const uint8_t *src,
+                              size_t src_len,
+                              uint16_t width,
+                              uint16_t height,
+                              pixformat_t format,
+                              uint8_t quality,
+                              uint8_t *out,
+                              size_t out_size,
+                              size_t *out_len)
+{
+    sw_enc_out_t enc_out = {
+        .buf = out,
+        .size = out_size,
+        .len = 0,
+        .overflow = false,
+    };
+    bool ok = fmt2jpg_cb((uint8_t *)src, src_len, width, height, format, quality, sw_enc_write_cb, &enc_out);
+    if (enc_out.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!ok) {
+        return ESP_FAIL;
+    }
+    *out_len = enc_out.len;
+    return ESP_OK;
+}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// JPEG encoder of the raw frames. Targets with a JPEG codec (CONFIG_SOC_JPEG_CODEC_SUPPORTED) encode on the codec,
+// the others in software with the esp32-camera encoder. Both write into a buffer of the caller, so the JPEGs can live
+// in a pool.
+typedef enum {
+    WHO_JPEG_ENC_BACKEND_SW,
+    WHO_JPEG_ENC_BACKEND_HW,
+} who_jpeg_enc_backend_t;
+
+// Creates the codec engine. Call once before the first encode, does nothing on the software backend.
+esp_err_t who_jpeg_enc_init(void);
+who_jpeg_enc_backend_t who_jpeg_enc_get_backend(void);
+// The codec writes the JPEG with DMA, allocate out with these caps and align it and its size to this.
+uint32_t who_jpeg_enc_get_out_caps(void);
+size_t who_jpeg_enc_get_out_align(void);
+// Encode a RGB565, RGB888 or grayscale frame with quality 1..100. Returns ESP_ERR_INVALID_SIZE if the JPEG doesn't
+// fit into out_size bytes. Thread safe, the codec encodes one frame at a time.
+esp_err_t who_jpeg_enc_encode(const uint8_t *src,
+                              size_t src_len,
+                              uint16_t width,
+                              uint16_t height,
+                              pixformat_t format,
+                              uint8_t quality,
+                              uint8_t *out,
+                              size_t out_size,
+                              size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
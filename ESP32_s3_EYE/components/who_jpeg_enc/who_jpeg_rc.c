@@ -0,0 +1,58 @@
+#include "who_jpeg_rc.h"
+#include <math.h>
+
+// Quality steps per doubling of the size, a bit below the real slope so the loop doesn't overshoot
+#define RC_GAIN 8.f
+// Largest step per frame, a single odd frame (a hand in front of the lens) must not ruin the next ones
+#define RC_MAX_STEP 10.f
+// Size errors below this share are noise of the scene, not of the quality
+#define RC_DEADBAND 0.1f
+
+static float clamp_quality(const who_jpeg_rc_t *rc, float quality)
+{
+    if (quality < rc->config.min_quality) return rc->config.min_quality;
+    if (quality > rc->config.max_quality) return rc->config.max_quality;
+    return quality;
+}
+
+void who_jpeg_rc_init(who_jpeg_rc_t *rc, const who_jpeg_rc_config_t *config)
+{
+    rc->config = *config;
+    if (rc->config.min_quality < 1) rc->config.min_quality = 1;
+    if (rc->config.max_quality > 100) rc->config.max_quality = 100;
+    if (rc->config.max_quality < rc->config.min_quality) rc->config.max_quality = rc->config.min_quality;
+    rc->quality = clamp_quality(rc, rc->config.quality);
+    rc->last_bytes = 0;
+}
+
+void who_jpeg_rc_set_target(who_jpeg_rc_t *rc, uint32_t target_bytes)
+{
+    rc->config.target_bytes = target_bytes;
+}
+
+uint8_t who_jpeg_rc_get_quality(const who_jpeg_rc_t *rc)
+{
+    return (uint8_t)lroundf(rc->quality);
+}
+
+void who_jpeg_rc_update(who_jpeg_rc_t *rc, size_t jpeg_len)
+{
+    rc->last_bytes = jpeg_len;
+    if (rc->config.target_bytes == 0 || jpeg_len == 0) {
+        return;
+    }
+    float ratio = (float)rc->config.target_bytes / jpeg_len;
+    if (fabsf(ratio - 1.f) < RC_DEADBAND) {
+        return;
+    }
+    float step = RC_GAIN * log2f(ratio);
+    if (step > RC_MAX_STEP) step = RC_MAX_STEP;
+    if (step < -RC_MAX_STEP) step = -RC_MAX_STEP;
+    rc->quality = clamp_quality(rc, rc->quality + step);
+}
+
+void who_jpeg_rc_overflow(who_jpeg_rc_t *rc)
+{
+    rc->last_bytes = 0;
+    rc->quality = clamp_quality(rc, rc->quality - RC_MAX_STEP);
+}
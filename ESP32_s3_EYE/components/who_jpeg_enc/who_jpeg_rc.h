@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rate control of a JPEG stream. The quality of the next frame follows the size of the last one, so the stream keeps
+// to a byte budget per frame and a slow link gets smaller frames instead of stalling on big ones.
+//
+// JPEG size grows roughly exponentially with the quality in the useful range, so the quality moves with the log of
+// the size error. Plain C without FreeRTOS, not thread safe.
+typedef struct {
+    uint32_t target_bytes; // JPEG bytes per frame, 0 keeps the quality fixed
+    uint8_t quality;       // first and fixed quality, 1..100
+    uint8_t min_quality;
+    uint8_t max_quality;
+} who_jpeg_rc_config_t;
+
+typedef struct {
+    who_jpeg_rc_config_t config;
+    float quality;
+    size_t last_bytes;
+} who_jpeg_rc_t;
+
+void who_jpeg_rc_init(who_jpeg_rc_t *rc, const who_jpeg_rc_config_t *config);
+// Change the budget on the fly, e.g. from a bitrate and the frame rate. 0 keeps the current quality.
+void who_jpeg_rc_set_target(who_jpeg_rc_t *rc, uint32_t target_bytes);
+// Quality to encode the next frame with.
+uint8_t who_jpeg_rc_get_quality(const who_jpeg_rc_t *rc);
+// Size of the frame just encoded with who_jpeg_rc_get_quality().
+void who_jpeg_rc_update(who_jpeg_rc_t *rc, size_t jpeg_len);
+// The frame encoded with who_jpeg_rc_get_quality() didn't fit its buffer, so its size is unknown. Steps the quality
+// down by the largest step, also at a fixed quality: a frame which never fits stalls the stream for good.
+void who_jpeg_rc_overflow(who_jpeg_rc_t *rc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,4 +5,7 @@
 #elif CONFIG_IDF_TARGET_ESP32P4
 #include "who_p4_cam.hpp"
 #endif
+#if !CONFIG_IDF_TARGET_LINUX
 #include "who_uvc_cam.hpp"
+#endif
+#include "who_file_cam.hpp"
@@ -1,16 +1,22 @@
 #pragma once
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#if !CONFIG_IDF_TARGET_LINUX
 #include "dl_image.hpp"
 #include "usb/uvc_host.h"
+#include "bsp/esp-bsp.h"
+#endif
 #if CONFIG_IDF_TARGET_ESP32S3
 #include "esp_camera.h"
 #elif CONFIG_IDF_TARGET_ESP32P4
 #include "linux/videodev2.h"
 #endif
-#include "bsp/esp-bsp.h"
 
 namespace who {
 namespace cam {
-enum class cam_fb_fmt_t { CAM_FB_FMT_RGB565, CAM_FB_FMT_RGB888, CAM_FB_FMT_JPEG, CAM_FB_FMT_UKN };
+enum class cam_fb_fmt_t { CAM_FB_FMT_RGB565, CAM_FB_FMT_RGB888, CAM_FB_FMT_GRAY, CAM_FB_FMT_JPEG, CAM_FB_FMT_UKN };
 
 #if CONFIG_IDF_TARGET_ESP32S3
 inline framesize_t get_cam_frame_size_from_lcd_resolution()
@@ -30,6 +36,8 @@ inline cam_fb_fmt_t pix_fmt2cam_fb_fmt(pixformat_t pix_fmt)
         return cam_fb_fmt_t::CAM_FB_FMT_RGB565;
     case PIXFORMAT_RGB888:
         return cam_fb_fmt_t::CAM_FB_FMT_RGB888;
+    case PIXFORMAT_GRAYSCALE:
+        return cam_fb_fmt_t::CAM_FB_FMT_GRAY;
     case PIXFORMAT_JPEG:
         return cam_fb_fmt_t::CAM_FB_FMT_JPEG;
     default:
@@ -38,6 +46,8 @@ inline cam_fb_fmt_t pix_fmt2cam_fb_fmt(pixformat_t pix_fmt)
 }
 #endif
 
+// esp-dl and the usb host are not available on the linux target, only the file camera is built there.
+#if !CONFIG_IDF_TARGET_LINUX
 inline cam_fb_fmt_t dl_pix_fmt2cam_fb_fmt(dl::image::pix_type_t dl_pix_fmt)
 {
     switch (dl_pix_fmt) {
@@ -45,6 +55,8 @@ inline cam_fb_fmt_t dl_pix_fmt2cam_fb_fmt(dl::image::pix_type_t dl_pix_fmt)
         return cam_fb_fmt_t::CAM_FB_FMT_RGB565;
     case dl::image::DL_IMAGE_PIX_TYPE_RGB888:
         return cam_fb_fmt_t::CAM_FB_FMT_RGB888;
+    case dl::image::DL_IMAGE_PIX_TYPE_GRAY:
+        return cam_fb_fmt_t::CAM_FB_FMT_GRAY;
     default:
         return cam_fb_fmt_t::CAM_FB_FMT_UKN;
     }
@@ -59,6 +71,7 @@ inline cam_fb_fmt_t uvc_fmt2cam_fb_fmt(uvc_host_stream_format uvc_fmt)
         return cam_fb_fmt_t::CAM_FB_FMT_UKN;
     }
 }
+#endif
 
 #if CONFIG_IDF_TARGET_ESP32P4
 inline cam_fb_fmt_t v4l2_fmt2cam_fb_fmt(uint32_t v4l2_fmt)
@@ -98,6 +111,7 @@ typedef struct cam_fb_s {
         ret = (void *)(&fb);
     }
 #endif
+#if !CONFIG_IDF_TARGET_LINUX
     cam_fb_s(const uvc_host_frame_t &fb, int64_t cur_time)
     {
         buf = (void *)fb.data;
@@ -121,12 +135,15 @@ typedef struct cam_fb_s {
     }
     operator dl::image::img_t() const
     {
-        return {.data = buf,
-                .width = width,
-                .height = height,
-                .pix_type = format == who::cam::cam_fb_fmt_t::CAM_FB_FMT_RGB565 ? dl::image::DL_IMAGE_PIX_TYPE_RGB565
-                                                                                : dl::image::DL_IMAGE_PIX_TYPE_RGB888};
+        dl::image::pix_type_t pix_type = dl::image::DL_IMAGE_PIX_TYPE_RGB888;
+        if (format == who::cam::cam_fb_fmt_t::CAM_FB_FMT_RGB565) {
+            pix_type = dl::image::DL_IMAGE_PIX_TYPE_RGB565;
+        } else if (format == who::cam::cam_fb_fmt_t::CAM_FB_FMT_GRAY) {
+            pix_type = dl::image::DL_IMAGE_PIX_TYPE_GRAY;
+        }
+        return {.data = buf, .width = width, .height = height, .pix_type = pix_type};
     }
+#endif
 } cam_fb_t;
 
 } // namespace cam
@@ -0,0 +1,117 @@
+// Replays a generated directory of RGB565 frames through WhoFileCam: only files of the format are played, in name
+// order, a file of the wrong size is skipped, a single pass ends after the last file and no more frames are handed
+// out than the camera has fbs.
+#include "who_file_cam.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace who::cam;
+
+TickType_t s_host_tick = 1;
+
+static constexpr uint16_t WIDTH = 4;
+static constexpr uint16_t HEIGHT = 2;
+static constexpr size_t FRAME_LEN = WIDTH * HEIGHT * 2;
+
+static int s_errors = 0;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_errors++;
+    }
+}
+
+static void write_file(const std::string &path, uint8_t fill, size_t len)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    for (size_t i = 0; i < len; i++) {
+        fputc(fill, f);
+    }
+    fclose(f);
+}
+
+// Frames 1 to 3 are filled with their number, written out of order to check the sort.
+static std::string make_frames()
+{
+    char tmpl[] = "/tmp/file_cam_test_XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    write_file(dir + "/f3.rgb565", 3, FRAME_LEN);
+    write_file(dir + "/f1.rgb565", 1, FRAME_LEN);
+    write_file(dir + "/f2.RGB565", 2, FRAME_LEN);
+    write_file(dir + "/f0_short.rgb565", 9, FRAME_LEN - 2);
+    write_file(dir + "/notes.txt", 9, 10);
+    return dir;
+}
+
+static void test_single_pass(const std::string &dir)
+{
+    WhoFileCam cam(dir, cam_fb_fmt_t::CAM_FB_FMT_RGB565, WIDTH, HEIGHT, 0, 2, false);
+    check(cam.get_num_files() == 4, "single pass: only files of the format");
+    // The short frame sorts first and is skipped with an error, then the rest in name order.
+    check(!cam.cam_fb_get(), "single pass: a file of the wrong size gives no frame");
+    for (int i = 1; i <= 3; i++) {
+        cam_fb_t *fb = cam.cam_fb_get();
+        check(fb && fb->len == FRAME_LEN && fb->width == WIDTH && fb->height == HEIGHT, "single pass: frame size");
+        check(fb && fb->format == cam_fb_fmt_t::CAM_FB_FMT_RGB565, "single pass: frame format");
+        check(fb && ((uint8_t *)fb->buf)[0] == i && ((uint8_t *)fb->buf)[FRAME_LEN - 1] == i,
+              "single pass: name order");
+        cam.cam_fb_return(fb);
+    }
+    check(cam.is_finished() && !cam.cam_fb_get(), "single pass: ends after the last file");
+}
+
+static void test_loop(const std::string &dir)
+{
+    WhoFileCam cam(dir, cam_fb_fmt_t::CAM_FB_FMT_RGB565, WIDTH, HEIGHT, 0, 2, true);
+    int frames = 0;
+    for (int i = 0; i < 12; i++) {
+        cam_fb_t *fb = cam.cam_fb_get();
+        frames += fb != nullptr;
+        cam.cam_fb_return(fb);
+    }
+    check(frames == 9 && !cam.is_finished(), "loop: starts over after the last file");
+}
+
+static void test_fb_count(const std::string &dir)
+{
+    WhoFileCam cam(dir, cam_fb_fmt_t::CAM_FB_FMT_RGB565, WIDTH, HEIGHT, 0, 2, true);
+    cam.cam_fb_get();
+    cam_fb_t *fb1 = cam.cam_fb_get();
+    cam_fb_t *fb2 = cam.cam_fb_get();
+    check(fb1 && fb2 && fb1 != fb2 && fb1->buf != fb2->buf, "fb_count: distinct fbs");
+    check(!cam.cam_fb_get(), "fb_count: no more frames than fbs are held");
+    cam.cam_fb_return(fb1);
+    cam_fb_t *fb3 = cam.cam_fb_get();
+    check(fb3 == fb1, "fb_count: a returned fb is used again");
+    cam.cam_fb_return(fb2);
+    cam.cam_fb_return(fb3);
+}
+
+static void test_missing_dir()
+{
+    WhoFileCam cam("/nonexistent/file_cam_test", cam_fb_fmt_t::CAM_FB_FMT_RGB565, WIDTH, HEIGHT, 0, 2, false);
+    check(cam.get_num_files() == 0 && !cam.cam_fb_get(), "missing dir: no frames");
+}
+
+int main()
+{
+    std::string dir = make_frames();
+    test_single_pass(dir);
+    test_loop(dir);
+    test_fb_count(dir);
+    test_missing_dir();
+    std::string cmd = "rm -rf " + dir;
+    if (system(cmd.c_str()) != 0) {
+        printf("failed to remove %s\n", dir.c_str());
+    }
+    if (s_errors) {
+        printf("%d errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
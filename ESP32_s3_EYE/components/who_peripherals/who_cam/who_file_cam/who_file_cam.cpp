@@ -0,0 +1,181 @@
+#include "who_file_cam.hpp"
+#include "who_stats.hpp"
+#include "esp_log.h"
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "WhoFileCam";
+
+namespace who {
+namespace cam {
+static bool has_ext(const char *name, cam_fb_fmt_t format)
+{
+    const char *ext = strrchr(name, '.');
+    if (!ext) {
+        return false;
+    }
+    switch (format) {
+    case cam_fb_fmt_t::CAM_FB_FMT_JPEG:
+        return !strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg");
+    case cam_fb_fmt_t::CAM_FB_FMT_RGB565:
+        return !strcasecmp(ext, ".rgb565");
+    case cam_fb_fmt_t::CAM_FB_FMT_RGB888:
+        return !strcasecmp(ext, ".rgb888");
+    default:
+        return false;
+    }
+}
+
+WhoFileCam::WhoFileCam(const std::string &dir,
+                       cam_fb_fmt_t format,
+                       uint16_t width,
+                       uint16_t height,
+                       float fps,
+                       const uint8_t fb_count,
+                       bool loop) :
+    WhoCam(fb_count, width, height),
+    m_next(0),
+    m_format(format),
+    m_interval(fps > 0 ? pdMS_TO_TICKS((int)(1000.f / fps)) : 0),
+    m_last_wake_time(0),
+    m_loop(loop),
+    m_pool(nullptr)
+{
+    for (int i = 0; i < fb_count; i++) {
+        m_cam_fbs[i].ret = nullptr;
+    }
+    size_t max_len = 0;
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        ESP_LOGE(TAG, "Failed to open %s.", dir.c_str());
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (!has_ext(entry->d_name, format)) {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            m_files.emplace_back(path);
+            max_len = std::max(max_len, (size_t)st.st_size);
+        }
+    }
+    closedir(d);
+    if (m_files.empty()) {
+        ESP_LOGE(TAG, "No frames found in %s.", dir.c_str());
+        return;
+    }
+    std::sort(m_files.begin(), m_files.end());
+    // One slot per fb, sized for the biggest file.
+    who_buf_pool_config_t config = {};
+    config.name = "file_cam";
+    config.slot_size = max_len;
+    config.slot_count = fb_count;
+#if !CONFIG_IDF_TARGET_LINUX
+    config.caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+#endif
+    ESP_ERROR_CHECK(who_buf_pool_create(&config, &m_pool));
+    ESP_LOGI(TAG, "Replay %d frames from %s.", (int)m_files.size(), dir.c_str());
+}
+
+WhoFileCam::~WhoFileCam()
+{
+    who_buf_pool_delete(m_pool);
+}
+
+int WhoFileCam::get_cam_fb_index()
+{
+    for (int i = 0; i < m_fb_count; i++) {
+        if (!m_cam_fbs[i].ret) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool WhoFileCam::read_file(const std::string &path, uint8_t *buf, size_t &len)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s.", path.c_str());
+        return false;
+    }
+    len = fread(buf, 1, who_buf_pool_get_slot_size(m_pool), f);
+    fclose(f);
+    size_t raw_len = 0;
+    if (m_format == cam_fb_fmt_t::CAM_FB_FMT_RGB565) {
+        raw_len = (size_t)m_fb_width * m_fb_height * 2;
+    } else if (m_format == cam_fb_fmt_t::CAM_FB_FMT_RGB888) {
+        raw_len = (size_t)m_fb_width * m_fb_height * 3;
+    }
+    if (raw_len && len != raw_len) {
+        ESP_LOGE(TAG, "%s has %d bytes, expected %d.", path.c_str(), (int)len, (int)raw_len);
+        return false;
+    }
+    return len > 0;
+}
+
+cam_fb_t *WhoFileCam::cam_fb_get()
+{
+    // Pace like a real sensor, also when there is nothing to replay so the fetch node does not spin.
+    if (!m_last_wake_time) {
+        m_last_wake_time = xTaskGetTickCount();
+    }
+    if (m_interval) {
+        vTaskDelayUntil(&m_last_wake_time, m_interval);
+    }
+    if (m_files.empty() || is_finished()) {
+        if (!m_interval) {
+            vTaskDelay(1);
+        }
+        return nullptr;
+    }
+    if (m_next >= m_files.size()) {
+        m_next = 0;
+    }
+    int i = get_cam_fb_index();
+    if (i < 0) {
+        ESP_LOGE(TAG, "No free cam_fb_t, more frames are held than fb_count.");
+        return nullptr;
+    }
+    uint8_t *buf = (uint8_t *)who_buf_pool_alloc(m_pool, who_buf_pool_get_slot_size(m_pool), 0);
+    if (!buf) {
+        return nullptr;
+    }
+    size_t len = 0;
+    const std::string &path = m_files[m_next++];
+    if (!read_file(path, buf, len)) {
+        who_buf_pool_free(m_pool, buf);
+        return nullptr;
+    }
+    int64_t us = stats::WhoStats::now_us();
+    cam_fb_t &fb = m_cam_fbs[i];
+    fb.buf = buf;
+    fb.len = len;
+    fb.width = m_fb_width;
+    fb.height = m_fb_height;
+    fb.format = m_format;
+    fb.timestamp.tv_sec = us / 1000000;
+    fb.timestamp.tv_usec = us % 1000000;
+    fb.ret = buf;
+    return &fb;
+}
+
+void WhoFileCam::cam_fb_return(cam_fb_t *fb)
+{
+    if (!fb || !fb->ret) {
+        return;
+    }
+    who_buf_pool_free(m_pool, fb->ret);
+    fb->ret = nullptr;
+}
+} // namespace cam
+} // namespace who
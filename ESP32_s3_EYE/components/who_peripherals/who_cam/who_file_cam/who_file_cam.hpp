@@ -0,0 +1,43 @@
+#pragma once
+#include "who_cam_base.hpp"
+#include "who_buf_pool.h"
+#include <string>
+#include <vector>
+
+namespace who {
+namespace cam {
+// Replays a directory of recorded frames as if they came from a camera. Useful to run the pipeline on the same
+// input again and again, on the board from the sdcard or on the linux target from a host directory.
+class WhoFileCam : public WhoCam {
+public:
+    // Every file in dir with the extension of the format (.jpg/.jpeg, .rgb565, .rgb888) is played in name order.
+    // Raw files hold width * height pixels as the camera would deliver them. If loop is false, cam_fb_get() returns
+    // nullptr after the last file.
+    WhoFileCam(const std::string &dir,
+               cam_fb_fmt_t format,
+               uint16_t width,
+               uint16_t height,
+               float fps,
+               const uint8_t fb_count,
+               bool loop = true);
+    ~WhoFileCam();
+    cam_fb_t *cam_fb_get() override;
+    void cam_fb_return(cam_fb_t *fb) override;
+    cam_fb_fmt_t get_fb_format() override { return m_format; }
+    int get_num_files() { return m_files.size(); }
+    bool is_finished() { return !m_loop && m_next >= m_files.size(); }
+
+private:
+    int get_cam_fb_index();
+    bool read_file(const std::string &path, uint8_t *buf, size_t &len);
+
+    std::vector<std::string> m_files;
+    size_t m_next;
+    cam_fb_fmt_t m_format;
+    TickType_t m_interval;
+    TickType_t m_last_wake_time;
+    bool m_loop;
+    who_buf_pool_handle_t m_pool;
+};
+} // namespace cam
+} // namespace who
@@ -14,6 +14,9 @@ WhoS3Cam::WhoS3Cam(const pixformat_t pixel_format,
                    bool horizontal_flip) :
     WhoCam(fb_count, resolution[frame_size].width, resolution[frame_size].height), m_format(pixel_format)
 {
+    for (int i = 0; i < fb_count; i++) {
+        m_cam_fbs[i].ret = nullptr;
+    }
     ESP_ERROR_CHECK(bsp_i2c_init());
     camera_config_t camera_config = BSP_CAMERA_DEFAULT_CONFIG;
     camera_config.pixel_format = pixel_format;
@@ -41,6 +44,11 @@ cam_fb_t *WhoS3Cam::cam_fb_get()
         return nullptr;
     }
     int i = get_cam_fb_index();
+    if (i < 0) {
+        ESP_LOGE(TAG, "No free cam_fb_t, more frames are held than fb_count.");
+        esp_camera_fb_return(fb);
+        return nullptr;
+    }
     m_cam_fbs[i] = cam_fb_t(*fb);
     return &m_cam_fbs[i];
 }
@@ -51,6 +59,7 @@ void WhoS3Cam::cam_fb_return(cam_fb_t *fb)
         return;
     }
     esp_camera_fb_return((camera_fb_t *)fb->ret);
+    fb->ret = nullptr;
 }
 
 esp_err_t WhoS3Cam::set_flip(bool vertical_flip, bool horizontal_flip)
@@ -76,10 +85,14 @@ esp_err_t WhoS3Cam::set_flip(bool vertical_flip, bool horizontal_flip)
 
 int WhoS3Cam::get_cam_fb_index()
 {
-    static int i = 0;
-    int index = i;
-    i = (i + 1) % m_fb_count;
-    return index;
+    // Frames may be returned out of order when they are leased, so pick a cam_fb_t which is not held instead of
+    // just rotating.
+    for (int i = 0; i < m_fb_count; i++) {
+        if (!m_cam_fbs[i].ret) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 } // namespace cam
@@ -8,6 +8,9 @@ WhoUVCCam::WhoUVCCam(
     const uvc_host_stream_format fmt, uint16_t h_res, uint16_t v_res, float fps, const uint8_t fb_count) :
     WhoCam(fb_count, h_res, v_res), m_frame(xQueueCreate(1, sizeof(uvc_host_frame_t *))), m_format(fmt)
 {
+    for (int i = 0; i < fb_count; i++) {
+        m_cam_fbs[i].ret = nullptr;
+    }
     assert(fmt == UVC_VS_FORMAT_MJPEG || fmt == UVC_VS_FORMAT_YUY2);
     size_t frame_size = (fmt == UVC_VS_FORMAT_MJPEG) ? (size_t)(h_res * v_res * 3 / 5.f) : (size_t)(h_res * v_res * 2);
     m_stream_config = {
@@ -52,6 +55,11 @@ cam_fb_t *WhoUVCCam::cam_fb_get()
     uvc_host_frame_t *frame;
     xQueueReceive(m_frame, &frame, portMAX_DELAY);
     int i = get_cam_fb_index();
+    if (i < 0) {
+        ESP_LOGE(TAG, "No free cam_fb_t, more frames are held than fb_count.");
+        uvc_host_frame_return(m_stream, frame);
+        return nullptr;
+    }
     m_cam_fbs[i] = cam_fb_t(*frame, esp_timer_get_time());
     return &m_cam_fbs[i];
 }
@@ -59,14 +67,18 @@ cam_fb_t *WhoUVCCam::cam_fb_get()
 void WhoUVCCam::cam_fb_return(cam_fb_t *fb)
 {
     uvc_host_frame_return(m_stream, (uvc_host_frame_t *)fb->ret);
+    fb->ret = nullptr;
 }
 
 int WhoUVCCam::get_cam_fb_index()
 {
-    static int i = 0;
-    int index = i;
-    i = (i + 1) % m_fb_count;
-    return index;
+    // Frames may be returned out of order when they are leased, so pick a cam_fb_t which is not held.
+    for (int i = 0; i < m_fb_count; i++) {
+        if (!m_cam_fbs[i].ret) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 void WhoUVCCam::stream_cb(const uvc_host_stream_event_data_t *event, void *user_ctx)
@@ -41,12 +41,17 @@ void WhoQRCode::task()
                 continue;
             }
         }
-        auto fb = m_frame_cap_node->cam_fb_peek();
+        auto fb = m_frame_cap_node->cam_fb_lease();
+        if (!fb) {
+            continue;
+        }
         int w, h;
         uint8_t *data = quirc_begin(m_qr, &w, &h);
         dl::image::img_t dst_img = {
             .data = data, .width = (uint16_t)w, .height = (uint16_t)h, .pix_type = dl::image::DL_IMAGE_PIX_TYPE_GRAY};
         m_image_transformer.set_src_img(*fb).set_dst_img(dst_img).transform();
+        // The gray copy is all quirc needs.
+        m_frame_cap_node->cam_fb_release(fb);
         quirc_end(m_qr);
         int num_codes = quirc_count(m_qr);
         for (int i = 0; i < num_codes; i++) {
@@ -0,0 +1,92 @@
+#include "who_face_quality.hpp"
+#include "esp_heap_caps.h"
+#include <algorithm>
+#include <cmath>
+
+namespace who {
+namespace recognition {
+WhoFaceQuality::WhoFaceQuality(int size_ref, float sharpness_ref) :
+    m_size_ref(size_ref),
+    m_sharpness_ref(sharpness_ref),
+    m_patch((uint8_t *)heap_caps_malloc(PATCH_SIZE * PATCH_SIZE, MALLOC_CAP_DEFAULT))
+{
+#if CONFIG_IDF_TARGET_ESP32S3
+    m_image_transformer.set_caps(dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN);
+#endif
+}
+
+WhoFaceQuality::~WhoFaceQuality()
+{
+    heap_caps_free(m_patch);
+}
+
+WhoFaceQuality::quality_t WhoFaceQuality::evaluate(const dl::image::img_t &img, const dl::detect::result_t &res)
+{
+    quality_t quality = evaluate_geometry(res);
+    quality.sharpness = evaluate_sharpness(img, res);
+    quality.score = quality.size * quality.symmetry * quality.sharpness;
+    return quality;
+}
+
+WhoFaceQuality::quality_t WhoFaceQuality::evaluate_geometry(const dl::detect::result_t &res) const
+{
+    quality_t quality = {};
+    int w = res.box[2] - res.box[0];
+    int h = res.box[3] - res.box[1];
+    int side = std::min(w, h);
+    quality.box_area = std::max(w, 0) * std::max(h, 0);
+    // Unknown pose counts as turned away.
+    quality.yaw = 1;
+    quality.size = std::clamp((float)side / m_size_ref, 0.f, 1.f);
+    if (res.keypoint.size() < 10) {
+        return quality;
+    }
+    float left_eye_x = res.keypoint[0], left_eye_y = res.keypoint[1];
+    float nose_x = res.keypoint[4];
+    float right_eye_x = res.keypoint[6], right_eye_y = res.keypoint[7];
+    float eye_dist = std::hypot(right_eye_x - left_eye_x, right_eye_y - left_eye_y);
+    quality.eye_dist = eye_dist;
+    if (eye_dist < 1) {
+        return quality;
+    }
+    // Turning the head moves the nose towards one eye, tilting it moves one eye up.
+    quality.yaw = std::fabs(nose_x - (left_eye_x + right_eye_x) / 2) / eye_dist;
+    float roll = std::fabs(right_eye_y - left_eye_y) / eye_dist;
+    quality.symmetry = std::clamp(1.f - 2 * quality.yaw - roll, 0.f, 1.f);
+    return quality;
+}
+
+float WhoFaceQuality::evaluate_sharpness(const dl::image::img_t &img, const dl::detect::result_t &res)
+{
+    if (!m_patch) {
+        return 0;
+    }
+    int x0 = std::max(res.box[0], 0);
+    int y0 = std::max(res.box[1], 0);
+    int x1 = std::min(res.box[2], (int)img.width);
+    int y1 = std::min(res.box[3], (int)img.height);
+    if (x1 - x0 < 2 || y1 - y0 < 2) {
+        return 0;
+    }
+    dl::image::img_t patch = {
+        .data = m_patch, .width = PATCH_SIZE, .height = PATCH_SIZE, .pix_type = dl::image::DL_IMAGE_PIX_TYPE_GRAY};
+    m_image_transformer.set_src_img(img).set_src_img_crop_area({x0, y0, x1, y1}).set_dst_img(patch).transform();
+
+    // Variance of the 4 neighbour laplacian over the inner pixels.
+    int64_t sum = 0;
+    int64_t sum_sq = 0;
+    for (int y = 1; y < PATCH_SIZE - 1; y++) {
+        const uint8_t *row = m_patch + y * PATCH_SIZE;
+        for (int x = 1; x < PATCH_SIZE - 1; x++) {
+            int lap = 4 * row[x] - row[x - 1] - row[x + 1] - row[x - PATCH_SIZE] - row[x + PATCH_SIZE];
+            sum += lap;
+            sum_sq += lap * lap;
+        }
+    }
+    const int n = (PATCH_SIZE - 2) * (PATCH_SIZE - 2);
+    float mean = (float)sum / n;
+    float var = (float)sum_sq / n - mean * mean;
+    return var / (var + m_sharpness_ref);
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,51 @@
+#pragma once
+#include "dl_detect_base.hpp"
+#include "dl_image.hpp"
+
+namespace who {
+namespace recognition {
+// How well a detected face suits recognition, every score is in [0, 1].
+//
+// Size and symmetry come from the box and the keypoints only. Sharpness is the variance of the laplacian over the
+// face, scaled down to a small gray patch with the esp-dl image transformer first, so it costs a few thousand pixels
+// whatever the face size. The keypoints are in human_face_detect order: left eye, left mouth corner, nose, right eye,
+// right mouth corner.
+class WhoFaceQuality {
+public:
+    typedef struct {
+        // Shorter box side relative to size_ref.
+        float size;
+        // Nose centered between the eyes and the eyes level, 1 for a frontal upright face.
+        float symmetry;
+        float sharpness;
+        // Product of the scores above, a face needs all of them.
+        float score;
+        // Raw measures behind size and symmetry: box area and eye distance in pixels, nose offset from the eye
+        // midpoint relative to the eye distance.
+        int box_area;
+        float eye_dist;
+        float yaw;
+    } quality_t;
+
+    // size_ref is the box side at which the size score saturates, the feat models take 112x112 input.
+    // sharpness_ref is the laplacian variance which scores 0.5.
+    WhoFaceQuality(int size_ref = 112, float sharpness_ref = 100.f);
+    ~WhoFaceQuality();
+    WhoFaceQuality(const WhoFaceQuality &) = delete;
+    WhoFaceQuality &operator=(const WhoFaceQuality &) = delete;
+    quality_t evaluate(const dl::image::img_t &img, const dl::detect::result_t &res);
+    // Size and symmetry only, sharpness and score are left at 0.
+    quality_t evaluate_geometry(const dl::detect::result_t &res) const;
+
+private:
+    static inline constexpr int PATCH_SIZE = 48;
+
+    float evaluate_sharpness(const dl::image::img_t &img, const dl::detect::result_t &res);
+
+    const int m_size_ref;
+    const float m_sharpness_ref;
+    dl::image::ImageTransformer m_image_transformer;
+    uint8_t *m_patch;
+};
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,164 @@
+#include "who_face_recognizer.hpp"
+#include "esp_log.h"
+#include <algorithm>
+
+namespace who {
+namespace recognition {
+std::vector<face_index::WhoFaceIndex::result_t>
+WhoFaceRecognizer::recognize_all(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    std::vector<face_index::WhoFaceIndex::result_t> results;
+    results.reserve(detect_res.size());
+    for (const auto &face : detect_res) {
+        // recognize() only looks at the first face of the list.
+        auto ret = recognize(img, {face});
+        if (ret.empty()) {
+            results.push_back({-1, 0});
+        } else {
+            results.push_back({ret[0].id, ret[0].similarity});
+        }
+    }
+    return results;
+}
+
+std::vector<dl::recognition::result_t>
+WhoHumanFaceRecognizer::recognize(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    return m_recognizer->recognize(img, detect_res);
+}
+
+int WhoHumanFaceRecognizer::enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    if (m_recognizer->enroll(img, detect_res) == ESP_FAIL) {
+        return -1;
+    }
+    return m_recognizer->get_num_feats();
+}
+
+int WhoHumanFaceRecognizer::delete_last_feat()
+{
+    int id = m_recognizer->get_num_feats();
+    if (m_recognizer->delete_last_feat() == ESP_FAIL) {
+        return -1;
+    }
+    return id;
+}
+
+esp_err_t WhoHumanFaceRecognizer::clear_all_feats()
+{
+    return m_recognizer->clear_all_feats();
+}
+
+int WhoHumanFaceRecognizer::get_num_feats()
+{
+    return m_recognizer->get_num_feats();
+}
+
+WhoFaceDBRecognizer::WhoFaceDBRecognizer(HumanFaceFeat *feat, face_db::WhoFaceDB *db, float thr, int top_k) :
+    m_feat(feat),
+    m_db(db),
+    m_thr(thr),
+    m_top_k(top_k),
+    m_batch_feats((size_t)face_db::WhoFaceDB::MAX_BATCH * db->get_feat_len())
+{
+    // Every call fails if the db can't be opened, open() logs why.
+    m_db->open();
+}
+
+WhoFaceDBRecognizer::~WhoFaceDBRecognizer()
+{
+    delete m_feat;
+    delete m_db;
+}
+
+const float *WhoFaceDBRecognizer::run_feat(const dl::image::img_t &img, const dl::detect::result_t &face)
+{
+    dl::TensorBase *feat = m_feat->run(img, face.keypoint);
+    if (feat->get_size() != m_db->get_feat_len()) {
+        ESP_LOGE("WhoFaceDBRecognizer", "Feature len %d, db expects %d.", feat->get_size(), m_db->get_feat_len());
+        return nullptr;
+    }
+    return feat->get_element_ptr<float>();
+}
+
+std::vector<dl::recognition::result_t>
+WhoFaceDBRecognizer::recognize(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    std::vector<dl::recognition::result_t> ret;
+    const float *feat = detect_res.empty() ? nullptr : run_feat(img, detect_res.front());
+    if (!feat) {
+        return ret;
+    }
+    std::vector<face_index::WhoFaceIndex::result_t> results(m_top_k);
+    int n = m_db->search(feat, m_top_k, m_thr, results.data());
+    ret.resize(n);
+    for (int i = 0; i < n; i++) {
+        ret[i].id = results[i].id;
+        ret[i].similarity = results[i].similarity;
+    }
+    return ret;
+}
+
+std::vector<face_index::WhoFaceIndex::result_t>
+WhoFaceDBRecognizer::recognize_all(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    std::vector<face_index::WhoFaceIndex::result_t> results;
+    results.reserve(detect_res.size());
+    auto face = detect_res.begin();
+    while (face != detect_res.end()) {
+        // The model runs one face at a time, the search takes the whole batch.
+        int feat_len = m_db->get_feat_len();
+        int n = 0;
+        bool valid[face_db::WhoFaceDB::MAX_BATCH];
+        for (; n < face_db::WhoFaceDB::MAX_BATCH && face != detect_res.end(); n++, face++) {
+            const float *feat = run_feat(img, *face);
+            valid[n] = feat != nullptr;
+            if (feat) {
+                std::copy(feat, feat + feat_len, &m_batch_feats[n * feat_len]);
+            } else {
+                std::fill_n(&m_batch_feats[n * feat_len], feat_len, 0.f);
+            }
+        }
+        face_index::WhoFaceIndex::result_t batch[face_db::WhoFaceDB::MAX_BATCH];
+        m_db->search_batch(m_batch_feats.data(), n, m_thr, batch);
+        for (int i = 0; i < n; i++) {
+            results.push_back(valid[i] ? batch[i] : face_index::WhoFaceIndex::result_t{-1, 0});
+        }
+    }
+    return results;
+}
+
+int WhoFaceDBRecognizer::enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    const float *feat = detect_res.empty() ? nullptr : run_feat(img, detect_res.front());
+    return feat ? m_db->enroll(feat) : -1;
+}
+
+bool WhoFaceDBRecognizer::get_feat(const dl::image::img_t &img,
+                                   const std::list<dl::detect::result_t> &detect_res,
+                                   float *feat)
+{
+    const float *ret = detect_res.empty() ? nullptr : run_feat(img, detect_res.front());
+    if (!ret) {
+        return false;
+    }
+    std::copy(ret, ret + m_db->get_feat_len(), feat);
+    return true;
+}
+
+int WhoFaceDBRecognizer::delete_last_feat()
+{
+    return m_db->remove_last();
+}
+
+esp_err_t WhoFaceDBRecognizer::clear_all_feats()
+{
+    return m_db->clear_all() == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+int WhoFaceDBRecognizer::get_num_feats()
+{
+    return m_db->size();
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,83 @@
+#pragma once
+#include "human_face_recognition.hpp"
+#include "who_face_db.hpp"
+
+namespace who {
+namespace recognition {
+// What WhoRecognitionCore needs from a face recognizer, so the feature store can be swapped.
+class WhoFaceRecognizer {
+public:
+    virtual ~WhoFaceRecognizer() {}
+    virtual std::vector<dl::recognition::result_t> recognize(const dl::image::img_t &img,
+                                                             const std::list<dl::detect::result_t> &detect_res) = 0;
+    // Every face in detect_res order, id -1 for an unknown face. Runs recognize() on each face by default.
+    virtual std::vector<face_index::WhoFaceIndex::result_t> recognize_all(
+        const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res);
+    // Returns the enrolled id, or -1.
+    virtual int enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res) = 0;
+    // Returns the deleted id, or -1.
+    virtual int delete_last_feat() = 0;
+    virtual esp_err_t clear_all_feats() = 0;
+    virtual int get_num_feats() = 0;
+    // Feature level access for multi-shot enrollment, 0 if the recognizer has none.
+    virtual int get_feat_len() { return 0; }
+    // Feature of the first face, get_feat_len() floats.
+    virtual bool get_feat(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res, float *feat)
+    {
+        return false;
+    }
+    // Returns the enrolled id, or -1.
+    virtual int enroll_feat(const float *feat) { return -1; }
+};
+
+// face.db file on a file system, ids are 1 to get_num_feats().
+class WhoHumanFaceRecognizer : public WhoFaceRecognizer {
+public:
+    WhoHumanFaceRecognizer(HumanFaceRecognizer *recognizer) : m_recognizer(recognizer) {}
+    ~WhoHumanFaceRecognizer() { delete m_recognizer; }
+    std::vector<dl::recognition::result_t> recognize(const dl::image::img_t &img,
+                                                     const std::list<dl::detect::result_t> &detect_res) override;
+    int enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res) override;
+    int delete_last_feat() override;
+    esp_err_t clear_all_feats() override;
+    int get_num_feats() override;
+
+private:
+    HumanFaceRecognizer *m_recognizer;
+};
+
+// Features in a WhoFaceDB partition, searched in place.
+class WhoFaceDBRecognizer : public WhoFaceRecognizer {
+public:
+    // Both human_face_feat models output 512 features.
+    static inline constexpr int FEAT_LEN = 512;
+
+    // Takes ownership of feat and db, opens db.
+    WhoFaceDBRecognizer(HumanFaceFeat *feat, face_db::WhoFaceDB *db, float thr = 0.5, int top_k = 1);
+    ~WhoFaceDBRecognizer();
+    std::vector<dl::recognition::result_t> recognize(const dl::image::img_t &img,
+                                                     const std::list<dl::detect::result_t> &detect_res) override;
+    // Runs the feature model on each face, then matches all of them in one pass over the db.
+    std::vector<face_index::WhoFaceIndex::result_t> recognize_all(
+        const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res) override;
+    int enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res) override;
+    int delete_last_feat() override;
+    esp_err_t clear_all_feats() override;
+    int get_num_feats() override;
+    int get_feat_len() override { return m_db->get_feat_len(); }
+    bool get_feat(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res, float *feat) override;
+    int enroll_feat(const float *feat) override { return m_db->enroll(feat); }
+
+private:
+    // Feature of the face, nullptr if the model output doesn't fit the db.
+    const float *run_feat(const dl::image::img_t &img, const dl::detect::result_t &face);
+
+    HumanFaceFeat *m_feat;
+    face_db::WhoFaceDB *m_db;
+    const float m_thr;
+    const int m_top_k;
+    // WhoFaceDB::MAX_BATCH features for recognize_all().
+    std::vector<float> m_batch_feats;
+};
+} // namespace recognition
+} // namespace who
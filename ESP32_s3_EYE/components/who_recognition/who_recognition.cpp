@@ -1,22 +1,64 @@
 #include "who_recognition.hpp"
+#include <algorithm>
+#include <cmath>
 
 namespace who {
 namespace recognition {
 WhoRecognitionCore::WhoRecognitionCore(const std::string &name, detect::WhoDetect *detect) :
-    task::WhoTask(name), m_detect(detect)
+    task::WhoTask(name),
+    m_detect(detect),
+    m_recognizer(nullptr),
+    m_stats(name),
+    m_command_stats(name + "Commands"),
+    m_command_queue(xQueueCreate(COMMAND_QUEUE_LEN, sizeof(queued_command_t))),
+    m_next_seq(0),
+    m_command_seq(-1),
+    m_command_start_us(0),
+    m_queue_len(1),
+    m_free_jobs(nullptr),
+    m_job_queue(nullptr),
+    m_request(NO_REQUEST),
+    m_request_frame_us(0),
+    m_max_faces(1),
+    m_filter_enabled(false),
+    m_filter(),
+    m_filter_deferred(0),
+    m_quality(nullptr),
+    m_enroll_frames(1),
+    m_enroll_best(1),
+    m_enroll_min_quality(0),
+    m_enroll_seen(0),
+    m_enroll_faces(0),
+    m_enroll_kept(0)
 {
 }
 
 WhoRecognitionCore::~WhoRecognitionCore()
 {
+    if (m_job_queue) {
+        vQueueDelete(m_job_queue);
+        vQueueDelete(m_free_jobs);
+    }
+    vQueueDelete(m_command_queue);
     delete m_recognizer;
+    delete m_quality;
 }
 
-void WhoRecognitionCore::set_recognizer(HumanFaceRecognizer *recognizer)
+void WhoRecognitionCore::set_recognizer(WhoFaceRecognizer *recognizer)
 {
     m_recognizer = recognizer;
 }
 
+void WhoRecognitionCore::set_recognizer(HumanFaceRecognizer *recognizer)
+{
+    m_recognizer = new WhoHumanFaceRecognizer(recognizer);
+}
+
+void WhoRecognitionCore::set_result_cb(const std::function<void(const result_t &)> &result_cb)
+{
+    m_result_cb = result_cb;
+}
+
 void WhoRecognitionCore::set_recognition_result_cb(const std::function<void(const std::string &)> &result_cb)
 {
     m_recognition_result_cb = result_cb;
@@ -32,6 +74,51 @@ void WhoRecognitionCore::set_cleanup_func(const std::function<void()> &cleanup_f
     m_cleanup = cleanup_func;
 }
 
+void WhoRecognitionCore::set_enroll_session(int num_frames, int num_best, float min_quality)
+{
+    m_enroll_frames = std::max(num_frames, 1);
+    m_enroll_best = std::clamp(num_best, 1, m_enroll_frames);
+    m_enroll_min_quality = min_quality;
+    if (m_enroll_frames > 1 && !m_quality) {
+        m_quality = new WhoFaceQuality();
+    }
+}
+
+void WhoRecognitionCore::set_max_faces(int max_faces)
+{
+    m_max_faces = std::clamp(max_faces, 1, MAX_FACES);
+}
+
+void WhoRecognitionCore::set_queue_len(int queue_len)
+{
+    m_queue_len = std::max(queue_len, 1);
+}
+
+void WhoRecognitionCore::set_face_filter(const face_filter_t &filter)
+{
+    m_filter = filter;
+    m_filter_enabled = true;
+    if (!m_quality) {
+        m_quality = new WhoFaceQuality();
+    }
+}
+
+int WhoRecognitionCore::send_command(command_t command, const struct timeval *frame)
+{
+    queued_command_t queued = {.command = command,
+                               .seq = m_next_seq.fetch_add(1) & SEQ_MASK,
+                               .frame_us = frame ? frame->tv_sec * 1000000LL + frame->tv_usec : 0,
+                               .sent_us = stats::WhoStats::now_us()};
+    m_command_stats.frame_in();
+    if (xQueueSend(m_command_queue, &queued, 0) != pdTRUE) {
+        ESP_LOGW("WhoRecognitionCore", "Command queue full, drop the command.");
+        m_command_stats.frame_dropped();
+        return -1;
+    }
+    xEventGroupSetBits(m_event_group, NEW_COMMAND);
+    return queued.seq;
+}
+
 bool WhoRecognitionCore::run(const configSTACK_DEPTH_TYPE uxStackDepth,
                              UBaseType_t uxPriority,
                              const BaseType_t xCoreID)
@@ -40,17 +127,404 @@ bool WhoRecognitionCore::run(const configSTACK_DEPTH_TYPE uxStackDepth,
         ESP_LOGE("WhoRecognitionCore", "recognizer is nullptr, please call set_recognizer() first.");
         return false;
     }
-    return task::WhoTask::run(uxStackDepth, uxPriority, xCoreID);
+    if (!m_job_queue) {
+        m_jobs.resize(m_queue_len + 1);
+        m_free_jobs = xQueueCreate(m_jobs.size(), sizeof(job_t *));
+        m_job_queue = xQueueCreate(m_queue_len, sizeof(job_t *));
+        for (auto &job : m_jobs) {
+            job_t *ptr = &job;
+            xQueueSend(m_free_jobs, &ptr, 0);
+        }
+    }
+    if (!task::WhoTask::run(uxStackDepth, uxPriority, xCoreID)) {
+        return false;
+    }
+    m_detect->set_detect_result_cb(std::bind(&WhoRecognitionCore::on_detect_result, this, std::placeholders::_1));
+    return true;
+}
+
+void WhoRecognitionCore::on_detect_result(const detect::WhoDetect::result_t &result)
+{
+    // The app tags the faces with their track ids first.
+    if (m_detect_result_cb) {
+        m_detect_result_cb(result);
+    }
+    int request = m_request.load();
+    int64_t frame_us = m_request_frame_us.load();
+    int64_t timestamp_us = result.timestamp.tv_sec * 1000000LL + result.timestamp.tv_usec;
+    // Skip frames older than the command, and this one if the next command started while the tag was read.
+    if (timestamp_us < frame_us || m_request.load() != request) {
+        request = NO_REQUEST;
+    }
+    int type = request & 3;
+    int seq = request >> 2;
+    std::list<dl::detect::result_t> faces;
+    std::vector<int> track_ids;
+    if (type == RECOGNIZE_REQUEST) {
+        select_faces(result, faces, track_ids);
+    } else if (type == ENROLL_REQUEST) {
+        faces = result.det_res;
+        track_ids = m_track_ids;
+        track_ids.resize(faces.size(), -1);
+    }
+    m_track_ids.clear();
+    if (type == NO_REQUEST) {
+        return;
+    }
+    if (type == RECOGNIZE_REQUEST && faces.empty() && m_filter_enabled) {
+        // Wait for a better frame instead of running the feature model on this one.
+        m_stats.frame_skipped();
+        if (++m_filter_deferred >= m_filter.max_defer_frames &&
+            queue_job(SKIP_RESULT, seq, result, faces, track_ids)) {
+            finish_request(request);
+        }
+        return;
+    }
+    m_stats.frame_in();
+    if (!queue_job(type == RECOGNIZE_REQUEST ? RECOGNIZE_RESULT : ENROLL_RESULT, seq, result, faces, track_ids)) {
+        // Recognition still busy with the frames before, try again with the next one.
+        m_stats.frame_dropped();
+        return;
+    }
+    if (type == RECOGNIZE_REQUEST || m_enroll_frames == 1) {
+        finish_request(request);
+    }
+}
+
+bool WhoRecognitionCore::queue_job(result_type_t type,
+                                   int seq,
+                                   const detect::WhoDetect::result_t &result,
+                                   std::list<dl::detect::result_t> &faces,
+                                   std::vector<int> &track_ids)
+{
+    job_t *job;
+    if (xQueueReceive(m_free_jobs, &job, 0) != pdTRUE) {
+        return false;
+    }
+    job->fb = nullptr;
+    if (type != SKIP_RESULT && !faces.empty()) {
+        job->fb = m_detect->lease_frame();
+        if (!job->fb) {
+            xQueueSend(m_free_jobs, &job, 0);
+            return false;
+        }
+    }
+    job->type = type;
+    job->seq = seq;
+    job->img = result.img;
+    job->timestamp = result.timestamp;
+    job->faces.swap(faces);
+    job->track_ids.swap(track_ids);
+    // There are more jobs than queue slots, so a free job always fits.
+    xQueueSend(m_job_queue, &job, 0);
+    xEventGroupSetBits(m_event_group, NEW_JOB);
+    return true;
+}
+
+void WhoRecognitionCore::finish_request(int request)
+{
+    m_filter_deferred = 0;
+    // Don't clear a request which replaced this one meanwhile.
+    m_request.compare_exchange_strong(request, NO_REQUEST);
+}
+
+void WhoRecognitionCore::start_command(const queued_command_t &command)
+{
+    m_command_seq = command.seq;
+    m_command_start_us = stats::WhoStats::now_us();
+    m_command_stats.observe_queue_wait(m_command_start_us - command.sent_us);
+    switch (command.command) {
+    case RECOGNIZE:
+    case ENROLL: {
+        request_t type = command.command == RECOGNIZE ? RECOGNIZE_REQUEST : ENROLL_REQUEST;
+        if (type == ENROLL_REQUEST && m_enroll_frames > 1) {
+            start_enroll_session();
+        }
+        // The tag first, the detect task reads it after the request.
+        m_request_frame_us = command.frame_us;
+        m_request = (command.seq << 2) | type;
+        break;
+    }
+    case DELETE: {
+        int id = m_recognizer->delete_last_feat();
+        result_t res = make_result(DELETE_RESULT, nullptr);
+        res.ok = id >= 0;
+        res.id = id;
+        finish_command(res);
+        break;
+    }
+    case CLEAR_ALL: {
+        esp_err_t ret = m_recognizer->clear_all_feats();
+        result_t res = make_result(CLEAR_ALL_RESULT, nullptr);
+        res.ok = ret != ESP_FAIL;
+        finish_command(res);
+        break;
+    }
+    }
+}
+
+void WhoRecognitionCore::finish_command(result_t &result)
+{
+    result.seq = m_command_seq;
+    m_request = NO_REQUEST;
+    m_command_seq = -1;
+    send_result(result);
+    m_command_stats.observe_process_time(stats::WhoStats::now_us() - m_command_start_us);
+    m_command_stats.frame_out();
+}
+
+void WhoRecognitionCore::drain_commands()
+{
+    queued_command_t command;
+    while (xQueueReceive(m_command_queue, &command, 0) == pdTRUE) {
+        m_command_stats.frame_dropped();
+    }
+}
+
+void WhoRecognitionCore::process_job(job_t *job)
+{
+    if (job->seq != m_command_seq) {
+        // Queued for an enroll session which is over already.
+        m_stats.frame_dropped();
+        return;
+    }
+    if (job->type == SKIP_RESULT) {
+        result_t res = make_result(SKIP_RESULT, job);
+        finish_command(res);
+        return;
+    }
+    int64_t start = stats::WhoStats::now_us();
+    if (job->type == RECOGNIZE_RESULT) {
+        auto matches = m_recognizer->recognize_all(job->img, job->faces);
+        observe_frame(*job, start, stats::WhoStats::now_us());
+        result_t res = make_result(RECOGNIZE_RESULT, job, matches);
+        finish_command(res);
+        return;
+    }
+    int id;
+    if (m_enroll_frames == 1) {
+        id = m_recognizer->enroll(job->img, job->faces);
+    } else if (!add_enroll_frame(*job, id)) {
+        observe_frame(*job, start, stats::WhoStats::now_us());
+        return;
+    }
+    observe_frame(*job, start, stats::WhoStats::now_us());
+    result_t res = make_result(ENROLL_RESULT, job);
+    res.ok = id >= 0;
+    res.id = id;
+    finish_command(res);
+}
+
+void WhoRecognitionCore::recycle_job(job_t *job)
+{
+    if (job->fb) {
+        m_detect->release_frame(job->fb);
+        job->fb = nullptr;
+    }
+    job->faces.clear();
+    job->track_ids.clear();
+    xQueueSend(m_free_jobs, &job, 0);
+}
+
+void WhoRecognitionCore::drain_jobs()
+{
+    job_t *job;
+    while (xQueueReceive(m_job_queue, &job, 0) == pdTRUE) {
+        if (job->type != SKIP_RESULT) {
+            m_stats.frame_dropped();
+        }
+        recycle_job(job);
+    }
+}
+
+void WhoRecognitionCore::observe_frame(const job_t &job, int64_t start, int64_t end)
+{
+    // The wait includes detection and the time in the queue.
+    m_stats.observe_queue_wait(start - (job.timestamp.tv_sec * 1000000LL + job.timestamp.tv_usec));
+    m_stats.observe_process_time(end - start);
+    m_stats.frame_out();
+}
+
+WhoRecognitionCore::result_t WhoRecognitionCore::make_result(result_type_t type,
+                                                             const job_t *job,
+                                                             const std::vector<match_t> &matches)
+{
+    result_t result = {.type = type,
+                       .seq = -1,
+                       .ok = false,
+                       .id = -1,
+                       .similarity = 0,
+                       .track_id = -1,
+                       .timestamp = {},
+                       .box = {},
+                       .num_faces = 0,
+                       .faces = {}};
+    if (!job) {
+        return result;
+    }
+    auto copy_box = [](const dl::detect::result_t &det, int *box) {
+        std::copy(det.box.begin(), det.box.begin() + 4, box);
+    };
+    result.timestamp = job->timestamp;
+    if (!job->faces.empty()) {
+        result.track_id = job->track_ids[0];
+        copy_box(job->faces.front(), result.box);
+    }
+    result.num_faces = std::min<int>({(int)matches.size(), (int)job->faces.size(), MAX_FACES});
+    auto it = job->faces.begin();
+    for (int i = 0; i < result.num_faces; i++, it++) {
+        face_t &face = result.faces[i];
+        face.id = matches[i].id;
+        face.similarity = matches[i].similarity;
+        face.track_id = job->track_ids[i];
+        copy_box(*it, face.box);
+    }
+    if (result.num_faces > 0) {
+        result.ok = result.faces[0].id >= 0;
+        result.id = result.faces[0].id;
+        result.similarity = result.ok ? result.faces[0].similarity : 0;
+    }
+    return result;
+}
+
+void WhoRecognitionCore::send_result(const result_t &result)
+{
+    if (m_result_cb) {
+        m_result_cb(result);
+    }
+    // Only format when someone displays it.
+    if (m_recognition_result_cb) {
+        m_recognition_result_cb(to_string(result));
+    }
+}
+
+std::string WhoRecognitionCore::to_string(const result_t &result)
+{
+    switch (result.type) {
+    case RECOGNIZE_RESULT: {
+        if (result.num_faces <= 1) {
+            return result.ok ? std::format("id: {}, sim: {:.2f}", result.id, result.similarity) : "who?";
+        }
+        // One line per face.
+        std::string text;
+        for (int i = 0; i < result.num_faces; i++) {
+            const face_t &face = result.faces[i];
+            text += i ? "\n" : "";
+            text += face.id >= 0 ? std::format("id: {}, sim: {:.2f}", face.id, face.similarity) : "who?";
+        }
+        return text;
+    }
+    case ENROLL_RESULT:
+        return result.ok ? std::format("id: {} enrolled.", result.id) : "Failed to enroll.";
+    case DELETE_RESULT:
+        return result.ok ? std::format("id: {} deleted.", result.id) : "Failed to delete.";
+    case CLEAR_ALL_RESULT:
+        return result.ok ? "all faces deleted." : "Failed to delete all.";
+    case SKIP_RESULT:
+        return "Face the camera.";
+    }
+    return {};
+}
+
+void WhoRecognitionCore::start_enroll_session()
+{
+    int feat_len = m_recognizer->get_feat_len();
+    m_enroll_feats.resize((size_t)m_enroll_best * feat_len);
+    m_enroll_scores.resize(m_enroll_best);
+    m_enroll_seen = 0;
+    m_enroll_faces = 0;
+    m_enroll_kept = 0;
+}
+
+bool WhoRecognitionCore::add_enroll_frame(const job_t &job, int &id)
+{
+    id = -1;
+    m_enroll_seen++;
+    if (!job.faces.empty()) {
+        m_enroll_faces++;
+        auto quality = m_quality->evaluate(job.img, job.faces.front());
+        if (quality.score >= m_enroll_min_quality) {
+            int feat_len = m_recognizer->get_feat_len();
+            if (feat_len == 0) {
+                // Nothing to average, the first good frame is the template.
+                id = m_recognizer->enroll(job.img, job.faces);
+                return true;
+            }
+            // Replace the worst kept frame once all slots are used.
+            int slot = m_enroll_kept;
+            if (slot == m_enroll_best) {
+                slot = std::min_element(m_enroll_scores.begin(), m_enroll_scores.end()) - m_enroll_scores.begin();
+                if (quality.score <= m_enroll_scores[slot]) {
+                    slot = -1;
+                }
+            }
+            if (slot >= 0 && m_recognizer->get_feat(job.img, job.faces, &m_enroll_feats[slot * feat_len])) {
+                m_enroll_scores[slot] = quality.score;
+                m_enroll_kept = std::max(m_enroll_kept, slot + 1);
+            }
+        }
+    }
+    // Don't wait forever for a face, give up after a few times the frames asked for.
+    if (m_enroll_faces < m_enroll_frames && m_enroll_seen < m_enroll_frames * 4) {
+        return false;
+    }
+    id = enroll_average();
+    return true;
+}
+
+int WhoRecognitionCore::enroll_average()
+{
+    if (m_enroll_kept == 0) {
+        ESP_LOGW("WhoRecognitionCore", "No face good enough to enroll.");
+        return -1;
+    }
+    // Average the normalized features, so every frame has the same weight.
+    int feat_len = m_recognizer->get_feat_len();
+    float *avg = m_enroll_feats.data();
+    for (int k = 0; k < m_enroll_kept; k++) {
+        float *feat = &m_enroll_feats[k * feat_len];
+        float norm = 0;
+        for (int i = 0; i < feat_len; i++) {
+            norm += feat[i] * feat[i];
+        }
+        float inv_norm = norm > 0 ? 1.f / std::sqrt(norm) : 0;
+        for (int i = 0; i < feat_len; i++) {
+            avg[i] = k == 0 ? feat[i] * inv_norm : avg[i] + feat[i] * inv_norm;
+        }
+    }
+    return m_recognizer->enroll_feat(avg);
+}
+
+bool WhoRecognitionCore::passes_face_filter(const dl::detect::result_t &face)
+{
+    if (!m_filter_enabled) {
+        return true;
+    }
+    // Keypoints and box only, this costs nothing next to a feature model run.
+    auto quality = m_quality->evaluate_geometry(face);
+    return quality.box_area >= m_filter.min_box_area && quality.eye_dist >= m_filter.min_eye_dist &&
+        quality.yaw <= m_filter.max_yaw;
+}
+
+void WhoRecognitionCore::select_faces(const detect::WhoDetect::result_t &result,
+                                      std::list<dl::detect::result_t> &faces,
+                                      std::vector<int> &track_ids)
+{
+    int index = 0;
+    for (auto it = result.det_res.begin(); it != result.det_res.end() && (int)faces.size() < m_max_faces;
+         it++, index++) {
+        if (passes_face_filter(*it)) {
+            faces.push_back(*it);
+            track_ids.push_back(index < (int)m_track_ids.size() ? m_track_ids[index] : -1);
+        }
+    }
 }
 
 void WhoRecognitionCore::task()
 {
     while (true) {
-        EventBits_t event_bits = xEventGroupWaitBits(m_event_group,
-                                                     RECOGNIZE | ENROLL | DELETE | CLEAR_ALL | TASK_PAUSE | TASK_STOP,
-                                                     pdTRUE,
-                                                     pdFALSE,
-                                                     portMAX_DELAY);
+        EventBits_t event_bits = xEventGroupWaitBits(
+            m_event_group, NEW_JOB | NEW_COMMAND | TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
         if (event_bits & TASK_STOP) {
             break;
         } else if (event_bits & TASK_PAUSE) {
@@ -60,65 +534,30 @@ void WhoRecognitionCore::task()
             if (pause_event_bits & TASK_STOP) {
                 break;
             } else {
-                continue;
-            }
-        }
-        if (event_bits & RECOGNIZE) {
-            auto new_detect_result_cb = [this](const detect::WhoDetect::result_t &result) {
-                auto ret = m_recognizer->recognize(result.img, result.det_res);
-                if (m_detect_result_cb) {
-                    m_detect_result_cb(result);
+                // The pause cleared the bits of jobs and commands queued before or meanwhile.
+                if (uxQueueMessagesWaiting(m_job_queue)) {
+                    xEventGroupSetBits(m_event_group, NEW_JOB);
                 }
-                if (m_recognition_result_cb) {
-                    if (ret.empty()) {
-                        m_recognition_result_cb("who?");
-                    } else {
-                        m_recognition_result_cb(std::format("id: {}, sim: {:.2f}", ret[0].id, ret[0].similarity));
-                    }
-                }
-                m_detect->set_detect_result_cb(m_detect_result_cb);
-            };
-            m_detect->set_detect_result_cb(new_detect_result_cb);
-            continue;
-        }
-        if (event_bits & ENROLL) {
-            auto new_detect_result_cb = [this](const detect::WhoDetect::result_t &result) {
-                esp_err_t ret = m_recognizer->enroll(result.img, result.det_res);
-                if (m_detect_result_cb) {
-                    m_detect_result_cb(result);
-                }
-                if (m_recognition_result_cb) {
-                    if (ret == ESP_FAIL) {
-                        m_recognition_result_cb("Failed to enroll.");
-                    } else {
-                        m_recognition_result_cb(std::format("id: {} enrolled.", m_recognizer->get_num_feats()));
-                    }
-                }
-                m_detect->set_detect_result_cb(m_detect_result_cb);
-            };
-            m_detect->set_detect_result_cb(new_detect_result_cb);
-            continue;
-        }
-        if (event_bits & DELETE) {
-            esp_err_t ret = m_recognizer->delete_last_feat();
-            if (m_recognition_result_cb) {
-                if (ret == ESP_FAIL) {
-                    m_recognition_result_cb("Failed to delete.");
-                } else {
-                    m_recognition_result_cb(std::format("id: {} deleted.", m_recognizer->get_num_feats() + 1));
+                if (uxQueueMessagesWaiting(m_command_queue)) {
+                    xEventGroupSetBits(m_event_group, NEW_COMMAND);
                 }
+                continue;
             }
         }
-        if (event_bits & CLEAR_ALL) {
-            esp_err_t ret = m_recognizer->clear_all_feats();
-            if (m_recognition_result_cb) {
-                if (ret == ESP_FAIL) {
-                    m_recognition_result_cb("Failed to delete all.");
-                } else {
-                    m_recognition_result_cb("all faces deleted.");
-                }
+        if (event_bits & NEW_JOB) {
+            job_t *job;
+            while (xQueueReceive(m_job_queue, &job, 0) == pdTRUE) {
+                process_job(job);
+                recycle_job(job);
             }
         }
+        // One command at a time, the others wait in the queue until the running one has its result. A new command
+        // never replaces a pending request, e.g. a recognize must not drop a single frame enroll.
+        queued_command_t command;
+        while (m_command_seq < 0 && m_request.load() == NO_REQUEST &&
+               xQueueReceive(m_command_queue, &command, 0) == pdTRUE) {
+            start_command(command);
+        }
     }
     xEventGroupSetBits(m_event_group, TASK_STOPPED);
     vTaskDelete(NULL);
@@ -126,6 +565,18 @@ void WhoRecognitionCore::task()
 
 void WhoRecognitionCore::cleanup()
 {
+    // Queued frames and commands are kept over a pause, only a stop drops them.
+    if (xEventGroupGetBits(m_event_group) & TASK_STOPPED) {
+        // Takes the result callback mutex of the detect task, so nothing is queued any more once it returns.
+        m_detect->set_detect_result_cb(m_detect_result_cb);
+        m_request = NO_REQUEST;
+        drain_jobs();
+        if (m_command_seq >= 0) {
+            m_command_stats.frame_dropped();
+            m_command_seq = -1;
+        }
+        drain_commands();
+    }
     if (m_cleanup) {
         m_cleanup();
     }
@@ -149,6 +600,11 @@ void WhoRecognition::set_detect_model(dl::detect::Detect *model)
     m_detect->set_model(model);
 }
 
+void WhoRecognition::set_recognizer(WhoFaceRecognizer *recognizer)
+{
+    m_recognition->set_recognizer(recognizer);
+}
+
 void WhoRecognition::set_recognizer(HumanFaceRecognizer *recognizer)
 {
     m_recognition->set_recognizer(recognizer);
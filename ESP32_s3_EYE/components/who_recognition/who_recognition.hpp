@@ -1,32 +1,219 @@
 #pragma once
-#include "human_face_recognition.hpp"
 #include "who_detect.hpp"
+#include "who_face_quality.hpp"
+#include "who_face_recognizer.hpp"
+#include <atomic>
 
 namespace who {
 namespace recognition {
 class WhoRecognitionCore : public task::WhoTask {
 public:
-    static inline constexpr EventBits_t RECOGNIZE = TASK_EVENT_BIT_LAST;
-    static inline constexpr EventBits_t ENROLL = TASK_EVENT_BIT_LAST << 1;
-    static inline constexpr EventBits_t DELETE = TASK_EVENT_BIT_LAST << 2; // delete last
-    static inline constexpr EventBits_t CLEAR_ALL = TASK_EVENT_BIT_LAST << 3; // delete all faces
+    static inline constexpr int MAX_FACES = 4;
+    static inline constexpr int COMMAND_QUEUE_LEN = 8;
+
+    typedef enum {
+        RECOGNIZE,
+        ENROLL,
+        DELETE, // delete last
+        CLEAR_ALL, // delete all faces
+    } command_t;
+
+    typedef enum {
+        RECOGNIZE_RESULT,
+        ENROLL_RESULT,
+        DELETE_RESULT,
+        CLEAR_ALL_RESULT,
+        // A recognize request given up because no face passed the face filter, nothing was recognized.
+        SKIP_RESULT,
+    } result_type_t;
+
+    // Faces which would give a poor feature, they are not sent to the feature model.
+    typedef struct {
+        int min_box_area;
+        // Pixels between the eye keypoints.
+        int min_eye_dist;
+        // Nose offset from the eye midpoint relative to the eye distance, about sin(yaw) / 2 for a head turned by
+        // yaw.
+        float max_yaw;
+        // Frames to wait for a usable face before a recognize request ends with SKIP_RESULT.
+        int max_defer_frames;
+    } face_filter_t;
+
+    typedef struct {
+        // -1 if the face is unknown.
+        int id;
+        float similarity;
+        int track_id;
+        int box[4];
+    } face_t;
+
+    typedef struct {
+        result_type_t type;
+        // Sequence number of the command this result ends, see send_command().
+        int seq;
+        // Recognize: the face is known. Others: the request succeeded.
+        bool ok;
+        // Matched, enrolled or deleted id, -1 if there is none.
+        int id;
+        float similarity;
+        // Set with set_track_id() for the recognized frame, -1 otherwise.
+        int track_id;
+        // Frame and first face box of recognize and enroll, zero for delete and clear all.
+        struct timeval timestamp;
+        int box[4];
+        // Recognize: every recognized face of the frame in detect order, the fields above repeat faces[0].
+        int num_faces;
+        face_t faces[MAX_FACES];
+    } result_t;
 
     WhoRecognitionCore(const std::string &name, detect::WhoDetect *detect);
     ~WhoRecognitionCore();
+    // Takes ownership of the recognizer.
+    void set_recognizer(WhoFaceRecognizer *recognizer);
     void set_recognizer(HumanFaceRecognizer *recognizer);
+    // Typed result, nothing is allocated or formatted for it.
+    void set_result_cb(const std::function<void(const result_t &)> &result_cb);
+    // Text result for display, the same text as to_string().
     void set_recognition_result_cb(const std::function<void(const std::string &)> &result_cb);
     void set_detect_result_cb(const std::function<void(const detect::WhoDetect::result_t &)> &result_cb);
     void set_cleanup_func(const std::function<void()> &cleanup_func);
+    // Enroll from several frames instead of the next one. Of the next num_frames frames with a face, up to num_best
+    // with a WhoFaceQuality score of at least min_quality are kept and their averaged feature is enrolled. Without
+    // feature access in the recognizer the first frame over min_quality is enrolled. Call before run().
+    void set_enroll_session(int num_frames, int num_best, float min_quality);
+    // Recognize up to max_faces faces of a frame in one batch instead of the first one only. Call before run().
+    void set_max_faces(int max_faces);
+    // Check every face of a frame before recognizing it. Filtered frames are counted as skipped in the stats.
+    // Call before run().
+    void set_face_filter(const face_filter_t &filter);
+    // Recognize and enroll requests take the next frames from the detect task through a queue of queue_len jobs, so
+    // detection goes on while recognition runs, also on the other core. A queued frame stays leased from the frame cap
+    // node, keep it short. Frames arriving while the queue is full are counted as dropped. Call before run().
+    void set_queue_len(int queue_len);
+    // Call from the detect result callback to tag the frame which is about to be recognized or enrolled, one id per
+    // face in det_res order.
+    void set_track_ids(const std::vector<int> &track_ids) { m_track_ids = track_ids; }
+    void set_track_id(int track_id) { m_track_ids.assign(1, track_id); }
+    // Queue a command, from any task. Commands run one after the other in order and each one ends with exactly one
+    // result. RECOGNIZE and ENROLL take the first frame detected at or after frame, pass the timestamp of a detect
+    // result to start with that frame, nullptr for the next one. Returns the sequence number of the command, or -1 if
+    // COMMAND_QUEUE_LEN commands are waiting already.
+    int send_command(command_t command, const struct timeval *frame = nullptr);
+    static std::string to_string(const result_t &result);
     bool run(const configSTACK_DEPTH_TYPE uxStackDepth, UBaseType_t uxPriority, const BaseType_t xCoreID) override;
+    stats::WhoStats &get_stats() { return m_stats; }
+    // Commands: sent, dropped because the queue was full or at stop, and done. The queue wait is the time from
+    // send_command() to the start of the command, the process time from there to the result.
+    stats::WhoStats &get_command_stats() { return m_command_stats; }
 
 private:
+    // Set by the detect task when it queued a job.
+    static inline constexpr EventBits_t NEW_JOB = TASK_EVENT_BIT_LAST;
+    static inline constexpr EventBits_t NEW_COMMAND = TASK_EVENT_BIT_LAST << 1;
+    static inline constexpr int SEQ_MASK = 0x1fffffff;
+
+    // The detect task only sees the recognize or enroll command being run, packed with its sequence number.
+    typedef enum {
+        NO_REQUEST,
+        RECOGNIZE_REQUEST,
+        ENROLL_REQUEST,
+    } request_t;
+
+    typedef struct {
+        command_t command;
+        int seq;
+        // RECOGNIZE and ENROLL skip older frames.
+        int64_t frame_us;
+        int64_t sent_us;
+    } queued_command_t;
+
+    // A frame handed over from the detect task.
+    typedef struct {
+        // RECOGNIZE_RESULT, ENROLL_RESULT, or SKIP_RESULT to only send the result of a given up request.
+        result_type_t type;
+        // Command the frame was queued for.
+        int seq;
+        // Leased from the frame cap node of the detect task, nullptr if there is no face to look at.
+        cam::cam_fb_t *fb;
+        dl::image::img_t img;
+        struct timeval timestamp;
+        // Faces to recognize or enroll from in det_res order, and their track ids.
+        std::list<dl::detect::result_t> faces;
+        std::vector<int> track_ids;
+    } job_t;
+
     void task() override;
     void cleanup() override;
+    // Runs on the detect task in place of the detect result callback, queues a job for the pending request.
+    void on_detect_result(const detect::WhoDetect::result_t &result);
+    bool queue_job(result_type_t type,
+                   int seq,
+                   const detect::WhoDetect::result_t &result,
+                   std::list<dl::detect::result_t> &faces,
+                   std::vector<int> &track_ids);
+    void finish_request(int request);
+    void start_command(const queued_command_t &command);
+    // Send the result of the running command, the next command may start then.
+    void finish_command(result_t &result);
+    void drain_commands();
+    void process_job(job_t *job);
+    void recycle_job(job_t *job);
+    void drain_jobs();
+    void observe_frame(const job_t &job, int64_t start, int64_t end);
+    typedef face_index::WhoFaceIndex::result_t match_t;
+    // matches are the matches of the job's faces.
+    result_t make_result(result_type_t type, const job_t *job, const std::vector<match_t> &matches = {});
+    void send_result(const result_t &result);
+    void start_enroll_session();
+    // Returns true when the session is over, id is the enrolled id or -1.
+    bool add_enroll_frame(const job_t &job, int &id);
+    int enroll_average();
+    bool passes_face_filter(const dl::detect::result_t &face);
+    // Faces to recognize and their track ids.
+    void select_faces(const detect::WhoDetect::result_t &result,
+                      std::list<dl::detect::result_t> &faces,
+                      std::vector<int> &track_ids);
     detect::WhoDetect *m_detect;
-    HumanFaceRecognizer *m_recognizer;
+    WhoFaceRecognizer *m_recognizer;
     std::function<void(const detect::WhoDetect::result_t &)> m_detect_result_cb;
+    std::function<void(const result_t &)> m_result_cb;
     std::function<void(const std::string &)> m_recognition_result_cb;
     std::function<void()> m_cleanup;
+    stats::WhoStats m_stats;
+    stats::WhoStats m_command_stats;
+    QueueHandle_t m_command_queue;
+    std::atomic<int> m_next_seq;
+    // Sequence number of the running command, -1 if none. Only touched by this task.
+    int m_command_seq;
+    int64_t m_command_start_us;
+    // Track ids of the current frame, only touched by the detect task.
+    std::vector<int> m_track_ids;
+    int m_queue_len;
+    // queue_len + 1 jobs, one of them may be processed while the queue is full.
+    std::vector<job_t> m_jobs;
+    QueueHandle_t m_free_jobs;
+    QueueHandle_t m_job_queue;
+    // Set by this task, cleared by the detect task once the request's frame is queued. An enroll session keeps
+    // queueing frames until this task ends it.
+    std::atomic<int> m_request;
+    std::atomic<int64_t> m_request_frame_us;
+    int m_max_faces;
+    bool m_filter_enabled;
+    face_filter_t m_filter;
+    // Frames filtered for the pending recognize request, only touched by the detect task.
+    int m_filter_deferred;
+    // Shared by the enroll session and the face filter.
+    WhoFaceQuality *m_quality;
+    int m_enroll_frames;
+    int m_enroll_best;
+    float m_enroll_min_quality;
+    // Enroll session state, only touched by this task.
+    int m_enroll_seen;
+    int m_enroll_faces;
+    int m_enroll_kept;
+    // m_enroll_best features and their scores.
+    std::vector<float> m_enroll_feats;
+    std::vector<float> m_enroll_scores;
 };
 
 class WhoRecognition : public task::WhoTaskGroup {
@@ -34,6 +221,7 @@ public:
     WhoRecognition(frame_cap::WhoFrameCapNode *frame_cap_node);
     ~WhoRecognition();
     void set_detect_model(dl::detect::Detect *model);
+    void set_recognizer(WhoFaceRecognizer *recognizer);
     void set_recognizer(HumanFaceRecognizer *recognizer);
     detect::WhoDetect *get_detect_task();
     WhoRecognitionCore *get_recognition_task();
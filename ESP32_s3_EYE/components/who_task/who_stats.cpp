@@ -0,0 +1,185 @@
+#include "who_stats.hpp"
+#include "esp_log.h"
+#include <cinttypes>
+#include <cstdio>
+
+static const char *TAG = "WhoStats";
+
+namespace who {
+namespace stats {
+std::atomic<WhoStats *> WhoStats::s_registry[MAX_STATS] = {};
+
+WhoStats::Histogram::Histogram() : m_sum_us(0)
+{
+    for (int i = 0; i < NUM_BUCKETS + 1; i++) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void WhoStats::Histogram::observe(uint32_t us)
+{
+    int i = 0;
+    while (i < NUM_BUCKETS && us > BUCKET_BOUNDS_US[i]) {
+        i++;
+    }
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+WhoStats::WhoStats(const std::string &name) :
+    m_name(name),
+    m_frames_in(0),
+    m_frames_out(0),
+    m_frames_dropped(0),
+    m_frames_skipped(0),
+    m_last_log_us(now_us()),
+    m_last_frames_in(0),
+    m_last_frames_out(0),
+    m_last_frames_dropped(0)
+{
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *expected = nullptr;
+        if (s_registry[i].compare_exchange_strong(expected, this)) {
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Too many stats, %s will not be exported.", name.c_str());
+}
+
+WhoStats::~WhoStats()
+{
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *expected = this;
+        if (s_registry[i].compare_exchange_strong(expected, nullptr)) {
+            return;
+        }
+    }
+}
+
+void WhoStats::write_counter(const std::function<void(const char *, size_t)> &write,
+                             const char *metric,
+                             const char *help,
+                             std::atomic<uint32_t> WhoStats::*counter)
+{
+    char line[160];
+    int len = snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n", metric, help, metric);
+    write(line, len);
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *stats = s_registry[i].load();
+        if (!stats) {
+            continue;
+        }
+        len = snprintf(line,
+                       sizeof(line),
+                       "%s{node=\"%s\"} %" PRIu32 "\n",
+                       metric,
+                       stats->m_name.c_str(),
+                       (stats->*counter).load(std::memory_order_relaxed));
+        write(line, len);
+    }
+}
+
+void WhoStats::write_histogram(const std::function<void(const char *, size_t)> &write,
+                               const char *metric,
+                               const char *help,
+                               Histogram WhoStats::*histogram)
+{
+    char line[160];
+    int len = snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", metric, help, metric);
+    write(line, len);
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *stats = s_registry[i].load();
+        if (!stats) {
+            continue;
+        }
+        const char *name = stats->m_name.c_str();
+        Histogram &h = stats->*histogram;
+        // Prometheus buckets are cumulative.
+        uint32_t cumulative = 0;
+        for (int j = 0; j < NUM_BUCKETS; j++) {
+            cumulative += h.m_buckets[j].load(std::memory_order_relaxed);
+            len = snprintf(line,
+                           sizeof(line),
+                           "%s_bucket{node=\"%s\",le=\"%g\"} %" PRIu32 "\n",
+                           metric,
+                           name,
+                           BUCKET_BOUNDS_US[j] / 1e6,
+                           cumulative);
+            write(line, len);
+        }
+        cumulative += h.m_buckets[NUM_BUCKETS].load(std::memory_order_relaxed);
+        len = snprintf(
+            line, sizeof(line), "%s_bucket{node=\"%s\",le=\"+Inf\"} %" PRIu32 "\n", metric, name, cumulative);
+        write(line, len);
+        len = snprintf(line,
+                       sizeof(line),
+                       "%s_sum{node=\"%s\"} %.6f\n",
+                       metric,
+                       name,
+                       h.m_sum_us.load(std::memory_order_relaxed) / 1e6);
+        write(line, len);
+        // The bucket total is the count, so it always matches the +Inf bucket.
+        len = snprintf(line, sizeof(line), "%s_count{node=\"%s\"} %" PRIu32 "\n", metric, name, cumulative);
+        write(line, len);
+    }
+}
+
+void WhoStats::write_prometheus(const std::function<void(const char *, size_t)> &write)
+{
+    write_counter(write, "who_frames_in_total", "Frames received by the task.", &WhoStats::m_frames_in);
+    write_counter(write, "who_frames_out_total", "Frames produced or results delivered.", &WhoStats::m_frames_out);
+    write_counter(write,
+                  "who_frames_dropped_total",
+                  "Frames dropped, failed or overwritten before the next stage took them.",
+                  &WhoStats::m_frames_dropped);
+    write_counter(write,
+                  "who_frames_skipped_total",
+                  "Frames a cheap check kept from the expensive step, e.g. feature runs saved by the face filter.",
+                  &WhoStats::m_frames_skipped);
+    write_histogram(
+        write, "who_process_time_seconds", "Time spent processing one frame.", &WhoStats::m_process_time);
+    write_histogram(write,
+                    "who_queue_wait_seconds",
+                    "Time a frame waited before processing started.",
+                    &WhoStats::m_queue_wait);
+}
+
+void WhoStats::for_each(const std::function<void(const WhoStats &)> &func)
+{
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *stats = s_registry[i].load();
+        if (stats) {
+            func(*stats);
+        }
+    }
+}
+
+void WhoStats::log_throughput()
+{
+    int64_t now = now_us();
+    for (int i = 0; i < MAX_STATS; i++) {
+        WhoStats *stats = s_registry[i].load();
+        if (!stats) {
+            continue;
+        }
+        uint32_t frames_in = stats->get_frames_in();
+        uint32_t frames_out = stats->get_frames_out();
+        uint32_t frames_dropped = stats->get_frames_dropped();
+        float secs = (now - stats->m_last_log_us) / 1e6f;
+        if (secs > 0) {
+            // Unsigned differences stay right when a counter wraps.
+            ESP_LOGI(TAG,
+                     "%s: in %.1f fps, out %.1f fps, dropped %.1f fps",
+                     stats->m_name.c_str(),
+                     (frames_in - stats->m_last_frames_in) / secs,
+                     (frames_out - stats->m_last_frames_out) / secs,
+                     (frames_dropped - stats->m_last_frames_dropped) / secs);
+        }
+        stats->m_last_log_us = now;
+        stats->m_last_frames_in = frames_in;
+        stats->m_last_frames_out = frames_out;
+        stats->m_last_frames_dropped = frames_dropped;
+    }
+}
+} // namespace stats
+} // namespace who
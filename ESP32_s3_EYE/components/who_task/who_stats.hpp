@@ -0,0 +1,93 @@
+#pragma once
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include "esp_timer.h"
+#endif
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace who {
+namespace stats {
+// Per task frame counters and timing histograms. Updated with relaxed atomics only, so any task can record and
+// the exporter can read at any time without a lock. Values are 32 bit, the time sums wrap after ~71 minutes of
+// accumulated time, which scrapers treat like a counter reset.
+class WhoStats {
+public:
+    static inline constexpr int NUM_BUCKETS = 10;
+    static inline constexpr uint32_t BUCKET_BOUNDS_US[NUM_BUCKETS] = {
+        1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000};
+    static inline constexpr int MAX_STATS = 16;
+
+    class Histogram {
+    public:
+        Histogram();
+        void observe(uint32_t us);
+
+    private:
+        friend class WhoStats;
+        // The last bucket counts everything above the last bound.
+        std::atomic<uint32_t> m_buckets[NUM_BUCKETS + 1];
+        std::atomic<uint32_t> m_sum_us;
+    };
+
+    WhoStats(const std::string &name);
+    ~WhoStats();
+    WhoStats(const WhoStats &) = delete;
+    WhoStats &operator=(const WhoStats &) = delete;
+    void frame_in() { m_frames_in.fetch_add(1, std::memory_order_relaxed); }
+    void frame_out() { m_frames_out.fetch_add(1, std::memory_order_relaxed); }
+    void frame_dropped() { m_frames_dropped.fetch_add(1, std::memory_order_relaxed); }
+    void frame_skipped() { m_frames_skipped.fetch_add(1, std::memory_order_relaxed); }
+    void observe_process_time(uint32_t us) { m_process_time.observe(us); }
+    void observe_queue_wait(uint32_t us) { m_queue_wait.observe(us); }
+    const std::string &get_name() const { return m_name; }
+    uint32_t get_frames_in() const { return m_frames_in.load(std::memory_order_relaxed); }
+    uint32_t get_frames_out() const { return m_frames_out.load(std::memory_order_relaxed); }
+    uint32_t get_frames_dropped() const { return m_frames_dropped.load(std::memory_order_relaxed); }
+    // Same clock as the frame timestamps of the cameras.
+    static int64_t now_us()
+    {
+#if CONFIG_IDF_TARGET_LINUX
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#else
+        return esp_timer_get_time();
+#endif
+    }
+    // Write every registered stats in Prometheus text format. write is called once per line.
+    static void write_prometheus(const std::function<void(const char *, size_t)> &write);
+    static void for_each(const std::function<void(const WhoStats &)> &func);
+    // Log the frame rates of every registered stats since the last call, one line per task. Only call it from one
+    // task.
+    static void log_throughput();
+
+private:
+    static void write_histogram(const std::function<void(const char *, size_t)> &write,
+                                const char *metric,
+                                const char *help,
+                                Histogram WhoStats::*histogram);
+    static void write_counter(const std::function<void(const char *, size_t)> &write,
+                              const char *metric,
+                              const char *help,
+                              std::atomic<uint32_t> WhoStats::*counter);
+    std::string m_name;
+    std::atomic<uint32_t> m_frames_in;
+    std::atomic<uint32_t> m_frames_out;
+    std::atomic<uint32_t> m_frames_dropped;
+    std::atomic<uint32_t> m_frames_skipped;
+    Histogram m_process_time;
+    Histogram m_queue_wait;
+    // Counters at the last log_throughput().
+    int64_t m_last_log_us;
+    uint32_t m_last_frames_in;
+    uint32_t m_last_frames_out;
+    uint32_t m_last_frames_dropped;
+    static std::atomic<WhoStats *> s_registry[MAX_STATS];
+};
+} // namespace stats
+} // namespace who
@@ -1,5 +1,7 @@
 #include "who_yield2idle.hpp"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "esp_freertos_hooks.h"
+#endif
 #include <algorithm>
 #include <cstring>
 #include <esp_log.h>
@@ -115,6 +117,28 @@ bool WhoYield2Idle::pause_async()
     return false;
 }
 
+#if CONFIG_IDF_TARGET_LINUX
+// No task watchdog and no idle hooks on the host, there is nothing to monitor.
+void WhoYield2Idle::task()
+{
+    while (true) {
+        EventBits_t event_bits =
+            xEventGroupWaitBits(m_event_group, TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (event_bits & TASK_STOP) {
+            break;
+        } else if (event_bits & TASK_PAUSE) {
+            xEventGroupSetBits(m_event_group, TASK_PAUSED);
+            EventBits_t pause_event_bits =
+                xEventGroupWaitBits(m_event_group, TASK_RESUME | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+            if (pause_event_bits & TASK_STOP) {
+                break;
+            }
+        }
+    }
+    xEventGroupSetBits(m_event_group, TASK_STOPPED);
+    vTaskDelete(NULL);
+}
+#else
 void WhoYield2Idle::task()
 {
     const TickType_t interval = pdMS_TO_TICKS((CONFIG_ESP_TASK_WDT_TIMEOUT_S - CONFIG_MAX_TASK_LOOP_TIME) * 1000 / 2);
@@ -165,6 +189,7 @@ void WhoYield2Idle::task()
     xEventGroupSetBits(m_event_group, TASK_STOPPED);
     vTaskDelete(NULL);
 }
+#endif
 
 bool WhoYield2Idle::idle0_cb(void)
 {
@@ -1,12 +1,17 @@
 #include "frame_cap_pipeline.hpp"
 #include "who_recognition_app_lcd.hpp"
 #include "who_recognition_app_term.hpp"
+#include "who_recognition_app_bench.hpp"
 #include "who_spiflash_fatfs.hpp"
 #include "wifi_connect.h"
 #include "http_streamer.h"
+#include "stream_cache.h"
+#include "frame_lease.h"
+#include "jpeg_pool.h"
 #include "MyRecognitionApp.hpp"
 #include "recognition_control.h"
 #include "net_sender.h"
+#include "who_stats.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -72,10 +77,32 @@ extern "C" void init(void *pvParameter) {
     vTaskDelete(NULL);
 }
 
+#if CONFIG_WHO_BENCH
+// Headless run on recorded clips, without wifi, LCD and http. Compare the result file between builds.
+static void run_bench()
+{
+    auto frame_cap = get_file_frame_cap_pipeline(
+        CONFIG_WHO_BENCH_CLIP_DIR, CONFIG_WHO_BENCH_CLIP_WIDTH, CONFIG_WHO_BENCH_CLIP_HEIGHT, CONFIG_WHO_BENCH_CLIP_FPS);
+    auto bench_app = new WhoRecognitionAppBench(frame_cap);
+    if (!bench_app->run()) {
+        ESP_LOGE(TAG, "Failed to start benchmark");
+        return;
+    }
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_WHO_BENCH_DURATION_S * 1000));
+    bench_app->stop();
+    bench_app->write_result(CONFIG_WHO_BENCH_RESULT_PATH);
+}
+#endif
+
 // C linker needed for recognition app
 extern "C" void app_main(void)
 {
     task_semaphore = xSemaphoreCreateBinary();
+
+    // JPEG buffers for /stream and /motion are taken from PSRAM once, before anything can encode
+    if (!jpeg_pool_init()) {
+        ESP_LOGE(TAG, "Failed to allocate jpeg pool");
+    }
     
     vTaskPrioritySet(xTaskGetCurrentTaskHandle(), 5);
 #if CONFIG_DB_FATFS_FLASH
@@ -83,9 +110,14 @@ extern "C" void app_main(void)
 #elif CONFIG_DB_SPIFFS
     ESP_ERROR_CHECK(bsp_spiffs_mount());
 #endif
-#if CONFIG_DB_FATFS_SDCARD || CONFIG_HUMAN_FACE_DETECT_MODEL_IN_SDCARD || CONFIG_HUMAN_FACE_FEAT_MODEL_IN_SDCARD
+#if CONFIG_DB_FATFS_SDCARD || CONFIG_HUMAN_FACE_DETECT_MODEL_IN_SDCARD || CONFIG_HUMAN_FACE_FEAT_MODEL_IN_SDCARD || \
+    CONFIG_WHO_BENCH
     ESP_ERROR_CHECK(bsp_sdcard_mount());
 #endif
+#if CONFIG_WHO_BENCH
+    run_bench();
+    return;
+#endif
 
 // close led
 #ifdef BSP_BOARD_ESP32_S3_EYE
@@ -110,7 +142,23 @@ extern "C" void app_main(void)
     auto frame_cap = get_dvp_frame_cap_pipeline();
 
     auto recognition_app = new MyRecognitionApp(frame_cap);
-    recognition_register_event_group(recognition_app->get_recognition_event_group());
+    recognition_register_core(recognition_app->get_recognition_core());
+    recognition_register_detect_event_group(recognition_app->get_detect_event_group());
+
+    // /motion borrows frames from the pipeline, so no extra camera buffers are taken from the driver.
+    // The first node has the sensor frames, in JPEG capture mode the full size JPEGs which need no encode.
+    frame_lease_register_node(frame_cap->get_node(0));
+    // Encode-once JPEG producer for /stream, fed by the same frames as the recognition pipeline.
+    // Runs on core 0 next to the frame cap nodes so it does not steal time from detection on core 1.
+    stream_cache_start(frame_cap->get_node(0), 4096, 2, 0);
 
     recognition_app->run();
+
+#if CONFIG_WHO_STATS_LOG_INTERVAL_S > 0
+    // Detection and recognition run on different cores, log how fast each stage keeps up
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_WHO_STATS_LOG_INTERVAL_S * 1000));
+        who::stats::WhoStats::log_throughput();
+    }
+#endif
 }
\ No newline at end of file
@@ -1,57 +1,167 @@
 #include "frame_cap_pipeline.hpp"
 #include "who_cam.hpp"
+#include <algorithm>
 
 using namespace who::cam;
 using namespace who::frame_cap;
 
 // num of frames the model take to get result
 #define MODEL_TIME 3
+// Frames the recognition jobs lease from the node feeding detection, the queued ones plus the one being recognized.
+// They are older than the ringbuf covers, so each one holds a fb of its own.
+#define RECOGNITION_LEASED_FBS (CONFIG_RECOGNITION_QUEUE_LEN + 1)
+// The ringbuf of the node feeding detection covers the inference time, so detection, /stream and /motion lease frames
+// which are still in it.
+#define DETECT_RINGBUF_LEN (MODEL_TIME + 1)
+// Frames leased from that node at the same time: detection during inference, the recognition jobs, the stream cache
+// during an encode and /motion.
+#define DETECT_MAX_LEASED (1 + RECOGNITION_LEASED_FBS + 2)
+// fb_count of a camera which feeds detection directly: the ringbuf, the fb the driver is filling and the recognition
+// jobs.
+#define DETECT_CAM_FB_COUNT (DETECT_RINGBUF_LEN + 1 + RECOGNITION_LEASED_FBS)
+// A node which only feeds another node, /stream and /motion, they all take the newest frame.
+#define FEED_RINGBUF_LEN 2
+// The frame queued to the next node, the one it processes, the stream cache during an encode and /motion.
+#define FEED_MAX_LEASED 4
+// fb_count of such a camera: the ringbuf, the fb the driver is filling, the frame the next node still processes while
+// the fetch node waits to queue a newer one and the frame the stream cache encodes, both may have left the ringbuf.
+#define FEED_CAM_FB_COUNT (FEED_RINGBUF_LEN + 1 + 2)
 
-// The size of the fb_count and ringbuf_len must be big enough. If you have no idea how to set them, try with 5 and
-// larger.
+// Detection, display and the http handlers lease the frames they use, so the camera can't recycle a frame which is
+// still being read. The ringbuf only has to cover the display delay, not the whole inference time any more.
 #if CONFIG_IDF_TARGET_ESP32S3
+#if CONFIG_CAM_CAPTURE_JPEG
+static framesize_t get_jpeg_frame_size()
+{
+#if CONFIG_CAM_JPEG_FRAME_SIZE_VGA
+    return FRAMESIZE_VGA;
+#elif CONFIG_CAM_JPEG_FRAME_SIZE_XGA
+    return FRAMESIZE_XGA;
+#elif CONFIG_CAM_JPEG_FRAME_SIZE_HD
+    return FRAMESIZE_HD;
+#elif CONFIG_CAM_JPEG_FRAME_SIZE_UXGA
+    return FRAMESIZE_UXGA;
+#else
+    return FRAMESIZE_SVGA;
+#endif
+}
+
+// Smallest downscale of the decoder (1/2, 1/4 or 1/8) which fits the decoded frame onto the LCD.
+static uint8_t get_decode_scale_shift(framesize_t frame_size)
+{
+    uint8_t shift = 0;
+    while (shift < 3 &&
+           ((resolution[frame_size].width >> shift) > BSP_LCD_H_RES ||
+            (resolution[frame_size].height >> shift) > BSP_LCD_V_RES)) {
+        shift++;
+    }
+    return shift;
+}
+#else
+static framesize_t get_rgb565_frame_size()
+{
+#if CONFIG_CAM_RGB565_FRAME_SIZE_HVGA
+    return FRAMESIZE_HVGA;
+#elif CONFIG_CAM_RGB565_FRAME_SIZE_VGA
+    return FRAMESIZE_VGA;
+#elif CONFIG_CAM_RGB565_FRAME_SIZE_SVGA
+    return FRAMESIZE_SVGA;
+#else
+    return get_cam_frame_size_from_lcd_resolution();
+#endif
+}
+#endif
+
 WhoFrameCap *get_dvp_frame_cap_pipeline()
 {
-    // The ringbuf_len of FetchNode equals cam_fb_count - 2. The WhoFetchNode fb will display on lcd, if you want to
-    // make sure the displayed detection result is synced with the frame, the ringbuf size must be big enough to
-    // cover the process time from now to the the detection result is ready. If the ring_buf_len is 3, the frame
-    // which the disp task will display is 2 frames before than the frame which feeds into detection task. So the
-    // detection task must finish within 2 frames, or the detect result will have a delay compared to the displayed
-    // frame.
-    framesize_t frame_size = get_cam_frame_size_from_lcd_resolution();
+    // The WhoFetchNode fb will display on lcd, if you want to make sure the displayed detection result is synced with
+    // the frame, the ringbuf size must be big enough to cover the process time from now to the the detection result
+    // is ready. If the ring_buf_len is 3, the frame which the disp task will display is 2 frames before than the frame
+    // which feeds into detection task. So the detection task must finish within 2 frames, or the detect result will
+    // have a delay compared to the displayed frame. The extra fbs are the one the driver is filling and the frames the
+    // recognition jobs hold, see DETECT_CAM_FB_COUNT.
+#if CONFIG_CAM_CAPTURE_JPEG
+    framesize_t frame_size = get_jpeg_frame_size();
+    pixformat_t pixel_format = PIXFORMAT_JPEG;
+#else
+    framesize_t frame_size = get_rgb565_frame_size();
+    pixformat_t pixel_format = PIXFORMAT_RGB565;
+#endif
+    uint16_t width = resolution[frame_size].width;
+    uint16_t height = resolution[frame_size].height;
+    // JPEGs and frames bigger than the LCD go through a second node for detection and the lcd, which takes over the
+    // display delay and the recognition leases, the camera then only feeds that node.
+#if CONFIG_CAM_CAPTURE_JPEG
+    bool fits_lcd = false;
+#else
+    bool fits_lcd = width <= BSP_LCD_H_RES && height <= BSP_LCD_V_RES;
+#endif
+    uint8_t fb_count = fits_lcd ? DETECT_CAM_FB_COUNT : FEED_CAM_FB_COUNT;
 #ifdef BSP_BOARD_ESP32_S3_KORVO_2
-    auto cam = new WhoS3Cam(PIXFORMAT_RGB565, frame_size, MODEL_TIME + 3, true, true);
+    auto cam = new WhoS3Cam(pixel_format, frame_size, fb_count, true, true);
 #else
-    auto cam = new WhoS3Cam(PIXFORMAT_RGB565, frame_size, MODEL_TIME + 3);
+    auto cam = new WhoS3Cam(pixel_format, frame_size, fb_count);
 #endif
     auto frame_cap = new WhoFrameCap();
-    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam);
+#if CONFIG_CAM_CAPTURE_JPEG
+    // The JPEGs are streamed and uploaded from the fetch node as they are, the decode node feeds detection and the
+    // lcd. Like in the uvc pipeline every JPEG is decoded.
+    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, FEED_RINGBUF_LEN, FEED_MAX_LEASED, false);
+    frame_cap->add_node<WhoDecodeNode>("FrameCapDecode",
+                                       dl::image::DL_IMAGE_PIX_TYPE_RGB565,
+                                       DETECT_RINGBUF_LEN,
+                                       DETECT_MAX_LEASED,
+                                       true,
+                                       get_decode_scale_shift(frame_size));
+#else
+    if (fits_lcd) {
+        frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, DETECT_RINGBUF_LEN, DETECT_MAX_LEASED);
+    } else {
+        // Keep the aspect ratio, the lcd shows the whole frame.
+        float scale = std::min((float)BSP_LCD_H_RES / width, (float)BSP_LCD_V_RES / height);
+        frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, FEED_RINGBUF_LEN, FEED_MAX_LEASED, false);
+        frame_cap->add_node<WhoResizeNode>("FrameCapResize",
+                                           (uint16_t)(width * scale) & ~1,
+                                           (uint16_t)(height * scale) & ~1,
+                                           dl::image::DL_IMAGE_PIX_TYPE_RGB565,
+                                           DETECT_RINGBUF_LEN,
+                                           DETECT_MAX_LEASED);
+    }
+#endif
     return frame_cap;
 }
 #elif CONFIG_IDF_TARGET_ESP32P4
 WhoFrameCap *get_mipi_csi_frame_cap_pipeline()
 {
-    auto cam = new WhoP4Cam(V4L2_PIX_FMT_RGB565, MODEL_TIME + 3);
+    auto cam = new WhoP4Cam(V4L2_PIX_FMT_RGB565, DETECT_CAM_FB_COUNT);
     auto frame_cap = new WhoFrameCap();
-    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam);
+    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, DETECT_RINGBUF_LEN, DETECT_MAX_LEASED);
     return frame_cap;
 }
 
 WhoFrameCap *get_uvc_frame_cap_pipeline()
 {
-    auto cam = new WhoUVCCam(UVC_VS_FORMAT_MJPEG, 640, 480, 30, 4);
+    auto cam = new WhoUVCCam(UVC_VS_FORMAT_MJPEG, 640, 480, 30, FEED_CAM_FB_COUNT);
     auto frame_cap = new WhoFrameCap();
-    // The ringbuf_len of FetchNode equals cam_fb_count - 2, the ringbuf_len of FetchNode should take care of the
-    // process time of the following Node. For example, if the DecodeNode takes 2 frame to decode, then the
-    // FetchNode ringbuf_len is at least 2, and the fb_count of the cam is at least 4.
-    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, false);
+    // The fetch node only feeds the DecodeNode, /stream and /motion.
+    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, FEED_RINGBUF_LEN, FEED_MAX_LEASED, false);
     // The DecodeNode ringbuf_len relies on the following PPAResizeNode process time, the time of data transfer.
-    frame_cap->add_node<WhoDecodeNode>("FrameCapDecode", dl::image::DL_IMAGE_PIX_TYPE_RGB565, 2, false);
+    frame_cap->add_node<WhoDecodeNode>(
+        "FrameCapDecode", dl::image::DL_IMAGE_PIX_TYPE_RGB565, FEED_RINGBUF_LEN, FEED_MAX_LEASED, false);
     // The ppa resized fb will display on lcd, if you want to make sure the displayed detection result is synced with
     // the frame, the ringbuf size must be big enough to cover the process time from now to the the detection result is
     // ready.
     frame_cap->add_node<WhoPPAResizeNode>(
-        "FrameCapPPAResize", 800, 600, dl::image::DL_IMAGE_PIX_TYPE_RGB565, MODEL_TIME + 1);
+        "FrameCapPPAResize", 800, 600, dl::image::DL_IMAGE_PIX_TYPE_RGB565, DETECT_RINGBUF_LEN, DETECT_MAX_LEASED);
     return frame_cap;
 }
 #endif
+
+WhoFrameCap *get_file_frame_cap_pipeline(const char *dir, uint16_t width, uint16_t height, float fps)
+{
+    // Same buffer budget as the sensor pipeline, so the replay behaves like the real camera.
+    auto cam = new WhoFileCam(dir, cam_fb_fmt_t::CAM_FB_FMT_RGB565, width, height, fps, DETECT_CAM_FB_COUNT);
+    auto frame_cap = new WhoFrameCap();
+    frame_cap->add_node<WhoFetchNode>("FrameCapFetch", cam, DETECT_RINGBUF_LEN, DETECT_MAX_LEASED);
+    return frame_cap;
+}
@@ -2,8 +2,13 @@
 #include "who_frame_cap.hpp"
 
 #if CONFIG_IDF_TARGET_ESP32S3
+// The first node has the sensor frames. With CAM_CAPTURE_JPEG or frames bigger than the LCD the last node has the
+// decoded or resized RGB565 frames for detection and the LCD.
 who::frame_cap::WhoFrameCap *get_dvp_frame_cap_pipeline();
 #elif CONFIG_IDF_TARGET_ESP32P4
 who::frame_cap::WhoFrameCap *get_mipi_csi_frame_cap_pipeline();
 who::frame_cap::WhoFrameCap *get_uvc_frame_cap_pipeline();
 #endif
+
+// Replays recorded RGB565 frames (width x height .rgb565 files in dir) instead of the sensor.
+who::frame_cap::WhoFrameCap *get_file_frame_cap_pipeline(const char *dir, uint16_t width, uint16_t height, float fps);
@@ -0,0 +1,55 @@
+#include "frame_lease.h"
+
+using namespace who::cam;
+using namespace who::frame_cap;
+
+static WhoFrameCapNode *s_node = nullptr;
+
+void frame_lease_register_node(WhoFrameCapNode *node)
+{
+    s_node = node;
+}
+
+static pixformat_t cam_fb_fmt2pix_fmt(cam_fb_fmt_t fmt)
+{
+    switch (fmt) {
+    case cam_fb_fmt_t::CAM_FB_FMT_RGB565:
+        return PIXFORMAT_RGB565;
+    case cam_fb_fmt_t::CAM_FB_FMT_RGB888:
+        return PIXFORMAT_RGB888;
+    case cam_fb_fmt_t::CAM_FB_FMT_GRAY:
+        return PIXFORMAT_GRAYSCALE;
+    case cam_fb_fmt_t::CAM_FB_FMT_JPEG:
+        return PIXFORMAT_JPEG;
+    default:
+        return PIXFORMAT_RAW;
+    }
+}
+
+extern "C" bool frame_lease_acquire(frame_lease_t *lease)
+{
+    if (!lease || !s_node) {
+        return false;
+    }
+    cam_fb_t *fb = s_node->cam_fb_lease();
+    if (!fb) {
+        return false;
+    }
+    lease->buf = (const uint8_t *)fb->buf;
+    lease->len = fb->len;
+    lease->width = fb->width;
+    lease->height = fb->height;
+    lease->format = cam_fb_fmt2pix_fmt(fb->format);
+    lease->timestamp = fb->timestamp;
+    lease->handle = fb;
+    return true;
+}
+
+extern "C" void frame_lease_release(frame_lease_t *lease)
+{
+    if (!lease || !lease->handle || !s_node) {
+        return;
+    }
+    s_node->cam_fb_release((cam_fb_t *)lease->handle);
+    lease->handle = nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A camera frame borrowed from the frame cap pipeline for consumers which are not pipeline tasks (http handlers).
+// The pipeline keeps the frame alive until frame_lease_release() is called, so release it as soon as possible.
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    pixformat_t format;
+    struct timeval timestamp;
+    void *handle;
+} frame_lease_t;
+
+// Borrow the newest frame of the registered node. Returns false if no node is registered or no frame is ready.
+bool frame_lease_acquire(frame_lease_t *lease);
+void frame_lease_release(frame_lease_t *lease);
+
+#ifdef __cplusplus
+}
+
+#include "who_frame_cap.hpp"
+
+// Select the pipeline node the http handlers borrow frames from.
+void frame_lease_register_node(who::frame_cap::WhoFrameCapNode *node);
+#endif
@@ -1,13 +1,17 @@
 #include "esp_http_server.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include "img_converters.h"
+#include "jpeg_pool.h"
 #include "recognition_control.h"
 #include "net_sender.h"
 #include "http_streamer.h"
+#include "stream_cache.h"
+#include "frame_lease.h"
+#include "metrics.h"
 
 // Forward declare local handlers used in URI registration
 static esp_err_t index_get_handler(httpd_req_t *req);
@@ -18,6 +22,10 @@ static const char *TAG = "http_stream";
 static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=frame";
 static const char *_STREAM_BOUNDARY = "\r\n--frame\r\n";
 static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+// Give up on a client if the pipeline produced nothing for this long (e.g. paused)
+#define STREAM_FRAME_TIMEOUT_MS 3000
+// Motion snapshots are only uploaded, a lower quality keeps them small
+#define MOTION_JPEG_QUALITY 40
 
 char*  buf;
 size_t buf_len;
@@ -60,53 +68,30 @@ static esp_err_t stream_get_handler(httpd_req_t *req) {
     char part_buf[64];
     httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
     ESP_LOGI(TAG, "stream: client connected");
+    // Frames are encoded once by the stream cache producer and shared by every client,
+    // so adding viewers does not add JPEG encodes or take camera buffers away from the pipeline
+    stream_cache_viewer_add();
+    uint32_t last_seq = 0;
     while (true) {
-        // Get the latest camera frame
-        camera_fb_t *fb = esp_camera_fb_get();
-        if (!fb) {
-            ESP_LOGW(TAG, "stream: fb_get failed");
+        // Wait for a frame newer than the one we sent last
+        const stream_jpeg_t *frame = stream_cache_acquire(last_seq, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+        if (!frame) {
+            ESP_LOGW(TAG, "stream: no frame available");
             break;
         }
         // Send the frame as a multipart HTTP response
-        esp_err_t res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        if (res != ESP_OK) {
-            // Must release frame buffer if not sent, else core will panic due to buffer overflow
-            esp_camera_fb_return(fb);
+        // The slot must be released even if sending fails, else the producer will run out of slots
+        int hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)frame->len);
+        bool ok = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY)) == ESP_OK &&
+                  httpd_resp_send_chunk(req, part_buf, hlen) == ESP_OK &&
+                  httpd_resp_send_chunk(req, (const char *)frame->buf, frame->len) == ESP_OK;
+        last_seq = frame->seq;
+        stream_cache_release(frame);
+        if (!ok) {
             break;
         }
-        // Check if the frame is already in JPEG format, else convert it
-        // Most likely the frame is in RGB565 format so will need to convert it to JPEG for streaming
-        // Send the data is chunks fo 64 bytes so that sending is fast
-        // Must avoid large blocking send that will cause frame buffer overflow
-        // Frame buffer needs to be released back to camera driver after use 
-        if (fb->format == PIXFORMAT_JPEG) {
-            int hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, fb->len);
-            if (httpd_resp_send_chunk(req, part_buf, hlen) != ESP_OK ||
-                httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len) != ESP_OK) {
-                esp_camera_fb_return(fb);
-                break;
-            }
-        } else {
-            uint8_t *jpg_buf = NULL; size_t jpg_len = 0;
-            bool ok = frame2jpg(fb, 60, &jpg_buf, &jpg_len);
-            if (!ok || !jpg_buf) {
-                esp_camera_fb_return(fb);
-                ESP_LOGE(TAG, "stream: frame2jpg failed");
-                break;
-            }
-            int hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)jpg_len);
-            if (httpd_resp_send_chunk(req, part_buf, hlen) != ESP_OK ||
-                httpd_resp_send_chunk(req, (const char *)jpg_buf, jpg_len) != ESP_OK) {
-                free(jpg_buf);
-                esp_camera_fb_return(fb);
-                break;
-            }
-            free(jpg_buf);
-        }
-
-        esp_camera_fb_return(fb);
-        vTaskDelay(pdMS_TO_TICKS(50));
     }
+    stream_cache_viewer_remove();
     // Terminate the response if no client is connected / client disconnected
     httpd_resp_send_chunk(req, NULL, 0);
     ESP_LOGI(TAG, "stream: client disconnected");
@@ -121,8 +106,10 @@ httpd_handle_t start_webserver(void) {
     if (httpd_start(&server, &config) == ESP_OK) {
         httpd_uri_t index_uri  = {.uri="/", .method=HTTP_GET, .handler=index_get_handler, .user_ctx=NULL};
         httpd_uri_t stream_uri = {.uri="/stream", .method=HTTP_GET, .handler=stream_get_handler, .user_ctx=NULL};
+        httpd_uri_t metrics_uri = {.uri="/metrics", .method=HTTP_GET, .handler=metrics_get_handler, .user_ctx=NULL};
         httpd_register_uri_handler(server, &index_uri);
         httpd_register_uri_handler(server, &stream_uri);
+        httpd_register_uri_handler(server, &metrics_uri);
     } else {
         ESP_LOGE(TAG, "Failed starting HTTP server");
     }
@@ -154,43 +141,48 @@ static esp_err_t index_get_handler(httpd_req_t *req) {
 
 static esp_err_t motion_get_handler(httpd_req_t *req) {
     
-    // Get latest frame from camera
+    // Borrow the latest frame from the recognition pipeline instead of taking a camera buffer from the driver
     ESP_LOGI(TAG, "Motion detected, getting frame");
-    camera_fb_t *fb = esp_camera_fb_get();
+    // Someone is at the door, let detection run at the full rate before the face even reaches the camera
+    recognition_notify_motion();
+    frame_lease_t fb;
     // validation checks 
-    if (!fb) {
+    if (!frame_lease_acquire(&fb)) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no frame available");
         return ESP_FAIL;
     }
 
-    if (fb->format != PIXFORMAT_RGB565) {
-        esp_camera_fb_return(fb);
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "camera not in RGB565 mode");
+    size_t jpg_len = 0;
+    uint8_t *jpg = NULL;
+    if (fb.format == PIXFORMAT_JPEG) {
+        // JPEG capture mode: the sensor frame is uploaded as it is, at full size and without an encode
+        jpg = jpeg_pool_copy(fb.buf, fb.len);
+        jpg_len = fb.len;
+    } else if (fb.format == PIXFORMAT_RGB565) {
+        const size_t rgb565_len = (size_t)fb.width * fb.height * 2;
+        if (fb.len < rgb565_len) {
+            frame_lease_release(&fb);
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "frame size mismatch");
+            return ESP_FAIL;
+        }
+        // Encode straight from the leased frame into a pool buffer, no RGB565 copy is made and the sender task does not encode again
+        jpg = jpeg_pool_encode(
+            fb.buf, rgb565_len, fb.width, fb.height, PIXFORMAT_RGB565, MOTION_JPEG_QUALITY, &jpg_len, NULL);
+    } else {
+        frame_lease_release(&fb);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "camera not in RGB565 or JPEG mode");
         return ESP_FAIL;
     }
 
-    const size_t rgb565_len = (size_t)fb->width * fb->height * 2;
-    if (fb->len < rgb565_len) {
-        esp_camera_fb_return(fb);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "frame size mismatch");
-        return ESP_FAIL;
-    }
+    // Give the lease back so that the pipeline can recycle the frame
+    frame_lease_release(&fb);
 
-    uint8_t *copy = (uint8_t *)heap_caps_malloc(rgb565_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (!copy) {
-        copy = (uint8_t *)malloc(rgb565_len);
-    }
-    if (!copy) {
-        esp_camera_fb_return(fb);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "insufficient memory");
+    if (!jpg) {
+        // Either the encode failed, the JPEG is bigger than a pool buffer or every pool buffer is held by queued snapshots
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "jpeg encode failed");
         return ESP_FAIL;
     }
 
-    // Copy the frame data and return the frame buffer to camera driver so that the camera can continue capturing new frames
-    memcpy(copy, fb->buf, rgb565_len);
-
-    esp_camera_fb_return(fb);
-
     // Get timestamp from parameter 
     char ts_value[64] = {0};
     size_t qlen = httpd_req_get_url_query_len(req);
@@ -209,8 +201,8 @@ static esp_err_t motion_get_handler(httpd_req_t *req) {
     }
 
     // send to telegram async sender task so that camera will not be blocked when sending http
-    if (!net_send_telegram_rgb565_take(copy, rgb565_len, fb->width, fb->height, 40, ts_value[0] ? ts_value : 0)) {
-        free(copy);
+    // The sender owns the buffer even when this fails, so don't free it here
+    if (!net_send_jpeg_photo_take(jpg, jpg_len, ts_value[0] ? ts_value : 0)) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "enqueue failed");
         return ESP_FAIL;
     }
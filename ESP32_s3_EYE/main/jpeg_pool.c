@@ -0,0 +1,86 @@
+#include "jpeg_pool.h"
+#include "who_buf_pool.h"
+#include "who_jpeg_enc.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "jpeg_pool";
+
+static who_buf_pool_handle_t s_pool = NULL;
+
+bool jpeg_pool_init(void)
+{
+    if (s_pool) return true;
+    if (who_jpeg_enc_init() != ESP_OK) {
+        return false;
+    }
+    // The hardware encoder writes the slots with DMA
+    who_buf_pool_config_t config = {
+        .name = "jpeg",
+        .slot_size = CONFIG_JPEG_POOL_SLOT_SIZE_KB * 1024,
+        .slot_count = CONFIG_JPEG_POOL_SLOTS,
+        .caps = who_jpeg_enc_get_out_caps(),
+        .align = who_jpeg_enc_get_out_align(),
+    };
+    if (who_buf_pool_create(&config, &s_pool) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create jpeg pool");
+        return false;
+    }
+    return true;
+}
+
+uint8_t *jpeg_pool_encode(const uint8_t *src,
+                          size_t src_len,
+                          uint16_t width,
+                          uint16_t height,
+                          pixformat_t format,
+                          uint8_t quality,
+                          size_t *out_len,
+                          bool *overflow)
+{
+    if (overflow) *overflow = false;
+    uint8_t *buf = (uint8_t *)who_buf_pool_alloc(s_pool, who_buf_pool_get_slot_size(s_pool), 0);
+    if (!buf) return NULL;
+    size_t size = who_buf_pool_get_slot_size(s_pool);
+    esp_err_t ret = who_jpeg_enc_encode(src, src_len, width, height, format, quality, buf, size, out_len);
+    if (ret != ESP_OK) {
+        if (ret == ESP_ERR_INVALID_SIZE) {
+            ESP_LOGW(TAG, "jpeg bigger than %u bytes, increase JPEG_POOL_SLOT_SIZE_KB", (unsigned)size);
+            if (overflow) *overflow = true;
+        }
+        who_buf_pool_free(s_pool, buf);
+        return NULL;
+    }
+    return buf;
+}
+
+uint8_t *jpeg_pool_copy(const uint8_t *jpg, size_t len)
+{
+    if (len > who_buf_pool_get_slot_size(s_pool)) {
+        ESP_LOGW(TAG,
+                 "jpeg of %u bytes bigger than %u bytes, increase JPEG_POOL_SLOT_SIZE_KB",
+                 (unsigned)len,
+                 (unsigned)who_buf_pool_get_slot_size(s_pool));
+        return NULL;
+    }
+    uint8_t *buf = (uint8_t *)who_buf_pool_alloc(s_pool, len, 0);
+    if (!buf) return NULL;
+    memcpy(buf, jpg, len);
+    return buf;
+}
+
+void jpeg_pool_free(void *jpg)
+{
+    who_buf_pool_free(s_pool, jpg);
+}
+
+size_t jpeg_pool_get_slot_size(void)
+{
+    return who_buf_pool_get_slot_size(s_pool);
+}
+
+void jpeg_pool_print_stats(void)
+{
+    who_buf_pool_print_stats(s_pool);
+}
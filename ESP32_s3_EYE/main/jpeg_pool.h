@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every JPEG of a frame (stream cache, motion snapshots) lives in one preallocated PSRAM pool,
+// so encoding at frame rate never mallocs and frees frame sized buffers.
+bool jpeg_pool_init(void);
+
+// Encode a frame into a pool buffer, on the JPEG codec if the target has one. Returns NULL if no buffer is free,
+// the encode fails, or the JPEG doesn't fit into a buffer. Give the buffer back with jpeg_pool_free().
+// overflow, if not NULL, tells the last case apart so that the caller can lower the quality.
+uint8_t *jpeg_pool_encode(const uint8_t *src,
+                          size_t src_len,
+                          uint16_t width,
+                          uint16_t height,
+                          pixformat_t format,
+                          uint8_t quality,
+                          size_t *out_len,
+                          bool *overflow);
+
+// Copy an already encoded JPEG into a pool buffer.
+uint8_t *jpeg_pool_copy(const uint8_t *jpg, size_t len);
+void jpeg_pool_free(void *jpg);
+// Largest JPEG a buffer holds.
+size_t jpeg_pool_get_slot_size(void);
+void jpeg_pool_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+#include "metrics.h"
+#include "who_stats.hpp"
+#include <cstring>
+
+// Lines are collected and sent in chunks of this size instead of one chunk per line
+#define METRICS_CHUNK_SIZE 1024
+
+extern "C" esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    char chunk[METRICS_CHUNK_SIZE];
+    size_t used = 0;
+    esp_err_t err = ESP_OK;
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    who::stats::WhoStats::write_prometheus([&](const char *line, size_t len) {
+        if (err != ESP_OK) {
+            return;
+        }
+        if (used + len > sizeof(chunk)) {
+            err = httpd_resp_send_chunk(req, chunk, used);
+            used = 0;
+        }
+        len = len < sizeof(chunk) ? len : sizeof(chunk);
+        memcpy(chunk + used, line, len);
+        used += len;
+    });
+    if (err == ESP_OK && used > 0) {
+        err = httpd_resp_send_chunk(req, chunk, used);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
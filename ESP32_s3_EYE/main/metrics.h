@@ -0,0 +1,13 @@
+#pragma once
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// GET /metrics: per task frame counters and timing histograms of the pipeline in Prometheus text format.
+esp_err_t metrics_get_handler(httpd_req_t *req);
+
+#ifdef __cplusplus
+}
+#endif
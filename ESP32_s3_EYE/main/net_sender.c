@@ -1,4 +1,5 @@
 #include "net_sender.h"
+#include "jpeg_pool.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -8,14 +9,14 @@
 
 // Existing sync senders we will call from the background task
 bool post_plain_to_server(const char *ip, uint16_t port, const char *path, const char *body, size_t len);
-// Combined JPEG send: converts once and sends to both Telegram and Supabase
-http_success_t send_rgb565_image(const uint8_t *rgb565, uint16_t width, uint16_t height, uint8_t quality, const char *caption);
+// Combined JPEG send: sends the same JPEG to both Telegram and Supabase
+http_success_t send_jpeg_image(const uint8_t *jpg, size_t jpg_len, const char *caption);
 
 static const char *TAG = "net_sender";
 
 typedef enum {
     NET_ITEM_HTTP_PLAIN = 1,
-    NET_ITEM_TG_RGB565 = 2,
+    NET_ITEM_JPEG_PHOTO = 2,
 } net_item_type_t;
 
 typedef struct {
@@ -26,20 +27,18 @@ typedef struct {
     size_t len;
 } http_plain_t;
 
+// Only the compressed image is queued, so a queued event holds ~10 KB instead of a full RGB565 frame
 typedef struct {
-    uint8_t *rgb565;     // ownership transferred; will be free()'d after use
-    size_t rgb565_len;
-    uint16_t width;
-    uint16_t height;
-    uint8_t quality;
+    uint8_t *jpg;        // ownership transferred; given back to the jpeg pool after use
+    size_t jpg_len;
     char *caption;       // copied string
-} tg_rgb565_t;
+} jpeg_photo_t;
 
 typedef struct {
     net_item_type_t type;
     union {
         http_plain_t http;
-        tg_rgb565_t tg;
+        jpeg_photo_t photo;
     } u;
 } net_item_t;
 
@@ -54,9 +53,9 @@ static void net_item_free(net_item_t *it)
         if (it->u.http.ip) free(it->u.http.ip);
         if (it->u.http.path) free(it->u.http.path);
         if (it->u.http.body) free(it->u.http.body);
-    } else if (it->type == NET_ITEM_TG_RGB565) {
-        if (it->u.tg.rgb565) free(it->u.tg.rgb565);
-        if (it->u.tg.caption) free(it->u.tg.caption);
+    } else if (it->type == NET_ITEM_JPEG_PHOTO) {
+        if (it->u.photo.jpg) jpeg_pool_free(it->u.photo.jpg);
+        if (it->u.photo.caption) free(it->u.photo.caption);
     }
 }
 
@@ -82,13 +81,11 @@ static void net_sender_task(void *arg)
                 net_item_free(&item);
                 break;
             }
-            case NET_ITEM_TG_RGB565: {
-                // send rgb565 image to telegram and supabase with single conversion
-                http_success_t ok = send_rgb565_image(item.u.tg.rgb565,
-                                                      item.u.tg.width,
-                                                      item.u.tg.height,
-                                                      item.u.tg.quality,
-                                                      item.u.tg.caption ? item.u.tg.caption : "");
+            case NET_ITEM_JPEG_PHOTO: {
+                // send the already encoded image to telegram and supabase
+                http_success_t ok = send_jpeg_image(item.u.photo.jpg,
+                                                    item.u.photo.jpg_len,
+                                                    item.u.photo.caption ? item.u.photo.caption : "");
                 ESP_LOGI(TAG, "Telegram photo sent: %s", ok.telegram_ok ? "OK" : "FAIL");
                 ESP_LOGI(TAG, "Supabase photo sent: %s", ok.supabase_ok ? "OK" : "FAIL");
                 // We must free buffers
@@ -170,26 +167,21 @@ bool net_send_http_plain_async(const char *ip,
     return true;
 }
 
-bool net_send_telegram_rgb565_take(uint8_t *rgb565,
-                                   size_t rgb565_len,
-                                   uint16_t width,
-                                   uint16_t height,
-                                   uint8_t quality,
-                                   const char *caption)
+bool net_send_jpeg_photo_take(uint8_t *jpg,
+                              size_t jpg_len,
+                              const char *caption)
 {
-    if (!rgb565 || rgb565_len == 0 || width == 0 || height == 0) return false;
-    if (!s_queue) {
-        if (!net_sender_start(1)) return false;
+    if (!jpg) return false;
+    if (jpg_len == 0 || (!s_queue && !net_sender_start(1))) {
+        jpeg_pool_free(jpg);
+        return false;
     }
     net_item_t it = {0};
-    it.type = NET_ITEM_TG_RGB565;
-    it.u.tg.rgb565 = rgb565; // take ownership
-    it.u.tg.rgb565_len = rgb565_len;
-    it.u.tg.width = width;
-    it.u.tg.height = height;
-    it.u.tg.quality = quality;
-    it.u.tg.caption = caption ? strdup_n(caption) : NULL;
-    if (caption && !it.u.tg.caption) {
+    it.type = NET_ITEM_JPEG_PHOTO;
+    it.u.photo.jpg = jpg; // take ownership
+    it.u.photo.jpg_len = jpg_len;
+    it.u.photo.caption = caption ? strdup_n(caption) : NULL;
+    if (caption && !it.u.photo.caption) {
         net_item_free(&it);
         return false;
     }
@@ -198,4 +190,4 @@ bool net_send_telegram_rgb565_take(uint8_t *rgb565,
         return false;
     }
     return true;
-}
+}
\ No newline at end of file
@@ -20,15 +20,12 @@ bool net_send_http_plain_async(const char *ip,
                                const char *body,
                                size_t len);
 
-// Enqueue a Telegram send of an RGB565 image. The function takes ownership of
-// the rgb565 buffer and will free() it after sending (or on failure).
+// Enqueue a Telegram + Supabase send of a JPEG image. The jpg buffer must come from the jpeg pool,
+// the function takes ownership of it and gives it back to the pool after sending (or on failure).
 // The caption string is copied internally.
-bool net_send_telegram_rgb565_take(uint8_t *rgb565,
-                                   size_t rgb565_len,
-                                   uint16_t width,
-                                   uint16_t height,
-                                   uint8_t quality,
-                                   const char *caption);
+bool net_send_jpeg_photo_take(uint8_t *jpg,
+                              size_t jpg_len,
+                              const char *caption);
 
 typedef struct {
     bool telegram_ok;
@@ -1,26 +1,37 @@
 #include "recognition_control.h"
 #include "who_recognition.hpp"
 
-static EventGroupHandle_t s_recog_group = nullptr;
+static who::recognition::WhoRecognitionCore *s_recog_core = nullptr;
+static EventGroupHandle_t s_detect_group = nullptr;
 
-extern "C" void recognition_register_event_group(EventGroupHandle_t group) {
-    s_recog_group = group;
+void recognition_register_core(who::recognition::WhoRecognitionCore *core) {
+    s_recog_core = core;
 }
 
 extern "C" void recognition_request_recognize(void) {
-    if (s_recog_group) {
-        xEventGroupSetBits(s_recog_group, who::recognition::WhoRecognitionCore::RECOGNIZE);
+    if (s_recog_core) {
+        s_recog_core->send_command(who::recognition::WhoRecognitionCore::RECOGNIZE);
     }
 }
 
 extern "C" void recognition_request_enroll(void) {
-    if (s_recog_group) {
-        xEventGroupSetBits(s_recog_group, who::recognition::WhoRecognitionCore::ENROLL);
+    if (s_recog_core) {
+        s_recog_core->send_command(who::recognition::WhoRecognitionCore::ENROLL);
     }
 }
 
 extern "C" void recognition_request_clear_all(void) {
-    if (s_recog_group) {
-        xEventGroupSetBits(s_recog_group, who::recognition::WhoRecognitionCore::CLEAR_ALL);
+    if (s_recog_core) {
+        s_recog_core->send_command(who::recognition::WhoRecognitionCore::CLEAR_ALL);
+    }
+}
+
+extern "C" void recognition_register_detect_event_group(EventGroupHandle_t group) {
+    s_detect_group = group;
+}
+
+extern "C" void recognition_notify_motion(void) {
+    if (s_detect_group) {
+        xEventGroupSetBits(s_detect_group, who::detect::WhoDetect::MOTION);
     }
 }
@@ -3,13 +3,23 @@
 #include <freertos/event_groups.h>
 
 #ifdef __cplusplus
+namespace who {
+namespace recognition {
+class WhoRecognitionCore;
+}
+} // namespace who
+// Web requests are queued as commands of this task, none is lost when several arrive at once.
+void recognition_register_core(who::recognition::WhoRecognitionCore *core);
+
 extern "C" {
 #endif
 
-void recognition_register_event_group(EventGroupHandle_t group);
 void recognition_request_recognize(void);
 void recognition_request_enroll(void);
 void recognition_request_clear_all(void);
+// Motion seen outside the camera, e.g. the door PIR. Puts detection into the full rate if it is motion gated.
+void recognition_register_detect_event_group(EventGroupHandle_t group);
+void recognition_notify_motion(void);
 
 #ifdef __cplusplus
 }
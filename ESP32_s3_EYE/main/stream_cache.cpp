@@ -0,0 +1,293 @@
+#include "stream_cache.h"
+#include "freertos/semphr.h"
+#include "jpeg_pool.h"
+#include "who_jpeg_rc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+
+using namespace who::cam;
+using namespace who::frame_cap;
+
+static const char *TAG = "stream_cache";
+
+// One slot being filled, one being the newest, the rest can be held by slow clients
+#define STREAM_CACHE_SLOTS 3
+
+// Clients waiting at the same time, more than the http server has sockets
+#define STREAM_CACHE_MAX_WAITERS 8
+
+typedef struct {
+    stream_jpeg_t frame; // must be first, clients get a pointer to it
+    uint8_t *jpg;
+    int refs;
+} stream_slot_t;
+
+static stream_slot_t s_slots[STREAM_CACHE_SLOTS];
+static int s_latest = -1;
+static uint32_t s_seq = 0;
+static volatile int s_viewers = 0;
+static SemaphoreHandle_t s_mutex = nullptr;
+// Clients waiting for a newer frame, woken with a task notification. A client registers while it holds the mutex
+// and has just seen no newer frame, so a frame published right after always wakes it.
+static TaskHandle_t s_waiters[STREAM_CACHE_MAX_WAITERS];
+
+// Producer: encodes the newest frame of the node once and publishes it for every client
+class StreamCacheTask : public who::task::WhoTask {
+public:
+    static inline constexpr EventBits_t NEW_FRAME = WhoFrameCapNode::NEW_FRAME;
+
+    StreamCacheTask(WhoFrameCapNode *node) :
+        who::task::WhoTask("StreamCache"), m_node(node), m_last_encode_us(0), m_frame_interval_us(0)
+    {
+        node->add_new_frame_signal_subscriber(this);
+        who_jpeg_rc_config_t rc_config = {
+            .target_bytes = CONFIG_STREAM_JPEG_TARGET_KB * 1024,
+            .quality = CONFIG_STREAM_JPEG_QUALITY,
+            .min_quality = CONFIG_STREAM_JPEG_MIN_QUALITY,
+            .max_quality = CONFIG_STREAM_JPEG_MAX_QUALITY,
+        };
+        who_jpeg_rc_init(&m_rc, &rc_config);
+    }
+
+private:
+    void task() override
+    {
+        while (true) {
+            EventBits_t event_bits =
+                xEventGroupWaitBits(m_event_group, NEW_FRAME | TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+            if (event_bits & TASK_STOP) {
+                break;
+            } else if (event_bits & TASK_PAUSE) {
+                xEventGroupSetBits(m_event_group, TASK_PAUSED);
+                EventBits_t pause_event_bits =
+                    xEventGroupWaitBits(m_event_group, TASK_RESUME | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+                if (pause_event_bits & TASK_STOP) {
+                    break;
+                } else {
+                    continue;
+                }
+            }
+            // Nobody is watching, don't spend cpu on encoding
+            if (s_viewers <= 0) {
+                continue;
+            }
+            // Lease the frame, the encode may take longer than the frame stays in the ringbuf
+            auto fb = m_node->cam_fb_lease();
+            if (fb) {
+                encode_and_publish(fb);
+                m_node->cam_fb_release(fb);
+            }
+        }
+        xEventGroupSetBits(m_event_group, TASK_STOPPED);
+        vTaskDelete(NULL);
+    }
+
+    // Only the producer writes slots, and clients only acquire the newest one. So a slot which is not the newest
+    // and not referenced can be filled without holding the mutex.
+    int get_free_slot()
+    {
+        int idx = -1;
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        for (int i = 0; i < STREAM_CACHE_SLOTS; i++) {
+            if (i != s_latest && s_slots[i].refs == 0) {
+                idx = i;
+                break;
+            }
+        }
+        xSemaphoreGive(s_mutex);
+        return idx;
+    }
+
+    void encode_and_publish(cam_fb_t *fb)
+    {
+        int idx = get_free_slot();
+        if (idx < 0) {
+            // All slots are held by slow clients, skip this frame
+            return;
+        }
+        stream_slot_t *slot = &s_slots[idx];
+        if (slot->jpg) {
+            jpeg_pool_free(slot->jpg);
+            slot->jpg = nullptr;
+        }
+        uint8_t *jpg_buf = nullptr;
+        size_t jpg_len = 0;
+        if (fb->format == cam_fb_fmt_t::CAM_FB_FMT_JPEG) {
+            jpg_buf = jpeg_pool_copy((const uint8_t *)fb->buf, fb->len);
+            jpg_len = fb->len;
+        } else if (fb->format == cam_fb_fmt_t::CAM_FB_FMT_RGB565) {
+            update_bitrate_target();
+            uint8_t quality = who_jpeg_rc_get_quality(&m_rc);
+            bool overflow = false;
+            jpg_buf = jpeg_pool_encode((const uint8_t *)fb->buf,
+                                       fb->len,
+                                       fb->width,
+                                       fb->height,
+                                       PIXFORMAT_RGB565,
+                                       quality,
+                                       &jpg_len,
+                                       &overflow);
+            if (jpg_buf) {
+                who_jpeg_rc_update(&m_rc, jpg_len);
+                ESP_LOGD(TAG, "quality %u, %u bytes", quality, (unsigned)jpg_len);
+            } else if (overflow) {
+                // Without a size the controller would keep the quality, and every later frame would overflow too
+                who_jpeg_rc_overflow(&m_rc);
+            }
+        } else {
+            ESP_LOGW(TAG, "unsupported frame format for streaming");
+            return;
+        }
+        if (!jpg_buf) {
+            ESP_LOGE(TAG, "jpeg encode failed");
+            return;
+        }
+
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        slot->jpg = jpg_buf;
+        slot->frame.buf = jpg_buf;
+        slot->frame.len = jpg_len;
+        slot->frame.seq = ++s_seq;
+        s_latest = idx;
+        // Wake every waiting client, they register again if they wait once more
+        for (auto &waiter : s_waiters) {
+            if (waiter) {
+                xTaskNotifyGive(waiter);
+                waiter = nullptr;
+            }
+        }
+        xSemaphoreGive(s_mutex);
+    }
+
+    // A bitrate target is a byte budget per frame at the rate frames are encoded
+    void update_bitrate_target()
+    {
+        int64_t now = esp_timer_get_time();
+        int64_t interval_us = now - m_last_encode_us;
+        m_last_encode_us = now;
+        if (CONFIG_STREAM_JPEG_BITRATE_KBPS == 0 || interval_us <= 0) {
+            return;
+        }
+        // After a pause without viewers the interval says nothing about the frame rate, start the average over and
+        // keep the last budget until the next frame
+        if (interval_us > 1000000) {
+            m_frame_interval_us = 0;
+            return;
+        }
+        // Smoothed, the budget shouldn't follow the jitter of single frames
+        m_frame_interval_us = m_frame_interval_us ? (m_frame_interval_us * 7 + interval_us) / 8 : interval_us;
+        int64_t target = (int64_t)CONFIG_STREAM_JPEG_BITRATE_KBPS * 1000 / 8 * m_frame_interval_us / 1000000;
+        // Leave room in the pool buffer for a frame above the budget
+        target = std::min<int64_t>(target, jpeg_pool_get_slot_size() * 3 / 4);
+        who_jpeg_rc_set_target(&m_rc, std::max<int64_t>(target, 1));
+    }
+
+    WhoFrameCapNode *m_node;
+    who_jpeg_rc_t m_rc;
+    int64_t m_last_encode_us;
+    int64_t m_frame_interval_us;
+};
+
+static StreamCacheTask *s_task = nullptr;
+
+bool stream_cache_start(WhoFrameCapNode *node,
+                        const configSTACK_DEPTH_TYPE uxStackDepth,
+                        UBaseType_t uxPriority,
+                        const BaseType_t xCoreID)
+{
+    if (s_task) {
+        return true;
+    }
+    s_mutex = xSemaphoreCreateMutex();
+    if (!s_mutex) {
+        ESP_LOGE(TAG, "failed to create sync objects");
+        return false;
+    }
+    s_task = new StreamCacheTask(node);
+    return s_task->run(uxStackDepth, uxPriority, xCoreID);
+}
+
+extern "C" void stream_cache_viewer_add(void)
+{
+    __atomic_add_fetch(&s_viewers, 1, __ATOMIC_RELAXED);
+}
+
+extern "C" void stream_cache_viewer_remove(void)
+{
+    __atomic_sub_fetch(&s_viewers, 1, __ATOMIC_RELAXED);
+}
+
+// Without a newer frame the calling task is registered as a waiter, *waiting tells if there was room for it.
+static const stream_jpeg_t *try_acquire_newer(uint32_t last_seq, bool *waiting)
+{
+    const stream_jpeg_t *ret = nullptr;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    *waiting = false;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (s_latest >= 0 && s_slots[s_latest].frame.seq != last_seq) {
+        s_slots[s_latest].refs++;
+        ret = &s_slots[s_latest].frame;
+    }
+    for (auto &waiter : s_waiters) {
+        if (waiter == self) {
+            waiter = nullptr;
+        }
+        if (!ret && !*waiting && !waiter) {
+            waiter = self;
+            *waiting = true;
+        }
+    }
+    xSemaphoreGive(s_mutex);
+    return ret;
+}
+
+static void remove_waiter(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    for (auto &waiter : s_waiters) {
+        if (waiter == self) {
+            waiter = nullptr;
+        }
+    }
+    xSemaphoreGive(s_mutex);
+}
+
+extern "C" const stream_jpeg_t *stream_cache_acquire(uint32_t last_seq, TickType_t timeout)
+{
+    if (!s_task) {
+        return nullptr;
+    }
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        bool waiting;
+        const stream_jpeg_t *frame = try_acquire_newer(last_seq, &waiting);
+        if (frame) {
+            return frame;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            remove_waiter();
+            return nullptr;
+        }
+        if (waiting) {
+            // A notification left over from an earlier timed out wait only costs one more check
+            ulTaskNotifyTake(pdTRUE, timeout - elapsed);
+        } else {
+            // Every waiter slot is taken, poll
+            vTaskDelay(1);
+        }
+    }
+}
+
+extern "C" void stream_cache_release(const stream_jpeg_t *frame)
+{
+    if (!frame) {
+        return;
+    }
+    stream_slot_t *slot = (stream_slot_t *)frame;
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    slot->refs--;
+    xSemaphoreGive(s_mutex);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One JPEG encoded frame shared by every /stream client.
+// A client holds a reference while it sends the bytes, the producer never touches a referenced slot.
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    uint32_t seq;
+} stream_jpeg_t;
+
+// Register / unregister a stream client. The producer only encodes while at least one client is registered.
+void stream_cache_viewer_add(void);
+void stream_cache_viewer_remove(void);
+
+// Get the newest frame with seq > last_seq, waiting up to timeout for one to be produced.
+// Returns NULL on timeout or if the cache is not started. Must be paired with stream_cache_release().
+const stream_jpeg_t *stream_cache_acquire(uint32_t last_seq, TickType_t timeout);
+void stream_cache_release(const stream_jpeg_t *frame);
+
+#ifdef __cplusplus
+}
+
+#include "who_frame_cap.hpp"
+
+// Start the producer task which encodes every new frame of the node once for all clients.
+// Must be called before the app is run, as every WhoTask has to be created before Yield2Idle starts.
+bool stream_cache_start(who::frame_cap::WhoFrameCapNode *node,
+                        const configSTACK_DEPTH_TYPE uxStackDepth,
+                        UBaseType_t uxPriority,
+                        const BaseType_t xCoreID);
+#endif
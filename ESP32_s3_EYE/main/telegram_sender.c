@@ -238,31 +238,16 @@ static bool send_jpeg_to_supabase(const uint8_t *jpg, size_t jpg_len, const char
     return true;
 }
 
-http_success_t send_rgb565_image(const uint8_t *rgb565,
-                                             uint16_t width,
-                                             uint16_t height,
-                                             uint8_t quality,
-                                             const char *caption)
+// The image is encoded once when the snapshot is taken, here we only upload it
+http_success_t send_jpeg_image(const uint8_t *jpg, size_t jpg_len, const char *caption)
 {
     http_success_t result = { .telegram_ok = false, .supabase_ok = false };
-    if (!rgb565 || width == 0 || height == 0) {
-        return result;
-    }
-    // create buffer for JPEG conversion
-    uint8_t *jpg_buf = NULL;
-    size_t jpg_len = 0;
-    size_t src_len = (size_t)width * height * 2;
-    // convert to JPEG
-    bool conv = fmt2jpg((uint8_t *)rgb565, src_len, width, height, PIXFORMAT_RGB565, quality, &jpg_buf, &jpg_len);
-    if (!conv || !jpg_buf) {
-        ESP_LOGE(TAG, "fmt2jpg failed");
+    if (!jpg || jpg_len == 0) {
         return result;
     }
     // send the JPEG buffer to Telegram
-    result.telegram_ok = send_jpeg_to_telegram(jpg_buf, jpg_len, caption);
+    result.telegram_ok = send_jpeg_to_telegram(jpg, jpg_len, caption);
     // send the JPEG buffer to Supabase
-    result.supabase_ok = send_jpeg_to_supabase(jpg_buf, jpg_len, caption);
-    // Free the JPEG buffer
-    free(jpg_buf);
+    result.supabase_ok = send_jpeg_to_supabase(jpg, jpg_len, caption);
     return result;
 }